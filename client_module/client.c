@@ -9,24 +9,77 @@
  * Caroline Chung - November 12, 2024
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#ifdef HEADLESS
+#include "headless.h"   // draw into memory; see headless.h
+#else
 #include <curses.h>
+#endif
 #include "ctype.h"
 #include "message.h"
+#include "wire.h"
 #include "log.h"
 #include "mem.h"
 
+#define STATUS_MAX 256  // status line buffer size; longer lines are truncated
+#define KEY_MESSAGE_MAX 24  // KEY message buffer size
+#define UNACKED_MAX 64      // predicted keys awaiting the server's DISPLAY
+#define BATCH_MAX 64        // most keys sent in one KEYS message
+#define BATCH_MS 30         // how long to gather keys for one KEYS message
+#define RESIZE_SECONDS 0.5  // idle time after which to look for a resized window
+#define KEY_ACK_MS 1000     // without CAPS, how long a key may go unnumbered
+
 /**************** global types ****************/
 // struct to hold necessary starting info for client to intitialize game
 typedef struct client {
   addr_t server;
-  char* statusLine;
+  char statusLine[STATUS_MAX];   // status from the latest GOLD
+  char statusText[2 * STATUS_MAX]; // status line as drawn, with any additions
   char playerSymbol;
   bool isSpectator;
   bool isQuitting;
+  int mapRows;           // map dimensions, from GRID
+  int mapCols;
+  int rows;              // cells shown: the map or, with "view", a window
+  int cols;              //   on it that fits the screen
+  int viewTop;           // where the newest window lies on the map
+  int viewLeft;
+  char* frame;           // rows*cols cells currently on screen, row-major
+  char* latest;          // rows*cols cells of the newest DISPLAY received
+  bool displayDirty;     // latest differs from what has been drawn
+  bool statusDirty;      // statusLine needs to be drawn
+  int goldReceived;      // gold picked up since the status line was drawn
+
+  // movement prediction (-p)
+  bool predict;          // move '@' locally before the server confirms
+  char* confirmed;       // rows*cols cells of the newest DISPLAY received
+  char* terrain;         // rows*cols remembered floor ('.' or '#') per cell
+  unsigned int nextSeq;  // number for the next movement key
+  int unackedCount;      // keys sent but not yet reflected in a DISPLAY
+  long unackedSince;     // when the oldest of them was sent (ms)
+  bool keysAcked;        // a DISPLAY has carried a key number
+  char unackedKey[UNACKED_MAX];
+  unsigned int unackedSeq[UNACKED_MAX];
+
+  // input batching (-b)
+  bool batchKeys;        // send keys typed close together as one KEYS
+  char lastBatch[BATCH_MAX];       // keys of the last KEYS sent, in case
+  int lastBatchCount;              // the server turns out not to know KEYS
+  unsigned int lastBatchSeq;       // number of its first key, if predicting
+
+  // protocol options (wire.h); offered unless -t
+  bool textOnly;         // do not offer any options
+  bool udpOnly;          // do not use shared memory with a local server
+  bool capsPending;      // CAPS sent, the server has not answered yet
+  int caps;              // the options the server accepted
 } client_t;
 
 /************* function prototypes ************/
@@ -34,16 +87,38 @@ void parseArgs(client_t* client, int argc, char* argv[]);
 static void initializeDisplay(); 
 static bool handleServerMessage(void* arg, const addr_t from, const char* message);
 bool handleClientInput(void* arg);
-void updateDisplay(char* gameState);
+void updateDisplay(client_t* client);
 void displayStatusLine(const char* message);
 
 /* helper functions for handleServerMessage */
 void handleGridMessage(client_t* client, const char* message);
 void handleGoldMessage(client_t* client, const char* message); 
 void handleOkMessage(client_t* client, const char* message); 
+static void handleBinaryMessage(client_t* client, const char* message, size_t length);
+static void applyGrid(client_t* client, int rows, int cols);
+static void applyGold(client_t* client, int n, int p, int r);
+static void applyOk(client_t* client, char playerSymbol);
+static void applyDisplay(client_t* client, const wire_frame_t* frame,
+                         const char* text, bool hasSeq, unsigned int seq,
+                         int top, int left);
+static void sendKey(client_t* client, char key, bool sequenced, unsigned int seq);
 static void handleQuitMessage(client_t* client, const char* message);
 static void handleErrorMessage(client_t* client, const char* message);
 static void handleDisplayMessage(client_t* client, const char* message);
+static void handleViewMessage(client_t* client, const char* message);
+static void handleStateMessage(client_t* client, const char* message);
+static void scrollView(client_t* client, int top, int left);
+static void sendSize(client_t* client);
+static void handleResize(client_t* client);
+static bool handleIdle(void* arg);
+static void renderPending(client_t* client);
+static void parseCells(client_t* client, const char* display, char* cells);
+static void reconcile(client_t* client, bool hasAck, unsigned int ack);
+static void predictKey(client_t* client, char key);
+static long nowMs(void);
+static unsigned int trackKey(client_t* client, char key);
+static int sendKeyBatch(client_t* client, char first);
+static bool isMovementKey(int key);
 void displayErrorMessage(client_t* client);
 /***************************************************/
 
@@ -51,7 +126,19 @@ void displayErrorMessage(client_t* client);
 /******************* main ********************/
 int main(int argc, char* argv[]) 
 {
-  FILE* log = fopen("client.log", "w");
+#ifdef HEADLESS
+  // bots run side by side in one directory, so each logs to $CLIENT_LOG,
+  // or else to a file of its own
+  char logPath[32];
+  const char* logName = getenv("CLIENT_LOG");
+  if (logName == NULL) {
+    snprintf(logPath, sizeof(logPath), "client-%d.log", (int)getpid());
+    logName = logPath;
+  }
+#else
+  const char* logName = "client.log";
+#endif
+  FILE* log = fopen(logName, "w");
   if (log == NULL) {
     fprintf(stderr, "Error opening log file\n");
     exit(1);
@@ -69,17 +156,8 @@ int main(int argc, char* argv[])
   // Initialize the allocated memory to zero
   memset(client, 0, sizeof(client_t));
 
-  // allocate memory for statusLine
-  client->statusLine = mem_malloc(message_MaxBytes);  // check for memory allocation failure
-  if (client->statusLine == NULL) {
-    fprintf(stderr, "Error: Memory allocation failed for statusLine\n");
-    mem_free(client);  
-    exit(1);
-  }
-
   // initialize message module
   if (message_init(NULL) == 0) {
-    mem_free(client->statusLine);
     mem_free(client);
     log_e("Initialization of message module failed");
     exit(1);
@@ -94,17 +172,30 @@ int main(int argc, char* argv[])
   log_v("Display initialized");
 
   log_v("Message loop started");
-  bool ok = message_loop(client, 0, NULL, handleClientInput, handleServerMessage);
+  bool ok = message_loop(client, RESIZE_SECONDS, handleIdle, handleClientInput,
+                         handleServerMessage);
   log_v("Message loop ended");
 
   // clean up
   log_v("Cleaning up resources");
   message_done();
   log_done();
-  if (client->statusLine != NULL) {
-    mem_free(client->statusLine);
-    client->statusLine = NULL;
-  }  
+  if (client->frame != NULL) {
+    mem_free(client->frame);
+    client->frame = NULL;
+  }
+  if (client->latest != NULL) {
+    mem_free(client->latest);
+    client->latest = NULL;
+  }
+  if (client->confirmed != NULL) {
+    mem_free(client->confirmed);
+    client->confirmed = NULL;
+  }
+  if (client->terrain != NULL) {
+    mem_free(client->terrain);
+    client->terrain = NULL;
+  }
   mem_free(client); 
   endwin();
   return ok? 0 : 1;
@@ -114,10 +205,34 @@ int main(int argc, char* argv[])
 /* see client.h for description */
 void parseArgs(client_t* client, int argc, char* argv[])
 {
+  // options come first: -p turns on movement prediction, -b key batching,
+  // -t keeps to the plain text protocol, -u to UDP
+  int opt;
+  while ((opt = getopt(argc, argv, "pbtu")) != -1) {
+    if (opt == 'p') {
+      client->predict = true;
+    }
+    else if (opt == 'b') {
+      client->batchKeys = true;
+    }
+    else if (opt == 't') {
+      client->textOnly = true;
+    }
+    else if (opt == 'u') {
+      client->udpOnly = true;
+    }
+    else {
+      optind = argc + 1; // force the usage error below
+      break;
+    }
+  }
+  argc -= optind - 1; // from here on, argv[1] is the hostname
+  argv += optind - 1;
+
   // validate command line length
   if (argc < 3 || argc > 4) {
     log_e("Invalid command-line arguments");
-    fprintf(stderr, "Usage: ./client hostname port [username] (username is optional)\n");
+    fprintf(stderr, "Usage: ./client [-p] [-b] [-t] [-u] hostname port [username] (username is optional)\n");
     exit(1); // invalid command line arguments
   }
 
@@ -133,11 +248,32 @@ void parseArgs(client_t* client, int argc, char* argv[])
 
   client->isQuitting = false;
 
+  // a server on this host is reached through shared memory, if it can be
+  if (!client->udpOnly && message_attachLocal(client->server)) {
+    log_v("Server reached through shared memory");
+  }
+
+  // offer the binary encoding, with compressed DISPLAYs, reliable
+  // delivery (message_loop acknowledges for us, once the server is
+  // accepted), windows that fit the screen, GOLD and DISPLAY in one STATE
+  // message, and (to predict moves) DISPLAYs numbered with the last key
+  // handled; an older server answers with an ERROR
+  if (!client->textOnly) {
+    message_acceptReliable(client->server);
+    char capsMessage[64];
+    wire_formatCaps(wire_CapBinary | wire_CapRle | wire_CapReliable | wire_CapView
+                    | wire_CapState | (client->predict ? wire_CapSeq : 0),
+                    capsMessage, sizeof(capsMessage));
+    message_send(client->server, capsMessage);
+    log_s("Message sent: %s", capsMessage);
+    client->capsPending = true;
+  }
+
   // determine if player or spectator
   if (argc == 4) { // fourth arg indicates player
     client->isSpectator = false;                         
     char playMessage[message_MaxBytes];
-    sprintf(playMessage, "PLAY %s", argv[3]); // add the player's name
+    snprintf(playMessage, sizeof(playMessage), "PLAY %s", argv[3]); // add the player's name
     message_send(client->server, playMessage);
     log_s("Message sent: %s", playMessage);
   }
@@ -155,6 +291,8 @@ static void initializeDisplay()
 {
   cbreak(); // accept keystrokes without needing to hit enter 
   noecho(); // don't echo to the screen
+  keypad(stdscr, true); // report a resized window as KEY_RESIZE (and other
+                        // function keys, which handleClientInput drops)
 }
 
 /******************* handleServerMessage *****************/
@@ -169,6 +307,15 @@ static bool handleServerMessage(void* arg, const addr_t from, const char* messag
     return false;
   }
 
+  if (wire_isBinary(message)) {
+    log_d("Message received: binary frame of %d bytes", (int)message_length());
+    handleBinaryMessage(client, message, message_length());
+    if (!message_pending()) {
+      renderPending(client);
+    }
+    return false;
+  }
+
   log_s("Message received: %s", message);
 
   if (strncmp(message, "GRID ", strlen("GRID ")) == 0) {
@@ -187,16 +334,42 @@ static bool handleServerMessage(void* arg, const addr_t from, const char* messag
   else if (strncmp(message, "ERROR", strlen("ERROR")) == 0) {
     handleErrorMessage(client, message);
   }
-  else if (strncmp(message, "DISPLAY\n", strlen("DISPLAY\n")) == 0) {
+  else if (strncmp(message, "CAPS", strlen("CAPS")) == 0) {
+    // the options the server accepted, from those we offered
+    client->caps = wire_parseCaps(message + strlen("CAPS"));
+    client->capsPending = false;
+    if (client->predict && !(client->caps & wire_CapSeq)) {
+      // predictions could never be reconciled
+      log_v("Server does not number DISPLAYs; movement prediction off");
+      client->predict = false;
+    }
+    if (client->caps & wire_CapView) {
+      sendSize(client);
+    }
+  }
+  else if (strncmp(message, "DISPLAY\n", strlen("DISPLAY\n")) == 0
+           || strncmp(message, "DISPLAY ", strlen("DISPLAY ")) == 0) {
     handleDisplayMessage(client, message);
   }
+  else if (strncmp(message, "VIEW ", strlen("VIEW ")) == 0) {
+    handleViewMessage(client, message);
+  }
+  else if (strncmp(message, "STATE ", strlen("STATE ")) == 0) {
+    handleStateMessage(client, message);
+  }
   else { // message not formatted correctly, log error
     displayErrorMessage(client);
     refresh();
     mvprintw(0, 0, "Error: message from server could not be read.\n");
+    refresh();
   }
-  refresh();
   log_s("Message (%s) was handled correctly!", message);
+
+  // DISPLAY and GOLD only record the newest state; draw it once the
+  // backlog of datagrams is drained, so the screen is never behind
+  if (!message_pending()) {
+    renderPending(client);
+  }
   return false; // keep the loop going
 }
 
@@ -207,11 +380,34 @@ void handleGridMessage(client_t* client, const char* message)
   int rows; // variable to hold integer from server message
   int cols; // variable to hold integer from server message
 
-  int width, height; // variables to hold screen dimensions
-
   // read the message to get the map dimensions
   if (sscanf(message, "GRID %d %d", &rows, &cols) == 2) {
+    applyGrid(client, rows, cols);
+  }
+  else {
+    displayErrorMessage(client);
+    refresh();
+  } 
+}
+
+/******************* applyGrid *****************/
+/* Check that the screen is large enough for a rows x cols map, and set up
+ * the frame grids for it; for GRID in either encoding.  If the server
+ * accepted "view", any screen will do: the grids are the part of the map
+ * that fits, below the status line, and the server sends just that.
+ */
+static void applyGrid(client_t* client, int rows, int cols)
+{
+  int width, height; // variables to hold screen dimensions
+
+  if (rows > 0 && cols > 0) {
     getmaxyx(stdscr, height, width);
+    client->mapRows = rows;
+    client->mapCols = cols;
+    if (client->caps & wire_CapView) {
+      rows = (rows < height - 1) ? rows : (height > 1 ? height - 1 : 1);
+      cols = (cols < width) ? cols : width;
+    }
 
     while (width < cols || height < rows) { // check to make sure screen dimensions are large enough
       mvprintw(0, 0, "Your window must be at least %d high", rows);
@@ -219,19 +415,122 @@ void handleGridMessage(client_t* client, const char* message)
       mvprintw(2, 0, "Resize your window, and press Enter to continue");
       refresh();
 
-      char ch = getch(); // if user presses enter, loop again to check
+      int ch = getch(); // if user presses enter, loop again to check
       if (ch == '\n') {
         getmaxyx(stdscr, height, width);
       }
     }
 
+    // remember the grid size and forget the previous frame; the screen is
+    // cleared, so the next DISPLAY must draw every cell
+    char* frame = mem_malloc(rows * cols);
+    char* latest = mem_malloc(rows * cols);
+    if (frame == NULL || latest == NULL) {
+      log_e("Memory allocation failed for frame buffer");
+      mem_free(frame);
+      mem_free(latest);
+      frame = latest = NULL;
+    }
+    if (client->frame != NULL) {
+      mem_free(client->frame);
+    }
+    if (client->latest != NULL) {
+      mem_free(client->latest);
+    }
+    client->frame = frame;
+    client->latest = latest;
+    client->rows = rows;
+    client->cols = cols;
+    client->viewTop = client->viewLeft = 0;
+    client->displayDirty = false;
+    if (client->frame != NULL) {
+      memset(client->frame, '\0', rows * cols); // matches no map character
+      memset(client->latest, ' ', rows * cols);
+    }
+
+    // prediction also needs the server's own frame and what lies under '@'
+    if (client->confirmed != NULL) {
+      mem_free(client->confirmed);
+      client->confirmed = NULL;
+    }
+    if (client->terrain != NULL) {
+      mem_free(client->terrain);
+      client->terrain = NULL;
+    }
+    if (client->predict && client->frame != NULL) {
+      client->confirmed = mem_malloc(rows * cols);
+      client->terrain = mem_malloc(rows * cols);
+      if (client->confirmed == NULL || client->terrain == NULL) {
+        log_e("Memory allocation failed for prediction; prediction off");
+        mem_free(client->confirmed);
+        mem_free(client->terrain);
+        client->confirmed = client->terrain = NULL;
+        client->predict = false;
+      }
+      else {
+        memset(client->confirmed, ' ', rows * cols);
+        memset(client->terrain, '.', rows * cols); // players start in rooms
+      }
+    }
+
     clear();
+    client->statusDirty = true; // cleared with the rest of the screen
     refresh();
   }
   else {
     displayErrorMessage(client);
     refresh();
-  } 
+  }
+}
+
+/******************* sendSize *****************/
+/* Tell a server that accepted "view" how much of the map fits on screen:
+ * all but the status line.
+ */
+static void sendSize(client_t* client)
+{
+  int width, height;
+  getmaxyx(stdscr, height, width);
+  char message[KEY_MESSAGE_MAX];
+  snprintf(message, sizeof(message), "SIZE %d %d", height > 1 ? height - 1 : 1, width);
+  message_send(client->server, message);
+  log_s("Message sent: %s", message);
+}
+
+/******************* handleResize *****************/
+/* The terminal changed size.  With "view", fit the grids to it and ask the
+ * server for a window of the new size; otherwise there is nothing to do
+ * until the next GRID.
+ */
+static void handleResize(client_t* client)
+{
+  if (!(client->caps & wire_CapView)) {
+    return;
+  }
+  if (client->mapRows > 0) {
+    applyGrid(client, client->mapRows, client->mapCols);
+  }
+  sendSize(client);
+}
+
+/******************* handleIdle *****************/
+/* Nothing has happened for a while.  curses reports a resized window
+ * (KEY_RESIZE) only from a getch that finds no key waiting, which ours,
+ * called when a key has arrived, never do; so look now.
+ */
+static bool handleIdle(void* arg)
+{
+  client_t* client = (client_t*) arg;
+  timeout(0);
+  int key = getch();
+  timeout(-1);
+  if (key == KEY_RESIZE) {
+    handleResize(client);
+  }
+  else if (key != ERR) {
+    ungetch(key); // typed just now; handleClientInput will read it
+  }
+  return false;
 }
 
 /******************* handleGoldMessage *****************/
@@ -245,32 +544,7 @@ void handleGoldMessage(client_t* client, const char* message)
 
   // read the message for GOLD n p r format
   if (sscanf(message, "GOLD %d %d %d", &n, &p, &r) == 3) {
-    char* goldStatus = mem_malloc(message_MaxBytes);
-    // write status line for spectator
-    if (client->isSpectator) {
-      sprintf(goldStatus, "Spectator: %d nuggets unclaimed.", r);
-    }
-    else {
-      sprintf(goldStatus, "Player %c has %d nuggets (%d nuggets unclaimed).", client->playerSymbol, p, r);
-    }
-    
-    strcpy(client->statusLine, goldStatus); // copy gold status into status line 
-
-    // update status line if player collects gold to show 'GOLD received: n'
-    char gold_collected[strlen("GOLD received: ") + 5];
-    if (n > 0) {
-      sprintf(gold_collected, "GOLD received: %d", n);
-      char totalStatus[strlen(client->statusLine) + strlen(gold_collected) + 1];
-      sprintf(totalStatus, "%s %s", client->statusLine, gold_collected);
-      displayStatusLine(totalStatus);
-      refresh();
-    }
-    else{
-      displayStatusLine(client->statusLine);
-    }
-
-    refresh(); 
-    mem_free(goldStatus);
+    applyGold(client, n, p, r);
   }
   else {
     displayErrorMessage(client);
@@ -278,6 +552,24 @@ void handleGoldMessage(client_t* client, const char* message)
   }
 }
 
+/******************* applyGold *****************/
+/* Record a GOLD update, in either encoding, for renderPending to draw. */
+static void applyGold(client_t* client, int n, int p, int r)
+{
+  // write status line for spectator
+  if (client->isSpectator) {
+    snprintf(client->statusLine, STATUS_MAX, "Spectator: %d nuggets unclaimed.", r);
+  }
+  else {
+    snprintf(client->statusLine, STATUS_MAX, "Player %c has %d nuggets (%d nuggets unclaimed).", client->playerSymbol, p, r);
+  }
+
+  // the line is drawn by renderPending; if several GOLD messages arrive
+  // before then, report all the gold they picked up
+  client->goldReceived += n;
+  client->statusDirty = true;
+}
+
 /******************* handleOkMessage *****************/
 /* see client.h for description */
 void handleOkMessage(client_t* client, const char* message) 
@@ -286,15 +578,7 @@ void handleOkMessage(client_t* client, const char* message)
 
   // parse the message for the player symbol
   if (sscanf(message, "OK %c", &playerSymbol) == 1) {
-    // check to make sure it is a letter
-    if (isalpha(playerSymbol)) {
-      // store playersymbol in game state
-      client->playerSymbol = playerSymbol;
-    }
-    else {
-      fprintf(stderr, "Error: Invalid player symbol %c received from server\n", playerSymbol);
-      return;
-    }
+    applyOk(client, playerSymbol);
   }
   else {
     displayErrorMessage(client);
@@ -302,6 +586,58 @@ void handleOkMessage(client_t* client, const char* message)
   }
 }
 
+/******************* applyOk *****************/
+/* Record the player's letter, from OK in either encoding. */
+static void applyOk(client_t* client, char playerSymbol)
+{
+  // check to make sure it is a letter
+  if (isalpha(playerSymbol)) {
+    // store playersymbol in game state
+    client->playerSymbol = playerSymbol;
+  }
+  else {
+    fprintf(stderr, "Error: Invalid player symbol %c received from server\n", playerSymbol);
+  }
+}
+
+/******************* handleBinaryMessage *****************/
+/* Decode a binary frame (wire.h) and apply it like its text counterpart. */
+static void handleBinaryMessage(client_t* client, const char* message, size_t length)
+{
+  wire_frame_t frame;
+  if (!wire_decode(message, length, &frame)) {
+    log_e("Malformed binary frame from server");
+    displayErrorMessage(client);
+    refresh();
+    return;
+  }
+  switch (frame.type) {
+  case wire_Ok:
+    applyOk(client, frame.letter);
+    break;
+  case wire_Grid:
+    applyGrid(client, frame.a, frame.b);
+    break;
+  case wire_Gold:
+    applyGold(client, frame.a, frame.b, frame.c);
+    break;
+  case wire_State:
+    applyGold(client, frame.gold[0], frame.gold[1], frame.gold[2]);
+    // fall through: the rest is a DISPLAY
+  case wire_Display:
+    if ((int)frame.a != client->rows || (int)frame.b != client->cols) {
+      log_e("Binary DISPLAY does not match the GRID size");
+      return;
+    }
+    applyDisplay(client, &frame, NULL, frame.hasSeq, frame.seq,
+                 frame.hasView ? frame.top : 0, frame.hasView ? frame.left : 0);
+    break;
+  default:
+    displayErrorMessage(client);
+    refresh();
+  }
+}
+
 /******************* handleQuitMessage *****************/
 /* see client.h for description */
 static void handleQuitMessage(client_t* client, const char* message)
@@ -329,58 +665,332 @@ static void handleErrorMessage(client_t* client, const char* message)
 {
   // make pointer to start of error explanation
   // start at beginning of error message from server 
-  char* errorExplanation = strstr(message, "ERROR ");
-  if (errorExplanation != NULL) {
-    // skip "ERROR " by adding 6
-    errorExplanation += 6;
-  }
-  else {
+  const char* errorExplanation = strstr(message, "ERROR ");
+  if (errorExplanation == NULL) {
     displayErrorMessage(client);
     refresh();
+    return;
+  }
+  // skip "ERROR " by adding 6
+  errorExplanation += 6;
+
+  // a server that does not know CAPS; keep to plain text
+  if (client->capsPending && strcmp(errorExplanation, "Unrecognized command") == 0) {
+    log_v("Server does not accept CAPS; plain text protocol");
+    client->capsPending = false;
+    return;
+  }
+
+  // a server that does not know KEYS; send that batch one key at a time
+  // and stop batching
+  if (client->batchKeys && client->lastBatchCount > 0
+      && strcmp(errorExplanation, "Unrecognized command") == 0) {
+    log_v("Server does not accept KEYS; key batching off");
+    client->batchKeys = false;
+    for (int i = 0; i < client->lastBatchCount; i++) {
+      sendKey(client, client->lastBatch[i], client->predict, client->lastBatchSeq + i);
+    }
+    client->lastBatchCount = 0;
+    return;
   }
 
-  char* totalStatus = mem_malloc(message_MaxBytes);
   // add the error explanation to the current statusline 
-  sprintf(totalStatus, "%s %s", client->statusLine, errorExplanation);
+  snprintf(client->statusText, sizeof(client->statusText), "%s %s", client->statusLine, errorExplanation);
 
-  displayStatusLine(totalStatus);
+  displayStatusLine(client->statusText);
   refresh();
-  mem_free(totalStatus);
+  client->statusDirty = false; // the error line already includes the status
 }
 
 /******************* handleDisplayMessage *****************/
 /* see client.h for description */
 static void handleDisplayMessage(client_t* client, const char* message)
 {
-  // skip the "DISPLAY\n" portion of the message to retrieve the display itself
-  char* displayMessage = strstr(message, "DISPLAY\n");
-  if (displayMessage != NULL) {
-    displayMessage += 9; // skip nine chars for "DISPLAY\n"
+  // skip the "DISPLAY\n" (or "DISPLAY seq\n") line to retrieve the display itself
+  const char* displayMessage = strchr(message, '\n');
+  if (displayMessage == NULL) {
+    displayErrorMessage(client);
+    refresh();
+    return;
+  }
+  displayMessage++;
+
+  // without a frame buffer (no GRID yet), repaint everything right away
+  if (client->latest == NULL) {
+    for (int row = 1; row < LINES; row++) { // for every line below the status line
+      move(row, 0); // go the the start of the line with the cursor
+      clrtoeol(); // clear it
+    }
+    mvprintw(1, 0, "%s", displayMessage);
+    refresh();
+    return;
+  }
+
+  unsigned int seq;
+  bool hasSeq = (sscanf(message + strlen("DISPLAY"), " %u", &seq) == 1);
+  applyDisplay(client, NULL, displayMessage, hasSeq, seq, 0, 0);
+}
+
+/******************* handleViewMessage *****************/
+/* "VIEW top left [seq]" and the rows of a window on the map ("view"). */
+static void handleViewMessage(client_t* client, const char* message)
+{
+  const char* rows = strchr(message, '\n');
+  char header[KEY_MESSAGE_MAX * 2];
+  int top, left;
+  unsigned int seq;
+  int fields = 0;
+  if (rows != NULL && rows - message < sizeof(header)) {
+    memcpy(header, message, rows - message);
+    header[rows - message] = '\0';
+    fields = sscanf(header, "VIEW %d %d %u", &top, &left, &seq);
+  }
+  if (fields < 2 || top < 0 || left < 0) {
+    displayErrorMessage(client);
+    refresh();
+    return;
+  }
+  if (client->latest != NULL) {
+    applyDisplay(client, NULL, rows + 1, fields == 3, seq, top, left);
+  }
+}
+
+/******************* handleStateMessage *****************/
+/* "STATE n p r", then a DISPLAY or VIEW message ("state"). */
+static void handleStateMessage(client_t* client, const char* message)
+{
+  int n, p, r;
+  const char* display = strchr(message, '\n');
+  if (display == NULL || sscanf(message, "STATE %d %d %d", &n, &p, &r) != 3) {
+    displayErrorMessage(client);
+    refresh();
+    return;
+  }
+  applyGold(client, n, p, r);
+
+  display++;
+  if (strncmp(display, "VIEW ", strlen("VIEW ")) == 0) {
+    handleViewMessage(client, display);
+  }
+  else if (strncmp(display, "DISPLAY", strlen("DISPLAY")) == 0) {
+    handleDisplayMessage(client, display);
   }
   else {
     displayErrorMessage(client);
     refresh();
   }
+}
 
-  // copy the game state
-  char* gameState = mem_malloc(message_MaxBytes);
-  if (gameState == NULL) {
-    fprintf(stderr, "Error: Memory allocation failed for gameState\n");
+/******************* applyDisplay *****************/
+/* Record the cells of a DISPLAY: a binary frame (copied, or expanded if
+ * run-length encoded), or else the text rows.  They are the window at
+ * (top, left) on the map, which is (0, 0) unless the server sent a VIEW.
+ * renderPending draws them once no more messages wait.
+ */
+static void applyDisplay(client_t* client, const wire_frame_t* frame,
+                         const char* text, bool hasSeq, unsigned int seq,
+                         int top, int left)
+{
+  if (top != client->viewTop || left != client->viewLeft) {
+    scrollView(client, top, left);
+  }
+  bool predicting = (client->predict && client->confirmed != NULL);
+  char* target = predicting ? client->confirmed : client->latest;
+  if (frame != NULL) {
+    if (!wire_decodeCells(frame, target)) {
+      log_e("Malformed binary DISPLAY from server");
+      return;
+    }
+  }
+  else {
+    parseCells(client, text, target);
+  }
+  if (predicting) {
+    reconcile(client, hasSeq, seq);
+  }
+  client->displayDirty = true;
+}
+
+/******************* scrollView *****************/
+/* The window has moved to (top, left) on the map.  The screen is redrawn
+ * cell by cell as usual, but the floor remembered for prediction moves
+ * with the map; cells that come into view are taken to be room floor, as
+ * at the start.
+ */
+static void scrollView(client_t* client, int top, int left)
+{
+  int down = top - client->viewTop;
+  int right = left - client->viewLeft;
+  client->viewTop = top;
+  client->viewLeft = left;
+  if (client->terrain == NULL) {
     return;
   }
-  strcpy(gameState, displayMessage);
+  char* moved = mem_malloc(client->rows * client->cols);
+  if (moved == NULL) {
+    memset(client->terrain, '.', client->rows * client->cols);
+    return;
+  }
+  for (int row = 0; row < client->rows; row++) {
+    for (int col = 0; col < client->cols; col++) {
+      int fromRow = row + down;
+      int fromCol = col + right;
+      bool inside = fromRow >= 0 && fromRow < client->rows
+                    && fromCol >= 0 && fromCol < client->cols;
+      moved[row * client->cols + col] =
+        inside ? client->terrain[fromRow * client->cols + fromCol] : '.';
+    }
+  }
+  mem_free(client->terrain);
+  client->terrain = moved;
+}
 
-  updateDisplay(gameState);
+/******************* parseCells *****************/
+/* Copy the rows of a DISPLAY into a rows*cols grid, in place from the
+ * receive buffer; cells past the end of a short line are blank.
+ */
+static void parseCells(client_t* client, const char* display, char* cells)
+{
+  const char* line = display;
+  for (int row = 0; row < client->rows; row++) {
+    char* rowCells = cells + row * client->cols;
+
+    int col = 0;
+    for (; col < client->cols && line[col] != '\0' && line[col] != '\n'; col++) {
+      rowCells[col] = line[col];
+    }
+    const char* next = line + col;
+    for (; col < client->cols; col++) {
+      rowCells[col] = ' ';
+    }
 
-  mem_free(gameState);
+    // advance to the next line of the message
+    while (*next != '\0' && *next != '\n') {
+      next++;
+    }
+    line = (*next == '\n') ? next + 1 : next;
+  }
+}
+
+/******************* reconcile *****************/
+/* A DISPLAY has just been parsed into 'confirmed'.  Drop the predicted keys
+ * it reflects, up to key number 'ack' (if the DISPLAY carried one), and
+ * rebuild 'latest' by replaying the keys still outstanding on top of
+ * the server's frame.  So a wrong guess lasts only until the next DISPLAY.
+ */
+static void reconcile(client_t* client, bool hasAck, unsigned int ack)
+{
+  int cells = client->rows * client->cols;
+
+  // remember the floor under every visible cell; gold lies on room floor
+  for (int i = 0; i < cells; i++) {
+    char c = client->confirmed[i];
+    if (c == '.' || c == '#') {
+      client->terrain[i] = c;
+    }
+    else if (c == '*') {
+      client->terrain[i] = '.';
+    }
+  }
+
+  if (hasAck) {
+    client->keysAcked = true;
+    int kept = 0;
+    for (int i = 0; i < client->unackedCount; i++) {
+      if ((int)(client->unackedSeq[i] - ack) > 0) { // sent after 'ack'
+        client->unackedKey[kept] = client->unackedKey[i];
+        client->unackedSeq[kept] = client->unackedSeq[i];
+        kept++;
+      }
+    }
+    client->unackedCount = kept;
+  }
+  else if (client->unackedCount > 0 && !client->keysAcked
+           && !(client->caps & wire_CapSeq)
+           && nowMs() - client->unackedSince > KEY_ACK_MS) {
+    // without CAPS, a DISPLAY without a number may just have been sent
+    // before the server read our first key; but one that comes long after
+    // means the server ignores key numbers, so predictions could never be
+    // reconciled; show only what the server sends from now on
+    log_v("Server does not acknowledge keys; movement prediction off");
+    client->predict = false;
+    client->unackedCount = 0;
+  }
+
+  memcpy(client->latest, client->confirmed, cells);
+  for (int i = 0; i < client->unackedCount; i++) {
+    predictKey(client, client->unackedKey[i]);
+  }
+}
+
+/******************* predictKey *****************/
+/* Move '@' in 'latest' as the server would for this key, as far as the
+ * client can tell: into known floor, passage or gold, but never into a
+ * wall, unknown space or another player, which the server decides.
+ */
+static void predictKey(client_t* client, char key)
+{
+  static const char* keys = "hljkyubn";
+  static const int dx[] = {-1, 1, 0, 0, -1, 1, -1, 1};
+  static const int dy[] = {0, 0, 1, -1, -1, -1, 1, 1};
+
+  const char* which = strchr(keys, tolower(key));
+  char* at = memchr(client->latest, '@', client->rows * client->cols);
+  if (which == NULL || *which == '\0' || at == NULL) {
+    return;
+  }
+  int dir = which - keys;
+  int index = at - client->latest;
+  int x = index % client->cols;
+  int y = index / client->cols;
+
+  do {
+    int newX = x + dx[dir];
+    int newY = y + dy[dir];
+    if (newX < 0 || newX >= client->cols || newY < 0 || newY >= client->rows) {
+      break;
+    }
+    char target = client->latest[newY * client->cols + newX];
+    if (target != '.' && target != '#' && target != '*') {
+      break;
+    }
+    client->latest[y * client->cols + x] = client->terrain[y * client->cols + x];
+    client->latest[newY * client->cols + newX] = '@';
+    x = newX;
+    y = newY;
+  } while (isupper(key)); // capitals run until blocked
+}
+
+/******************* renderPending *****************/
+/* Draw the newest display and status line, if either has changed since
+ * it was last drawn, and refresh the screen once.
+ */
+static void renderPending(client_t* client)
+{
+  if (client->statusDirty) {
+    if (client->goldReceived > 0) {
+      // update status line if player collects gold to show 'GOLD received: n'
+      snprintf(client->statusText, sizeof(client->statusText), "%s GOLD received: %d", client->statusLine, client->goldReceived);
+      displayStatusLine(client->statusText);
+    }
+    else {
+      displayStatusLine(client->statusLine);
+    }
+    client->goldReceived = 0;
+    client->statusDirty = false;
+    refresh();
+  }
+  if (client->displayDirty) {
+    updateDisplay(client);
+    client->displayDirty = false;
+  }
 }
 
 /******************* handleClientInput *****************/
 /* see client.h for description */
 bool handleClientInput(void* arg) 
 {
-  char inputCharacter; // int to hold client keystroke
-  char message[message_MaxBytes]; // buffer for holding client input
+  int inputCharacter; // int to hold client keystroke
   // cast arg to client struct pointer
   client_t* client = (client_t*) arg;
 
@@ -396,8 +1006,29 @@ bool handleClientInput(void* arg)
 
     // read one character from stdin
     inputCharacter = getch();
+    if (inputCharacter == KEY_RESIZE) {
+      handleResize(client);
+      return false;
+    }
+    if (client->batchKeys && isMovementKey(inputCharacter)) {
+      // send this key with any others typed right after it, and go on
+      // with the first other key, if one was typed
+      inputCharacter = sendKeyBatch(client, inputCharacter);
+      if (inputCharacter == '\0') {
+        return false;
+      }
+      if (inputCharacter == KEY_RESIZE) {
+        handleResize(client);
+        return false;
+      }
+    }
+    if (inputCharacter > UCHAR_MAX) {
+      // another function key, such as an arrow or Delete; as a char it
+      // would alias a letter (KEY_DC, 0x14A, is 'J'), so send nothing
+      return false;
+    }
     if (inputCharacter == EOF) { // check to make sure not EOF
-      message_send(client->server, "KEY Q");
+      sendKey(client, 'Q', false, 0);
       return true; // if it is stop looping
     } 
 
@@ -405,10 +1036,16 @@ bool handleClientInput(void* arg)
       client->isQuitting = true; // but don't return true to allow the loop one last loop
     }
 
-    // create the message to server
-    snprintf(message, sizeof(message), "KEY %c", inputCharacter);
-
-    message_send(client->server, message);
+    // send the key to the server
+    if (client->predict && client->latest != NULL && isMovementKey(inputCharacter)) {
+      // number the key, and move '@' now rather than after a round trip
+      unsigned int seq = trackKey(client, inputCharacter);
+      renderPending(client);
+      sendKey(client, inputCharacter, true, seq);
+    }
+    else {
+      sendKey(client, inputCharacter, false, 0);
+    }
   }
   else { // if spectator, the only key you can press is Q
     if (client->isQuitting) {
@@ -416,15 +1053,145 @@ bool handleClientInput(void* arg)
     }
 
     inputCharacter = getch();
-    if (inputCharacter == 'Q') {
+    if (inputCharacter == KEY_RESIZE) {
+      handleResize(client);
+    }
+    else if (inputCharacter == 'Q') {
       client->isQuitting = true; // but don't return true to allow the loop one last loop
-      message_send(client->server, "KEY Q");
+      sendKey(client, 'Q', false, 0);
     }
   }
 
   return false; // keep the message loo;p going
 }
 
+/******************* sendKey *****************/
+/* Send one key as "KEY k" or, numbered, "KEY k seq"; as a binary frame if
+ * the server accepted the binary encoding.
+ */
+static void sendKey(client_t* client, char key, bool sequenced, unsigned int seq)
+{
+  if (client->caps & wire_CapBinary) {
+    unsigned char frame[wire_MaxHeader];
+    message_sendBytes(client->server, frame, wire_encodeKey(frame, key, sequenced, seq));
+    return;
+  }
+  char message[KEY_MESSAGE_MAX];
+  if (sequenced) {
+    snprintf(message, sizeof(message), "KEY %c %u", key, seq);
+  }
+  else {
+    snprintf(message, sizeof(message), "KEY %c", key);
+  }
+  message_send(client->server, message);
+}
+
+/******************* isMovementKey *****************/
+/* True for the keys that move the player; never for a function key
+ * from getch, whose code is above UCHAR_MAX.
+ */
+static bool isMovementKey(int key)
+{
+  return key > 0 && key <= UCHAR_MAX && strchr("hljkyubnHLJKYUBN", key) != NULL;
+}
+
+/******************* nowMs *****************/
+/* Milliseconds on the monotonic clock. */
+static long nowMs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/******************* trackKey *****************/
+/* Number a movement key and, when predicting, remember it until the server
+ * reflects it, and move '@' now rather than after a round trip.
+ * Returns the key's number.
+ */
+static unsigned int trackKey(client_t* client, char key)
+{
+  unsigned int seq = ++client->nextSeq;
+  if (client->predict && client->latest != NULL && client->unackedCount < UNACKED_MAX) {
+    if (client->unackedCount == 0) {
+      client->unackedSince = nowMs();
+    }
+    client->unackedKey[client->unackedCount] = key;
+    client->unackedSeq[client->unackedCount] = seq;
+    client->unackedCount++;
+    predictKey(client, key);
+    client->displayDirty = true;
+  }
+  return seq;
+}
+
+/******************* sendKeyBatch *****************/
+/* Gather 'first' and the movement keys typed within BATCH_MS of it, and
+ * send them as one run-length encoded "KEYS keys [seq]" message, e.g.
+ * "KEYS 3h2jk" for hhhjjk.  The server applies them in order and updates
+ * everyone once.
+ * Returns the first non-movement key typed in that time, or '\0'.
+ */
+static int sendKeyBatch(client_t* client, char first)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long deadline = now.tv_sec * 1000 + now.tv_nsec / 1000000 + BATCH_MS;
+
+  char* keys = client->lastBatch;
+  int count = 0;
+  int other = '\0';
+  client->lastBatchSeq = client->nextSeq + 1;
+  keys[count++] = first;
+  trackKey(client, first);
+  renderPending(client);
+
+  while (count < BATCH_MAX) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long remaining = deadline - (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+    if (remaining <= 0) {
+      break;
+    }
+    timeout((int)remaining); // getch waits at most this long
+    int next = getch();
+    if (next == ERR) {
+      break; // nothing more was typed
+    }
+    if (!isMovementKey(next)) {
+      other = next;
+      break;
+    }
+    keys[count++] = next;
+    trackKey(client, next);
+    renderPending(client);
+  }
+  timeout(-1); // back to blocking reads
+  client->lastBatchCount = count;
+
+  // run-length encode: a run of n > 1 equal keys is written "nk"
+  char message[KEY_MESSAGE_MAX + 3 * BATCH_MAX];
+  int length = snprintf(message, sizeof(message), "KEYS ");
+  for (int i = 0; i < count; ) {
+    int run = 1;
+    while (i + run < count && keys[i + run] == keys[i]) {
+      run++;
+    }
+    if (run > 1) {
+      length += snprintf(message + length, sizeof(message) - length, "%d", run);
+    }
+    message[length++] = keys[i];
+    i += run;
+  }
+  message[length] = '\0';
+  if (client->predict) {
+    snprintf(message + length, sizeof(message) - length, " %u", client->nextSeq);
+  }
+
+  message_send(client->server, message);
+  log_s("Message sent: %s", message);
+  return other;
+}
+
 /******************* displayStatusLine *****************/
 /* see client.h for description */
 void displayStatusLine(const char* message)
@@ -438,22 +1205,38 @@ void displayStatusLine(const char* message)
 
 /******************* updateDisplay *****************/
 /* see client.h for description */
-void updateDisplay(char* gameState)
+void updateDisplay(client_t* client)
 { 
-  if (gameState == NULL) {
-    fprintf(stderr, "Error: NULL gameState in updateDisplay\n");
+  if (client->latest == NULL || client->frame == NULL) {
     return;
   }
 
-  // clear the current screen
-  for (int row = 1; row < LINES; row++) { // for every line below the status line
-    move(row, 0); // go the the start of the line with the cursor
-    clrtoeol(); // clear it
+  // compare the newest frame with the one on screen, cell by cell, and
+  // draw each run of changed cells in a row with one call
+  bool changed = false;
+  for (int row = 0; row < client->rows; row++) {
+    const char* cells = client->latest + row * client->cols;
+    char* old = client->frame + row * client->cols;
+
+    int col = 0;
+    while (col < client->cols) {
+      if (cells[col] == old[col]) {
+        col++;
+        continue;
+      }
+      int runStart = col;
+      while (col < client->cols && cells[col] != old[col]) {
+        old[col] = cells[col];
+        col++;
+      }
+      mvaddnstr(row + 1, runStart, cells + runStart, col - runStart); // row 0 is the status line
+      changed = true;
+    }
   }
 
-  // print the display 
-  mvprintw(1, 0, "%s", gameState);
-  refresh();
+  if (changed) {
+    refresh();
+  }
 }
 
 /****************** displayErrorMessage *********************/
@@ -461,9 +1244,7 @@ void updateDisplay(char* gameState)
 void displayErrorMessage(client_t* client) 
 {
     const char* errorMessage = "Malformed server message received.";
-    if (client->statusLine != NULL) {
-        snprintf(client->statusLine, message_MaxBytes, "%s", errorMessage);
-    }
+    snprintf(client->statusLine, STATUS_MAX, "%s", errorMessage);
     displayStatusLine(client->statusLine);
     refresh();
 }
\ No newline at end of file
@@ -36,10 +36,13 @@ typedef struct client client_t;
  *   client - a pointer to a client_t struct that holds all info needed about 
  *            client 
  *   argc - number of command line args
- *   argv - array of command line args
- *     argv[1] - hostname
- *     argv[2] - port where the client will connect to server
- *     argv[3] - playername (optional)
+ *   argv - array of command line args: [-p] [-b] [-t] hostname port [playername]
+ *     -p - predict movement locally (optional)
+ *     -b - batch movement keys into KEYS messages (optional)
+ *     -t - plain text protocol only; do not offer CAPS (optional)
+ *     hostname - hostname of the server
+ *     port - port where the client will connect to server
+ *     playername - (optional) join as this player, else spectate
  * Returns:
  *   nothing
  */
@@ -67,7 +70,7 @@ static void initializeDisplay();
  *   message - message received from the server
  * Notes:
  *   Server messages are expected to start with "OK", "GRID", "DISPLAY",
- *   "GOLD", "QUIT", or "ERROR"
+ *   "GOLD", "QUIT", "ERROR" or "CAPS", or to be binary frames (wire.h)
  * Returns:
  *   True to stop message_loop.  False to keep message_loop going.
  */
@@ -118,14 +121,21 @@ void displayStatusLine(const char* message);
 
 /******************* updateDisplay *****************/
 /*
- * updateDisplay - updates the display on screen for the user 
+ * updateDisplay - draws the newest display received on screen for the user 
  * 
  * Caller provides:
- *   gameState - the display with the map to be displayed on screen for the player
+ *   client - pointer to client_t struct, holding the newest display and
+ *            the frame currently on screen
+ * Notes:
+ *   only cells that differ from the frame on screen are drawn, a run at a
+ *   time, and the screen is not refreshed at all if nothing changed.  
+ *   DISPLAY messages only record the newest display; the client calls
+ *   updateDisplay once no further messages are waiting, so when the server
+ *   sends faster than the terminal can draw, stale frames are skipped.
  * Returns:
  *   nothing
  */
-void updateDisplay(char* gameState);
+void updateDisplay(client_t* client);
 
 /******************* handleOkMessage *****************/
 /*
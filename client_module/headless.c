@@ -0,0 +1,356 @@
+/*
+ * headless.c - an in-memory stand-in for ncurses, for the headless client
+ *
+ * see headless.h for more information.
+ *
+ * CS50 Nuggets, Team 10
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include "headless.h"
+#include "histogram.h"
+#include "wire.h"
+
+// this file calls the real message functions
+#undef message_send
+#undef message_sendBytes
+#undef message_loop
+
+#define SCREEN_ROWS 256
+#define SCREEN_COLS 512
+
+/**************** local types ****************/
+struct headless_screen {
+  char cells[SCREEN_ROWS][SCREEN_COLS];
+  int y, x;         // cursor
+  int delay;        // getch timeout in ms, or -1 to wait forever
+  int pushedBack;   // key for the next getch, from ungetch, or ERR
+};
+
+// kinds of server message, for timing
+enum { GRID, GOLD, OK, DISPLAY, QUIT, ERROR, OTHER, NUM_KINDS };
+static const char* kindNames[NUM_KINDS] = {
+  "GRID", "GOLD", "OK", "DISPLAY", "QUIT", "ERROR", "other"
+};
+
+/**************** global variables ****************/
+static struct headless_screen screen;
+WINDOW* stdscr = &screen;
+int LINES = SCREEN_ROWS;
+int COLS = SCREEN_COLS;
+
+/**************** local variables ****************/
+static histogram_t* handleTimes[NUM_KINDS];  // ns to handle each message
+static histogram_t* keyLatency;              // ns from a key to the next DISPLAY
+static uint64_t keySentAt = 0;               // oldest key not yet answered
+static uint64_t keysSent = 0;
+static bool (*clientHandler)(void* arg, const addr_t from, const char* message);
+
+/**************** local functions ****************/
+static bool timedHandler(void* arg, const addr_t from, const char* message);
+static void noteKeySent(void);
+static int kindOf(const char* message);
+static void putCell(int y, int x, char c);
+
+/******************* initscr *****************/
+/* see headless.h for description */
+WINDOW* initscr(void)
+{
+  // like curses, take the screen size from LINES and COLUMNS if they are set
+  const char* lines = getenv("LINES");
+  const char* columns = getenv("COLUMNS");
+  if (lines != NULL && atoi(lines) > 0 && atoi(lines) < SCREEN_ROWS) {
+    LINES = atoi(lines);
+  }
+  if (columns != NULL && atoi(columns) > 0 && atoi(columns) < SCREEN_COLS) {
+    COLS = atoi(columns);
+  }
+  screen.delay = -1;
+  screen.pushedBack = ERR;
+  clear();
+  return stdscr;
+}
+
+/******************* endwin *****************/
+/* see headless.h for description */
+int endwin(void)
+{
+  return 0;
+}
+
+/******************* cbreak, noecho, keypad *****************/
+/* there is no terminal to configure */
+int cbreak(void) { return 0; }
+int noecho(void) { return 0; }
+int keypad(WINDOW* window, bool enable) { return 0; }
+
+/******************* clear *****************/
+/* see headless.h for description */
+int clear(void)
+{
+  memset(screen.cells, ' ', sizeof(screen.cells));
+  screen.y = screen.x = 0;
+  return 0;
+}
+
+/******************* refresh *****************/
+/* the in-memory screen is always up to date */
+int refresh(void)
+{
+  return 0;
+}
+
+/******************* move *****************/
+/* see headless.h for description */
+int move(int y, int x)
+{
+  if (y < 0 || y >= LINES || x < 0 || x >= COLS) {
+    return ERR;
+  }
+  screen.y = y;
+  screen.x = x;
+  return 0;
+}
+
+/******************* clrtoeol *****************/
+/* see headless.h for description */
+int clrtoeol(void)
+{
+  if (screen.y >= LINES || screen.x >= COLS) {
+    return ERR;   // the cursor ran off the screen
+  }
+  memset(&screen.cells[screen.y][screen.x], ' ', COLS - screen.x);
+  return 0;
+}
+
+/******************* mvprintw *****************/
+/* see headless.h for description */
+int mvprintw(int y, int x, const char* format, ...)
+{
+  if (move(y, x) == ERR) {
+    return ERR;
+  }
+  char text[message_MaxBytes];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+
+  // like curses, a newline clears the rest of the line and starts the next
+  for (const char* p = text; *p != '\0'; p++) {
+    if (*p == '\n') {
+      clrtoeol();
+      screen.y++;
+      screen.x = 0;
+    }
+    else {
+      putCell(screen.y, screen.x++, *p);
+    }
+  }
+  return 0;
+}
+
+/******************* mvaddnstr *****************/
+/* see headless.h for description */
+int mvaddnstr(int y, int x, const char* string, int n)
+{
+  if (move(y, x) == ERR) {
+    return ERR;
+  }
+  for (int i = 0; (n < 0 || i < n) && string[i] != '\0'; i++) {
+    putCell(screen.y, screen.x++, string[i]);
+  }
+  return 0;
+}
+
+/******************* timeout *****************/
+/* see headless.h for description */
+void timeout(int delay)
+{
+  screen.delay = delay;
+}
+
+/******************* getch *****************/
+/* see headless.h for description */
+int getch(void)
+{
+  if (screen.pushedBack != ERR) {
+    int key = screen.pushedBack;
+    screen.pushedBack = ERR;
+    return key;
+  }
+  struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+  if (poll(&input, 1, screen.delay) <= 0) {
+    return ERR;
+  }
+  unsigned char c;
+  if (read(STDIN_FILENO, &c, 1) != 1) {
+    return ERR;
+  }
+  return c;
+}
+
+/******************* ungetch *****************/
+/* see headless.h for description */
+int ungetch(int key)
+{
+  if (screen.pushedBack != ERR) {
+    return ERR;
+  }
+  screen.pushedBack = key;
+  return 0;
+}
+
+/******************* headless_send *****************/
+/* see headless.h for description */
+void headless_send(const addr_t to, const char* message)
+{
+  if (message != NULL && strncmp(message, "KEY", 3) == 0) {
+    noteKeySent();
+  }
+  message_send(to, message);
+}
+
+/******************* headless_sendBytes *****************/
+/* see headless.h for description */
+void headless_sendBytes(const addr_t to, const void* bytes, const size_t length)
+{
+  if (length > 0 && *(const unsigned char*)bytes == wire_Key) {
+    noteKeySent();
+  }
+  message_sendBytes(to, bytes, length);
+}
+
+/******************* noteKeySent *****************/
+/* Count a key, and start the clock if no earlier key is waiting. */
+static void noteKeySent(void)
+{
+  keysSent++;
+  if (keySentAt == 0) {
+    keySentAt = histogram_nowNanos();
+  }
+}
+
+/******************* headless_loop *****************/
+/* see headless.h for description */
+bool headless_loop(void* arg, const float timeout,
+                   bool (*handleTimeout)(void* arg),
+                   bool (*handleInput)  (void* arg),
+                   bool (*handleMessage)(void* arg,
+                                         const addr_t from,
+                                         const char* message))
+{
+  for (int k = 0; k < NUM_KINDS; k++) {
+    handleTimes[k] = histogram_new();
+  }
+  keyLatency = histogram_new();
+  clientHandler = handleMessage;
+
+  uint64_t start = histogram_nowNanos();
+  bool ok = message_loop(arg, timeout, handleTimeout, handleInput,
+                         handleMessage == NULL ? NULL : timedHandler);
+  double seconds = (histogram_nowNanos() - start) / 1e9;
+
+  // report
+  uint64_t messages = 0;
+  for (int k = 0; k < NUM_KINDS; k++) {
+    messages += histogram_count(handleTimes[k]);
+  }
+  fprintf(stderr, "headless client: %.1f s, %llu keys sent, %llu messages received\n",
+          seconds, (unsigned long long)keysSent, (unsigned long long)messages);
+  fprintf(stderr, "time to handle each message, ns (DISPLAY: applying the frame):\n");
+  for (int k = 0; k < NUM_KINDS; k++) {
+    if (histogram_count(handleTimes[k]) > 0) {
+      histogram_print(handleTimes[k], stderr, kindNames[k]);
+    }
+  }
+  fprintf(stderr, "time from a key to the next DISPLAY, ns:\n");
+  histogram_print(keyLatency, stderr, "key->DISPLAY");
+
+  // the final screen, without trailing blanks
+  fprintf(stderr, "final screen:\n");
+  int lastRow = -1;
+  for (int y = 0; y < SCREEN_ROWS; y++) {
+    for (int x = 0; x < SCREEN_COLS; x++) {
+      if (screen.cells[y][x] != ' ') {
+        lastRow = y;
+        break;
+      }
+    }
+  }
+  for (int y = 0; y <= lastRow; y++) {
+    int width = SCREEN_COLS;
+    while (width > 0 && screen.cells[y][width - 1] == ' ') {
+      width--;
+    }
+    fprintf(stderr, "%.*s\n", width, screen.cells[y]);
+  }
+
+  for (int k = 0; k < NUM_KINDS; k++) {
+    histogram_delete(handleTimes[k]);
+  }
+  histogram_delete(keyLatency);
+  return ok;
+}
+
+/******************* timedHandler *****************/
+/* Call the client's handler, timing it by kind of message. */
+static bool timedHandler(void* arg, const addr_t from, const char* message)
+{
+  int kind = kindOf(message);
+  uint64_t received = histogram_nowNanos();
+  if (kind == DISPLAY && keySentAt != 0) {
+    histogram_record(keyLatency, received - keySentAt);
+    keySentAt = 0;
+  }
+
+  bool done = (*clientHandler)(arg, from, message);
+  histogram_record(handleTimes[kind], histogram_nowNanos() - received);
+  return done;
+}
+
+/******************* kindOf *****************/
+/* Classify a server message by its first word, or its binary type. */
+static int kindOf(const char* message)
+{
+  if (wire_isBinary(message)) {
+    switch (*(const unsigned char*)message) {
+    case wire_Grid:    return GRID;
+    case wire_Gold:    return GOLD;
+    case wire_Ok:      return OK;
+    case wire_Display: return DISPLAY;
+    case wire_State:   return DISPLAY;
+    default:           return OTHER;
+    }
+  }
+  if (strncmp(message, "VIEW ", strlen("VIEW ")) == 0
+      || strncmp(message, "STATE ", strlen("STATE ")) == 0) {
+    return DISPLAY;   // a DISPLAY of part of the map, or with the gold
+  }
+  for (int k = 0; k < OTHER; k++) {
+    size_t length = strlen(kindNames[k]);
+    if (strncmp(message, kindNames[k], length) == 0
+        && (message[length] == ' ' || message[length] == '\n' || message[length] == '\0')) {
+      return k;
+    }
+  }
+  return OTHER;
+}
+
+/******************* putCell *****************/
+/* Write one character, if it is on the screen. */
+static void putCell(int y, int x, char c)
+{
+  if (y >= 0 && y < LINES && x >= 0 && x < COLS) {
+    screen.cells[y][x] = c;
+  }
+}
@@ -0,0 +1,102 @@
+/*
+ * headless.h - an in-memory stand-in for ncurses, for the headless client
+ *
+ * When client.c is compiled with -DHEADLESS it includes this header instead
+ * of <curses.h>.  The few curses functions the client uses then draw into
+ * an in-memory screen rather than a terminal, and getch() reads keystrokes
+ * from stdin one byte at a time, so a script or key generator can be piped
+ * in.  Everything else in client.c -- the protocol handling, prediction,
+ * batching and rendering -- is the production code.
+ *
+ * This header also wraps message_send, message_sendBytes and message_loop,
+ * to time what the
+ * client does: how long each server message takes to handle (for DISPLAY,
+ * that is applying the frame), and how long after a key is sent the next
+ * DISPLAY arrives.  A report is printed to stderr when the loop ends.
+ *
+ * CS50 Nuggets, Team 10
+ */
+
+#ifndef __HEADLESS_H
+#define __HEADLESS_H
+
+#include <stdbool.h>
+#include "message.h"
+
+/**************** global types ****************/
+typedef struct headless_screen WINDOW;  // opaque; there is only one screen
+
+/**************** global variables ****************/
+extern WINDOW* stdscr;
+extern int LINES;   // screen size; large unless set by $LINES and $COLUMNS
+extern int COLS;
+
+#define ERR (-1)
+#define KEY_RESIZE 0632   // as in curses; never returned, as the size is fixed
+#define getmaxyx(win, y, x) ((y) = LINES, (x) = COLS)
+
+/**************** curses functions ****************/
+/* These behave like their curses namesakes, on the in-memory screen. */
+WINDOW* initscr(void);
+int endwin(void);
+int cbreak(void);
+int noecho(void);
+int keypad(WINDOW* window, bool enable);
+int clear(void);
+int refresh(void);
+int move(int y, int x);
+int clrtoeol(void);
+int mvprintw(int y, int x, const char* format, ...);
+int mvaddnstr(int y, int x, const char* string, int n);
+void timeout(int delay);
+
+/******************* getch *****************/
+/*
+ * getch - reads one keystroke from stdin
+ *
+ * Notes:
+ *   waits at most the delay last given to timeout() (forever if negative)
+ * Returns:
+ *   the key, or ERR at end of file or if the delay expired
+ */
+int getch(void);
+
+/******************* ungetch *****************/
+/*
+ * ungetch - push back one key, for the next getch to return
+ *
+ * Returns:
+ *   0, or ERR if a key is already pushed back
+ */
+int ungetch(int key);
+
+/**************** message wrappers ****************/
+#define message_send headless_send
+#define message_sendBytes headless_sendBytes
+#define message_loop headless_loop
+
+/******************* headless_send *****************/
+/*
+ * headless_send - message_send, noting when KEY and KEYS messages leave
+ */
+void headless_send(const addr_t to, const char* message);
+
+/******************* headless_sendBytes *****************/
+/*
+ * headless_sendBytes - message_sendBytes, noting when binary KEY frames leave
+ */
+void headless_sendBytes(const addr_t to, const void* bytes, const size_t length);
+
+/******************* headless_loop *****************/
+/*
+ * headless_loop - message_loop, timing each call of handleMessage; when the
+ * loop ends, prints the timings and the final screen to stderr
+ */
+bool headless_loop(void* arg, const float timeout,
+                   bool (*handleTimeout)(void* arg),
+                   bool (*handleInput)  (void* arg),
+                   bool (*handleMessage)(void* arg,
+                                         const addr_t from,
+                                         const char* message));
+
+#endif // __HEADLESS_H
@@ -23,9 +23,9 @@
 #define GoldTotal 250
 #define GoldMinNumPiles 10
 #define GoldMaxNumPiles 30
-#define MaxPlayers 26
 #define MAX_LINE_LENGTH 1024  // Set a reasonable max line length based on map constraints
 #define MAX_NAME_LENGTH 50
+#define SCORE_LINE_BYTES 80  // the longest final-score line, or the note after them
 
 /**************** local functions ****************/
 
@@ -44,13 +44,13 @@
 char* encodeMap(FILE* mapFile, game_t* game);
 
 /**************** placeGold ****************/
-/* Places gold randomly on the map and populates the `goldPileAmounts` hashtable.
+/* Places gold randomly on the map and fills in the gold layer.
  *
  * Caller provides:
  *   - game: a pointer to the current game object.
  * We update:
  *   - The map to place gold piles.
- *   - The `goldPileAmounts` hashtable to track gold values at specific positions.
+ *   - The `gold` layer, with the value of the pile on each cell.
  * Returns:
  *   - Nothing. Errors are logged if memory allocation fails or if the map is not initialized.
  */
@@ -78,59 +78,81 @@ int getIndex(int x, int y, int mapWidth);
  *   - proposedY: the proposed y-coordinate for the player.
  * We update:
  *   - The player's position and gold if they interact with a gold pile.
- *   - The game's map and `goldPileAmounts` if gold is captured.
+ *   - The game's map and `gold` layer if gold is captured.
  * Returns:
  *   - true if the move is valid and successful.
  *   - false if the move is invalid or fails.
  */
 bool validateAndMove(game_t* game, player_t* player, int proposedX, int proposedY);
 
-/**************** printMap ****************/
-/* Prints the current map for debugging purposes.
+/**************** runMove ****************/
+/* Moves a player as far as they can go in one direction (a capital-letter move).
  *
  * Caller provides:
- *   - map: a pointer to the encoded map string.
- *   - game: a pointer to the current game object containing map dimensions.
- * We print:
- *   - The map to the console, row by row.
+ *   - game: a pointer to the current game object.
+ *   - player: a pointer to the player running.
+ *   - dx, dy: the direction of the run, each -1, 0 or 1.
+ * We update:
+ *   - As a series of single steps would: the gold along the path is picked
+ *     up, each player in the way is swapped one step back along it, and the
+ *     runner remembers the passages beside the path.
+ *   - The runner's visible map at each step in or beside a room, and at
+ *     the end of the run.
+ * Returns:
+ *   - true if the player moved at all, false if a wall is in the way.
  */
-void printMap(char* map, game_t* game);
+static bool runMove(game_t* game, player_t* player, int dx, int dy);
 
-/**************** printItem ****************/
-/* Prints a key-value pair from the `goldPileAmounts` hashtable for debugging purposes.
+/**************** collectGold ****************/
+/* Gives a player the gold pile at a map cell, and removes it from the map.
  *
  * Caller provides:
- *   - fp: the file pointer to print to (e.g., stdout).
- *   - key: the key in the hashtable, representing the map index as a string.
- *   - item: the value in the hashtable, representing the gold amount at the index.
- * We print:
- *   - The key and gold amount, or "(null)" if the item is NULL.
+ *   - game: a pointer to the current game object.
+ *   - player: a pointer to the player stepping onto the pile.
+ *   - index: the map cell holding the pile.
+ * We update:
+ *   - The player's gold, the gold remaining, and the `gold` layer.
  */
-static void printItem(FILE* fp, const char* key, void* item);
+static void collectGold(game_t* game, player_t* player, int index);
 
-/**************** getPlayerByLetter ****************/
-/* Finds a player in the hashtable by their assigned letter.
+/**************** renderCell ****************/
+/* Recomposes the character of game->map at one cell from the layers.
  *
  * Caller provides:
- *   - letter: the letter representing the player to find.
  *   - game: a pointer to the current game object.
- * Returns:
- *   - A pointer to the player object if found.
- *   - NULL if no player with the given letter exists.
+ *   - index: the map cell whose occupant or gold has changed.
+ * We update:
+ *   - game->map[index]: the letter of the player there, else '*' for gold,
+ *     else what the bare map has.
+ */
+static void renderCell(game_t* game, int index);
+
+/**************** printMap ****************/
+/* Prints the current map for debugging purposes.
+ *
+ * Caller provides:
+ *   - map: a pointer to the encoded map string.
+ *   - game: a pointer to the current game object containing map dimensions.
+ * We print:
+ *   - The map to the console, row by row.
  */
-player_t* getPlayerByLetter(char letter, game_t* game);
+void printMap(char* map, game_t* game);
 
-/**************** getPlayerByLetterHelper ****************/
-/* Helper function for `getPlayerByLetter` to iterate through the hashtable.
+/**************** markChanged ****************/
+/* Flags every player who might see a change to one map cell.
  *
  * Caller provides:
- *   - arg: a pointer to an array containing the target letter and a pointer to store the found player.
- *   - key: the key in the hashtable (unused in this function).
- *   - item: the player object to check against the target letter.
+ *   - game: a pointer to the current game object.
+ *   - index: the map cell that changed.
  * We update:
- *   - The pointer in `arg` to point to the found player, if their letter matches.
+ *   - The `changed` flag of each player whose segment's reach covers the
+ *     cell; players in distant rooms are left alone.
  */
-void getPlayerByLetterHelper(void* arg, const char* key, void* item);
+static void markChanged(game_t* game, int index);
+
+/**************** markAllChanged ****************/
+/* Flags every player, e.g. when the gold remaining has changed. */
+static void markAllChanged(game_t* game);
 
 /**************** player_delete ****************/
 /* Frees memory allocated for a player object, including their name and map.
@@ -145,7 +167,7 @@ static void player_delete(void* playerRaw);
 
 /**************** game_init ****************/
 /* See game.h for details. */
-game_t* game_init(FILE* mapFile, int seed)
+game_t* game_init(FILE* mapFile, int seed, int maxPlayers)
 {
     game_t* game = mem_malloc(sizeof(game_t));
 
@@ -158,30 +180,78 @@ game_t* game_init(FILE* mapFile, int seed)
 
     memset(game, 0, sizeof(game_t)); // Ensure all fields are zeroed
 
-    // Initialize activePlayers array
-    for (int i = 0; i < MaxPlayers; i++) {
-        game->activePlayers[i] = message_noAddr(); // Initialize with no address
-    }
-
     // Initialize variables
     game->seed = seed;
     game->goldRemaining = GoldTotal;
 
     // Encoding map
     game->map = encodeMap(mapFile, game);
-    game->players = hashtable_new(27);
-
-    game->nextAvailableLetter = 'A';
+    if (game->map == NULL) {
+        mem_free(game);
+        return NULL;
+    }
 
     game->hasSpectator = false;
 
     game->mapWithNoPlayers = mem_malloc((1+strlen(game->map))*sizeof(char));
     strcpy(game->mapWithNoPlayers, game->map);
 
+    // Terrain, players and gold each get a layer of their own, so a move can
+    // tell what is on a cell without decoding its character; game->map is
+    // recomposed from them one cell at a time (renderCell)
+    game->terrain = map_terrain(game->mapWithNoPlayers, game->mapWidth, game->mapHeight);
+    game->occupant = mem_malloc(game->encodedMapLength * sizeof(short));
+    game->gold = mem_calloc(game->encodedMapLength, sizeof(int));
+    game->visibleMap = mem_calloc(game->encodedMapLength + 1, sizeof(char));
+    game->visibleMask = mem_calloc(map_mask_words(game->mapWidth, game->mapHeight), sizeof(uint64_t));
+    if (game->terrain == NULL || game->occupant == NULL || game->gold == NULL
+        || game->visibleMap == NULL || game->visibleMask == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the map layers.\n");
+        game_delete(game);
+        return NULL;
+    }
+    for (int i = 0; i < game->encodedMapLength; i++) {
+        game->occupant[i] = -1;
+    }
+
+    // Split the bare map into rooms and passages, so that a move need only
+    // refresh the players who might see it
+    game->segments = map_segment(game->mapWithNoPlayers, game->mapWidth, game->mapHeight);
+
+    // ... and find, once, where every capital-letter move from each spot ends
+    game->runs = map_runs(game->mapWithNoPlayers, game->mapWidth, game->mapHeight);
+
     game->activePlayersCount = 0;
 
     placeGold(game);
 
+    // A player joins on a free room spot, so there can be no more players
+    // than those; each gets a slot, and the hashtable of addresses is sized
+    // so that finding a player stays one short chain however many there are
+    int freeSpots = 0;
+    for (int i = 0; i < game->encodedMapLength; i++) {
+        if (game->terrain[i] == map_ROOM && game->gold[i] == 0) {
+            freeSpots++;
+        }
+    }
+    if (maxPlayers <= 0) {
+        maxPlayers = MaxPlayers;
+    }
+    if (maxPlayers > MaxPlayersLimit) {
+        maxPlayers = MaxPlayersLimit;
+    }
+    if (maxPlayers > freeSpots) {
+        maxPlayers = freeSpots;
+    }
+    game->maxPlayers = maxPlayers;
+    game->players = hashtable_new(maxPlayers + 1);
+    game->slots = mem_calloc(maxPlayers + 1, sizeof(player_t*));
+    if (game->players == NULL || game->slots == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the players.\n");
+        game_delete(game);
+        return NULL;
+    }
+
     printMap(game->map, game);
 
   
@@ -222,59 +292,26 @@ bool game_playerMove(addr_t playerAddress, game_t* game, char moveType)
 
         // Capital letters for maximum moves in each direction
         case 'H': // Move maximum left
-            while (validateAndMove(game, player, x - 1, y)) {
-                x--;  // Update x to the next position left
-            }
-            break;
+            return runMove(game, player, -1, 0);
         case 'L': // Move maximum right
-            while (validateAndMove(game, player, x + 1, y)) {
-                x++;  // Update x to the next position right
-            }
-            break;
+            return runMove(game, player, 1, 0);
         case 'K': // Move maximum up
-            while (validateAndMove(game, player, x, y - 1)) {
-                y--;  // Update y to the next position up
-            }
-            break;
+            return runMove(game, player, 0, -1);
         case 'J': // Move maximum down
-            while (validateAndMove(game, player, x, y + 1)) {
-                y++;  // Update y to the next position down
-            }
-            break;
+            return runMove(game, player, 0, 1);
 
         // Capital letters for diagonal maximum moves
         case 'Y': // Move maximum diagonal up and left
-            while (validateAndMove(game, player, x - 1, y - 1)) {
-                x--;
-                y--;
-            }
-            break;
+            return runMove(game, player, -1, -1);
         case 'U': // Move maximum diagonal up and right
-            while (validateAndMove(game, player, x + 1, y - 1)) {
-                x++;
-                y--;
-            }
-            break;
+            return runMove(game, player, 1, -1);
         case 'B': // Move maximum diagonal down and left
-            while (validateAndMove(game, player, x - 1, y + 1)) {
-                x--;
-                y++;
-            }
-            break;
+            return runMove(game, player, -1, 1);
         case 'N': // Move maximum diagonal down and right
-            while (validateAndMove(game, player, x + 1, y + 1)) {
-                x++;
-                y++;
-            }
-            break;
+            return runMove(game, player, 1, 1);
         default:
             return false;
     }
-
-    // Update player's final position after completing the loop
-    player->xPosition = x;
-    player->yPosition = y;
-    return true;
 }
 
 
@@ -308,10 +345,30 @@ void game_delete(game_t* game) {
 
     mem_free(game->map);
     mem_free(game->mapWithNoPlayers);
+    if (game->terrain != NULL) {
+        mem_free(game->terrain);
+    }
+    if (game->occupant != NULL) {
+        mem_free(game->occupant);
+    }
+    if (game->gold != NULL) {
+        mem_free(game->gold);
+    }
+    if (game->visibleMap != NULL) {
+        mem_free(game->visibleMap);
+    }
+    if (game->visibleMask != NULL) {
+        mem_free(game->visibleMask);
+    }
+    map_segments_delete(game->segments);
+    if (game->runs != NULL) {
+        mem_free(game->runs);
+    }
 
-    // Properly handle memory for gold pile amounts
-    hashtable_delete(game->goldPileAmounts, mem_free); // Only frees valid entries
     hashtable_delete(game->players, player_delete);    // Pass player_delete to free players
+    if (game->slots != NULL) {
+        mem_free(game->slots);
+    }
 
     mem_free(game);
 }
@@ -320,101 +377,171 @@ void game_delete(game_t* game) {
 /* See game.h for details. */
 player_t* game_playerInit(game_t* game, addr_t address, char* playerName)
 {
+    // Check if we have available slots left
+    if (game->activePlayersCount >= game->maxPlayers) {
+        fprintf(stderr, "Error: Maximum number of players reached.\n");
+        return NULL;
+    }
+
     player_t* player = mem_malloc(sizeof(player_t));
     if (player == NULL) {
         fprintf(stderr, "Error: Failed to allocate memory for player.\n");
         return NULL;
     }
 
-    // Check if we have available letters left
-    if (game->nextAvailableLetter > 'Z') {
-        fprintf(stderr, "Error: Maximum number of players reached.\n");
+    player->goldCaptured = 0;
+    player->goldJustCaptured = 0;
+    player->keysSequenced = false;
+    player->lastKeySeq = 0;
+    player->caps = 0;
+    player->viewRows = 0;
+    player->viewCols = 0;
+    player->changed = false;
+    player->display = NULL;
+
+    // Allocate memory for playerName and copy it safely with null termination
+    player->playerName = mem_malloc(MAX_NAME_LENGTH + 1);
+    if (player->playerName == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for playerName.\n");
         mem_free(player);
         return NULL;
     }
+    strncpy(player->playerName, playerName, MAX_NAME_LENGTH);
+    player->playerName[MAX_NAME_LENGTH] = '\0';  // Ensure null termination
+
+    // Allocate the masks of what the player has seen and sees now,
+    // and the blank map they are shown until then
+    int words = map_mask_words(game->mapWidth, game->mapHeight);
+    int stride = game->mapWidth + 1;
+    char* display = mem_malloc(DisplayHeadroom + game->mapHeight * stride + 1);
+    player->seen = mem_calloc(words, sizeof(uint64_t));
+    player->visible = mem_calloc(words, sizeof(uint64_t));
+    if (display == NULL || player->seen == NULL || player->visible == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory for the player's map.\n");
+        player->display = (display != NULL) ? display + DisplayHeadroom : NULL;
+        player_delete(player);
+        return NULL;
+    }
+    player->display = display + DisplayHeadroom;
+    memset(player->display, ' ', game->mapHeight * stride);
+    for (int row = 0; row < game->mapHeight; row++) {
+        player->display[row * stride + game->mapWidth] = '\n';
+    }
+    player->display[game->mapHeight * stride] = '\0';
 
-    player->goldCaptured = 0;
-    player->goldJustCaptured = 0;
+    // The next slot is the new player's, and its letter with it
+    int slot = game->activePlayersCount++;
+    game->slots[slot] = player;
+    player->slot = slot;
+    player->playerLetter = game_glyph(slot);
+    player->address = address;
 
-    // Find the first available slot in activePlayers for a new player
-    for (int i = 0; i < MaxPlayers; i++) {
-        if (!message_isAddr(game->activePlayers[i])) {  // Check if the slot is available
-            // Assign address to this slot and set the player's letter
-            game->activePlayers[i] = address;
-            player->address = address;
-            player->playerLetter = game->nextAvailableLetter;  // Assign the current available letter
-            game->activePlayersCount++;
-
-            // Prepare for the next player by moving to the next letter
-            game->nextAvailableLetter++;
-
-            // Allocate memory for playerName and copy it safely with null termination
-            player->playerName = mem_malloc(MAX_NAME_LENGTH + 1);
-            if (player->playerName != NULL) {
-                strncpy(player->playerName, playerName, MAX_NAME_LENGTH);
-                player->playerName[MAX_NAME_LENGTH] = '\0';  // Ensure null termination
-            } else {
-                fprintf(stderr, "Error: Failed to allocate memory for playerName.\n");
-                mem_free(player);  // Free player memory if name allocation fails
-                return NULL;
-            }
+    // Insert player into the hashtable using the address as the key
+    hashtable_insert(game->players, message_stringAddr(address), player);
 
-            // Insert player into the hashtable using the address as the key
-            hashtable_insert(game->players, message_stringAddr(address), player);
+    printf("New player initialized with name: %s, letter: %c\n", player->playerName, player->playerLetter);
+    fflush(stdout);
 
-            printf("New player initialized with name: %s, letter: %c\n", player->playerName, player->playerLetter);
-            fflush(stdout);
+    // Initialize player's position using map_player_init
+    int x, y;
+    map_player_init(game->map, &x, &y, &(game->seed), game->mapWidth, game->mapHeight, game);
+    player->xPosition = x;
+    player->yPosition = y;
 
-            // Initialize player's position using map_player_init
-            int x, y;
-            map_player_init(game->map, &x, &y, &(game->seed), game->mapWidth, game->mapHeight, game);
-            player->xPosition = x;
-            player->yPosition = y;
+    // Add player’s letter to the map, and show them their surroundings
+    int index = y * game->mapWidth + x;
+    game->occupant[index] = slot;
+    renderCell(game, index);
+    game_refreshPlayer(game, player);
 
-            // Allocate and initialize player map
-            player->playerMap = mem_malloc(sizeof(char) * (strlen(game->map) + 1));
-            if (player->playerMap == NULL) {
-                fprintf(stderr, "Error: Failed to allocate memory for playerMap.\n");
-                mem_free(player->playerName);
-                mem_free(player);
-                return NULL;
-            }
+    // The new player, and whoever can see them arrive, need a DISPLAY
+    markChanged(game, index);
 
-            map_get_visible(x, y, game->map, player->playerMap, game->mapWidth, game->mapHeight);
+    return player;  // Successfully initialized player
+}
 
-            // Add player’s letter to the map and player's map
-            int index = y * game->mapWidth + x;
-            game->map[index] = player->playerLetter;
-            player->playerMap[index] = '@';
+/**************** game_glyph ****************/
+/* See game.h for details. */
+char game_glyph(int slot)
+{
+    slot %= 52;
+    return (slot < 26) ? 'A' + slot : 'a' + (slot - 26);
+}
 
-            return player;  // Successfully initialized player
-        }
+
+/**************** game_refreshPlayer ****************/
+/* See game.h for details. */
+void game_refreshPlayer(game_t* game, player_t* player)
+{
+    if (game == NULL || player == NULL) return;
+
+    char* visibleMap = game->visibleMap;
+    map_get_visible(player->xPosition, player->yPosition, game->map, game->terrain, visibleMap, game->mapWidth, game->mapHeight);
+    map_segments_learn(game->segments, player->xPosition, player->yPosition, visibleMap, game->mapWidth, game->mapHeight);
+
+    // The new mask takes the place of the old, which is kept only long
+    // enough to tell which cells of the display to rewrite
+    uint64_t* previous = player->visible;
+    player->visible = game->visibleMask;
+    game->visibleMask = previous;
+    map_mask_visible(player->visible, visibleMap, game->mapWidth, game->mapHeight);
+    map_merge(player->seen, player->visible, map_mask_words(game->mapWidth, game->mapHeight));
+    map_compose(player->display, game->mapWidth + 1, game->map, game->mapWithNoPlayers,
+                player->seen, player->visible, previous,
+                player->xPosition, player->yPosition, game->mapWidth, game->mapHeight);
+}
+
+/**************** game_playerQuit ****************/
+/* See game.h for details. */
+void game_playerQuit(game_t* game, addr_t address)
+{
+    player_t* player = hashtable_find(game->players, message_stringAddr(address));
+    if (player == NULL) {
+        return;
     }
 
-    // If no available slot is found, free allocated memory and return NULL
-    mem_free(player);
-    return NULL;
+    // Restore whatever the player was standing on
+    int index = player->yPosition * game->mapWidth + player->xPosition;
+    game->occupant[index] = -1;
+    renderCell(game, index);
+    markChanged(game, index);
 }
 
 
 /**************** game_getFinalScores ****************/
 /* See game.h for details. */
-char* game_getFinalScores(game_t* game) {
-    char* quitMessage = mem_malloc(message_MaxBytes * sizeof(char));
+char* game_getFinalScores(game_t* game, size_t maxBytes) {
+    const int count = game->activePlayersCount;
+    size_t size = (size_t)(count + 1) * SCORE_LINE_BYTES + 1;
+    if (maxBytes > 0 && maxBytes < size) {
+        size = maxBytes;
+    }
+    char* quitMessage = mem_malloc(size);
     if (quitMessage == NULL) {
         fprintf(stderr, "Error: Memory allocation failed for quitMessage.\n");
         return NULL;
     }
     quitMessage[0] = '\0';
 
-    for (char letter = 'A'; letter <= 'Z'; letter++) {
-        player_t* player = getPlayerByLetter(letter, game);
-        if (player != NULL) {
-            char playerInfo[100];
-            snprintf(playerInfo, sizeof(playerInfo), "%-2c %10d %-51s\n", 
-                     player->playerLetter, player->goldCaptured, player->playerName);
-            strncat(quitMessage, playerInfo, message_MaxBytes - strlen(quitMessage) - 1);
+    // Past 52 players the letters repeat, so then every line names the slot
+    // too; one line per slot, appended in place rather than rescanning
+    bool withSlots = count > 52;
+    size_t used = 0;
+    for (int i = 0; i < count; i++) {
+        player_t* player = game->slots[i];
+        char line[SCORE_LINE_BYTES];
+        int length = withSlots
+            ? snprintf(line, sizeof(line), "%c%-6d %10d %-51s\n", player->playerLetter,
+                       player->slot, player->goldCaptured, player->playerName)
+            : snprintf(line, sizeof(line), "%-2c %10d %-51s\n", player->playerLetter,
+                       player->goldCaptured, player->playerName);
+        size_t room = (i == count - 1) ? 0 : SCORE_LINE_BYTES;   // for the note, if need be
+        if (used + length + room >= size) {
+            snprintf(quitMessage + used, size - used, "(%d more players not shown)\n", count - i);
+            break;
         }
+        memcpy(quitMessage + used, line, length + 1);
+        used += length;
     }
     return quitMessage;
 }
@@ -484,7 +611,6 @@ char* encodeMap(FILE* mapFile, game_t* game)
     printf("width: %d, height %d\n", game->mapWidth, game->mapHeight);
     game->encodedMapLength = game->mapWidth * game->mapHeight;
 
-    fclose(stdout);
     fclose(mapFile);
     return map;  // Return the map buffer
 }
@@ -503,8 +629,6 @@ void placeGold(game_t* game) {
     int numPiles = GoldMinNumPiles + rand() % (GoldMaxNumPiles - GoldMinNumPiles + 1);
     int remainingGold = game->goldRemaining - numPiles;
 
-    game->goldPileAmounts = hashtable_new(numPiles);
-
     int pileValues[numPiles];
     pileValues[0] = '\0';
     for (int i = 0; i < numPiles; i++) {
@@ -519,64 +643,19 @@ void placeGold(game_t* game) {
     }
 
     for (int i = 0; i < numPiles; i++) {
-    
-        int* pileSizePtr = mem_malloc(sizeof(int));
-        if (pileSizePtr == NULL) {
-            fprintf(stderr, "Error: Memory allocation failed for gold pile.\n");
-            return;
-        }
-
-
-        *pileSizePtr = pileValues[i];
         bool spotFound = false;
         while (!spotFound) {
             int randIndex = rand() % game->encodedMapLength;
-            if (game->map[randIndex] == '.') {
-                game->map[randIndex] = '*';
-                char key[12];
-                snprintf(key, sizeof(key), "%d", randIndex);
-                hashtable_insert(game->goldPileAmounts, key, pileSizePtr);
+            if (game->terrain[randIndex] == map_ROOM && game->gold[randIndex] == 0) {
+                game->gold[randIndex] = pileValues[i];
+                renderCell(game, randIndex);
                 spotFound = true;
-                printf("Placed %d gold at position %d\n", *pileSizePtr, randIndex);
+                printf("Placed %d gold at position %d\n", pileValues[i], randIndex);
             }
         }
     }
-
-    hashtable_print(game->goldPileAmounts, stdout, printItem);
-}
-
-
-/**************** getPlayerByLetter ****************/
-player_t* getPlayerByLetter(char letter, game_t* game)
-{   
-    player_t* foundPlayer = NULL;
-
-    // Use an array to hold the letter and pointer to foundPlayer
-    void* arg[2];
-    arg[0] = &letter;
-    arg[1] = &foundPlayer;
-
-    // Iterate through the hashtable to find the player with the matching letter
-    hashtable_iterate(game->players, arg, getPlayerByLetterHelper);
-
-    // Return the found player or NULL if not found
-    return foundPlayer;
 }
 
-/**************** getPlayerByLetterHelper ****************/
-void getPlayerByLetterHelper(void* arg, const char* key, void* item)
-{   
-    // Retrieve the letter and pointer to foundPlayer from the arg array
-    char targetLetter = *(char*)(((void**)arg)[0]);
-    player_t** foundPlayerPtr = (player_t**)(((void**)arg)[1]);
-
-    player_t* player = (player_t*)item;
-
-    // Check if the player's letter matches the target letter
-    if (player->playerLetter == targetLetter) {
-        *foundPlayerPtr = player;  // Set the found player via the pointer
-    }
-}
 
 /**************** player_delete ****************/
 static void player_delete(void* playerRaw) {
@@ -584,9 +663,15 @@ static void player_delete(void* playerRaw) {
 
     player_t* player = (player_t*)playerRaw;
 
-    // Free the player's map
-    if (player->playerMap != NULL) {
-        mem_free(player->playerMap);
+    // Free the player's map and masks
+    if (player->display != NULL) {
+        mem_free(player->display - DisplayHeadroom);
+    }
+    if (player->seen != NULL) {
+        mem_free(player->seen);
+    }
+    if (player->visible != NULL) {
+        mem_free(player->visible);
     }
 
     // Free the player's name
@@ -601,94 +686,168 @@ static void player_delete(void* playerRaw) {
 /**************** validateAndMove ****************/
 bool validateAndMove(game_t* game, player_t* player, int proposedX, int proposedY) 
 {
+    // A passage may run along the edge of the map; there is nothing beyond it
+    if (proposedX < 0 || proposedX >= game->mapWidth || proposedY < 0 || proposedY >= game->mapHeight) {
+        return false;
+    }
+
     int currentIndex = player->yPosition * game->mapWidth + player->xPosition;
-    char currentTilePlayerIsOn = game->mapWithNoPlayers[currentIndex];
     int proposedIndex = proposedY * game->mapWidth + proposedX;
-    char proposedTile = game->map[proposedIndex];
 
-    char valid_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-
-    if (proposedTile != '.' && proposedTile != '#' && proposedTile != '*' && strchr(valid_chars, proposedTile) == false) {
+    // Players walk on room spots and passages, whatever lies on them
+    if (game->terrain[proposedIndex] != map_ROOM && game->terrain[proposedIndex] != map_PASSAGE) {
         return false;
     }
 
-    game->map[currentIndex] = currentTilePlayerIsOn;
-
-    if (game->map[proposedIndex] == '*') {
-        // Convert proposedIndex to a string for lookup in the hashtable
-        char key[12];
-        key[0] = '\0';
-        snprintf(key, sizeof(key), "%d", proposedIndex);
-
-        int* goldAmountPtr = hashtable_find(game->goldPileAmounts, key);
-        int goldAmountPlayerFound = *goldAmountPtr;
+    int index = game->occupant[proposedIndex];  // the slot of a player in the way
+    if (index >= 0) {
+        player_t* playerMovedOnto = game->slots[index];
+        printf("Player %c moved onto player %c\n", player->playerLetter, playerMovedOnto->playerLetter);
 
-        player->goldCaptured += goldAmountPlayerFound;
-        game->goldRemaining -= goldAmountPlayerFound;
-        player->goldJustCaptured = goldAmountPlayerFound;
-        game->map[proposedIndex] = '.';
-
-        // Free the gold amount after retrieval
-        if (goldAmountPtr) {
-            //mem_free(goldAmountPtr);
-            hashtable_insert(game->goldPileAmounts, key, NULL);
-        }
+        // Swap positions
+        playerMovedOnto->xPosition = player->xPosition;
+        playerMovedOnto->yPosition = player->yPosition;
     }
 
-    if (strchr(valid_chars, proposedTile)) {
-        int index = proposedTile - 'A';  // Calculate the index in activePlayers based on the letter
-        const char* stringAddress = message_stringAddr(game->activePlayers[index]);
-        player_t* playerMovedOnto = hashtable_find(game->players, stringAddress);
-
-        if (playerMovedOnto != NULL) {
-            printf("Player %c moved onto player %c\n", player->playerLetter, playerMovedOnto->playerLetter);
-
-            // Swap positions
-            int tempX = playerMovedOnto->xPosition;
-            int tempY = playerMovedOnto->yPosition;
-            playerMovedOnto->xPosition = player->xPosition;
-            playerMovedOnto->yPosition = player->yPosition;
-            player->xPosition = tempX;
-            player->yPosition = tempY;
-
-            // Update map to reflect swapped positions
-            game->map[playerMovedOnto->yPosition * game->mapWidth + playerMovedOnto->xPosition] = playerMovedOnto->playerLetter;
-            game->map[player->yPosition * game->mapWidth + player->xPosition] = player->playerLetter;
-        } else {
-            printf("Error: Could not find player at activePlayers[%d]\n", index);
-            return false;
-        }
+    if (game->gold[proposedIndex] > 0) {
+        collectGold(game, player, proposedIndex);
     }
 
-    
-    game->map[proposedIndex] = player->playerLetter;
+    game->occupant[currentIndex] = index;
+    game->occupant[proposedIndex] = player->slot;
+    renderCell(game, currentIndex);
+    renderCell(game, proposedIndex);
 
     player->xPosition = proposedX;
     player->yPosition = proposedY;
     
     
     printf("x %d, y %d\n", proposedX, proposedY);
-    
-    for (int i = 0; i < MaxPlayers; i++) {
-                      
-        if ((message_isAddr(game->activePlayers[i])) ) {
-            player_t* player = hashtable_find(game->players, message_stringAddr((game->activePlayers[i])));
-            char* visibleMap = mem_malloc(sizeof(char) * (strlen(game->map) + 1));
-            memset(visibleMap, 0, strlen(game->map) + 1);
 
-            // printf("The length of the visible map is %d\n",(int)strlen(visibleMap));
-            // fflush(stdout);
-            map_get_visible(player->xPosition, player->yPosition, game->map, visibleMap, game->mapWidth, game->mapHeight);
-            map_merge(player->playerMap, visibleMap, game->mapWidth, game->mapHeight);
+    // The mover sees along the way; everyone else who might see either
+    // cell is refreshed once, when the update is sent
+    game_refreshPlayer(game, player);
+    markChanged(game, currentIndex);
+    markChanged(game, proposedIndex);
+
+    return true;
+}
 
-            mem_free(visibleMap);
+/**************** runMove ****************/
+static bool runMove(game_t* game, player_t* player, int dx, int dy)
+{
+    int width = game->mapWidth;
+    int steps = map_run_length(game->runs, player->xPosition, player->yPosition, dx, dy, width);
+    if (steps == 0) {
+        return false;
+    }
+    int step = dy * width + dx;
+    int start = player->yPosition * width + player->xPosition;
+    int end = start + steps * step;
+
+    // One scan along the path, doing what each step would have done
+    game->occupant[start] = -1;
+    renderCell(game, start);
+    markChanged(game, start);
+    int previous = start;
+    for (int here = start + step; ; here += step) {
+        bool changed = false;
+        if (game->gold[here] > 0) {
+            collectGold(game, player, here);
+            changed = true;
+        }
+        int index = game->occupant[here];
+        if (index >= 0) {
+            // The player in the way is swapped to where the runner just was
+            player_t* other = game->slots[index];
+            printf("Player %c moved onto player %c\n", player->playerLetter, other->playerLetter);
+            other->xPosition = previous % width;
+            other->yPosition = previous / width;
+            game->occupant[previous] = index;
+            game->occupant[here] = -1;
+            renderCell(game, previous);
+            renderCell(game, here);
+            markChanged(game, previous);
+            changed = true;
+        }
+
+        // Every step sees its neighbours; a single refresh at the end would
+        // forget the passages run through.  Solid rock is never marked seen,
+        // as map_mask_visible would not mark it
+        bool nearRoom = false;
+        for (int ny = here / width - 1; ny <= here / width + 1; ny++) {
+            for (int nx = here % width - 1; nx <= here % width + 1; nx++) {
+                if (ny >= 0 && ny < game->mapHeight && nx >= 0 && nx < width
+                    && game->mapWithNoPlayers[ny * width + nx] != ' ') {
+                    map_mask_set(player->seen, ny * width + nx);
+                    player->display[ny * (width + 1) + nx] = game->mapWithNoPlayers[ny * width + nx];
+                    nearRoom = nearRoom || game->terrain[ny * width + nx] == map_ROOM;
+                }
+            }
+        }
+        if (here == end) {
+            break;
+        }
+        if (changed) {
+            markChanged(game, here);
+        }
 
-        } 
+        // ... but a step in or beside a room sees across it, and a room need
+        // not be convex, so it is seen from every such step as stepping would
+        if (nearRoom) {
+            player->xPosition = here % width;
+            player->yPosition = here / width;
+            game_refreshPlayer(game, player);
+        }
+        previous = here;
     }
 
+    game->occupant[end] = player->slot;
+    renderCell(game, end);
+    player->xPosition = end % width;
+    player->yPosition = end / width;
+    printf("x %d, y %d\n", player->xPosition, player->yPosition);
+
+    game_refreshPlayer(game, player);
+    markChanged(game, end);
     return true;
 }
 
+/**************** collectGold ****************/
+static void collectGold(game_t* game, player_t* player, int index)
+{
+    int goldAmountPlayerFound = game->gold[index];
+
+    player->goldCaptured += goldAmountPlayerFound;
+    game->goldRemaining -= goldAmountPlayerFound;
+    player->goldJustCaptured = goldAmountPlayerFound;
+    game->gold[index] = 0;
+    renderCell(game, index);
+
+    // Everyone's count of the gold remaining is now out of date
+    markAllChanged(game);
+}
+
+/**************** markChanged ****************/
+static void markChanged(game_t* game, int index)
+{
+    for (int i = 0; i < game->activePlayersCount; i++) {
+        player_t* player = game->slots[i];
+        if (map_segments_sees(game->segments, player->xPosition,
+                              player->yPosition, index, game->mapWidth)) {
+            player->changed = true;
+        }
+    }
+}
+
+/**************** markAllChanged ****************/
+static void markAllChanged(game_t* game)
+{
+    for (int i = 0; i < game->activePlayersCount; i++) {
+        game->slots[i]->changed = true;
+    }
+}
+
 /**************** printMap ****************/
 void printMap(char* map, game_t* game)
 {
@@ -701,14 +860,15 @@ void printMap(char* map, game_t* game)
     }    
 }
 
-/**************** printItem ****************/
-static void printItem(FILE* fp, const char* key, void* item) {
-    int* amt = item;
-    if (amt == NULL) {
-        printf("(null)");
+/**************** renderCell ****************/
+static void renderCell(game_t* game, int index)
+{
+    if (game->occupant[index] >= 0) {
+        game->map[index] = game->slots[game->occupant[index]]->playerLetter;
+    } else if (game->gold[index] > 0) {
+        game->map[index] = '*';
     } else {
-        printf("Key: %s, Item: %d", key, *amt);
+        game->map[index] = game->mapWithNoPlayers[index];
     }
-
 }
 
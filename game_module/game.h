@@ -18,39 +18,60 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "../libcs50/hashtable.h"
 #include "../support/message.h"
 
-#define MaxPlayers 26
+#define MaxPlayers 26        // players per game unless game_init is given a cap
+#define MaxPlayersLimit 32767 // the most any cap can be: slots must fit game->occupant
+#define DisplayHeadroom 96  // room kept before player->display for a message header
 
 /**************** global types ****************/
 typedef struct player {
     char* playerName;
-    char playerLetter;
-    char* playerMap;
+    char playerLetter;      // glyph the player is drawn with (see game_glyph)
+    int slot;               // index in game->slots; stays theirs until the game ends
+    uint64_t* seen;         // cells the player has seen, a bit each (map.h)
+    uint64_t* visible;      // cells the player sees from where they stand
+    char* display;          // the map the player is shown, as a text DISPLAY's
+                            //   rows: mapWidth cells and a '\n' each, then '\0'
     int goldJustCaptured;
     addr_t address;
     int xPosition;
     int yPosition;
     int goldCaptured;
+    bool keysSequenced;     // client numbers its keys ("KEY k seq")
+    unsigned int lastKeySeq; // number of the last key handled
+    int caps;               // protocol options agreed with the client (wire.h)
+    int viewRows;           // map area of the client's screen ("SIZE"),
+    int viewCols;           //   or 0 if it shows the whole map
+    bool changed;           // something the player can see has changed
+                            //   since their last DISPLAY
 } player_t;
 
 typedef struct game {
-    char* map;
+    char* map;              // what everyone sees: composed from the layers below
     char* mapWithNoPlayers;
+    unsigned char* terrain; // map_tile_t of each cell (map.h); never changes
+    short* occupant;        // slot of the player on each cell, or -1
+    int* gold;              // nuggets in the pile on each cell, or 0
+    char* visibleMap;       // scratch for game_refreshPlayer: what a player sees
+    uint64_t* visibleMask;  //   ... and the same as a mask
     int port;
     int mapHeight;
     int mapWidth;
     int encodedMapLength;
-    hashtable_t* players;
-    hashtable_t* goldPileAmounts;
-    addr_t activePlayers[MaxPlayers]; // 26 max players
-    int activePlayersCount;
+    hashtable_t* players;   // player_t of each address, by message_stringAddr
+    int maxPlayers;         // the most players that can join (see game_init)
+    player_t** slots;       // the player in each of maxPlayers slots; slots are
+                            //   handed out in order and kept by players who quit
+    int activePlayersCount; // slots in use: slots[0 .. activePlayersCount-1]
     bool hasSpectator;
     addr_t spectatorAddress;
     int seed;
-    char nextAvailableLetter;
     int goldRemaining;
+    struct map_segments* segments; // rooms and passages (see map.h)
+    uint16_t* runs;         // where each capital-letter move ends (map_runs)
 } game_t;
 
 /**************** functions ****************/
@@ -61,12 +82,16 @@ typedef struct game {
  * Caller provides:
  *   - mapFile: a file pointer to the map file to use for the game.
  *   - seed: an integer seed for random number generation.
+ *   - maxPlayers: the most players that can join, or 0 for MaxPlayers.
  * We initialize:
- *   - The game structure with map data
+ *   - The game structure with map data, and maxPlayers empty player slots.
  * Returns:
  *   - A pointer to the initialized game object or NULL on failure.
+ * Notes:
+ *   - The cap is lowered if the map has fewer free room spots than that,
+ *     so every player who joins has somewhere to stand.
  */
-game_t* game_init(FILE* mapFile, int seed);
+game_t* game_init(FILE* mapFile, int seed, int maxPlayers);
 
 /**************** game_playerMove ****************/
 /* Handles movement for a player and updates their position and visible map.
@@ -77,6 +102,8 @@ game_t* game_init(FILE* mapFile, int seed);
  *   - moveType: a character representing the direction of the move (e.g., 'h' for left).
  * We update:
  *   - The player's position and visible map.
+ *   - The `changed` flag of every player who might see the move (all of
+ *     them, if gold was picked up); only their maps need refreshing.
  * Returns:
  *   - true if the move is valid and successful, false otherwise.
  */
@@ -111,21 +138,72 @@ void game_delete(game_t* game);
  *   - playerName: the name of the player as a string.
  * We initialize:
  *   - Player data, including name, position, map visibility, and assigned letter.
+ *   - The `changed` flag of the new player, and of every player who might
+ *     see them arrive.
  * Returns:
- *   - A pointer to the newly created player or NULL if initialization fails.
+ *   - A pointer to the newly created player or NULL if initialization fails,
+ *     or if all game->maxPlayers slots are taken.
  */
 player_t* game_playerInit(game_t* game, addr_t address, char* playerName);
 
+/**************** game_glyph ****************/
+/* The letter the player in a slot is drawn with.
+ *
+ * Caller provides:
+ *   - slot: a slot number, 0 or more.
+ * Returns:
+ *   - 'A' to 'Z' for the first 26 slots, then 'a' to 'z'; beyond 52 slots
+ *     the letters repeat, so only the slot tells two players apart.
+ */
+char game_glyph(int slot);
+
+/**************** game_refreshPlayer ****************/
+/* Recomputes what a player can see and merges it into what they have seen.
+ *
+ * Caller provides:
+ *   - game: a pointer to the current game state.
+ *   - player: the player whose map to refresh (NULL is ignored).
+ * We update:
+ *   - The player's visible and seen masks, from their current position.
+ *   - The player's display, in place: game->map where they see now, the
+ *     bare map where they have been, blanks elsewhere, and '@' where they
+ *     stand. Only cells they saw before or see now are rewritten.
+ *   - The reach of the segment they stand in, if they see beyond it.
+ * Notes:
+ *   - DisplayHeadroom bytes before player->display are free, so a header
+ *     can be written there and the whole message sent without a copy.
+ */
+void game_refreshPlayer(game_t* game, player_t* player);
+
+/**************** game_playerQuit ****************/
+/* Removes a quitting player's letter from the map.
+ *
+ * Caller provides:
+ *   - game: a pointer to the current game state.
+ *   - address: the address of the player who quit.
+ * We update:
+ *   - The map, restoring the tile the player was standing on.
+ *   - The `changed` flag of every player who might see that tile.
+ * Notes:
+ *   - Unknown addresses (e.g., the spectator) are ignored.
+ */
+void game_playerQuit(game_t* game, addr_t address);
+
 /**************** game_getFinalScores ****************/
 /* Generates a string containing the final scores of all players in the game.
  *
  * Caller provides:
  *   - game: a pointer to the current game state.
+ *   - maxBytes: the most the string may take, its NUL included; 0 for no limit.
  * We generate:
  *   - A string listing each player's letter, total gold captured, and name.
+ *     In a game of more than 52 players the letters repeat, so each letter
+ *     is followed by the player's slot, e.g. "a53".
+ *   - If not every line fits in maxBytes, the lines that do, and then one
+ *     saying how many players were left out.
  * Returns:
  *   - A dynamically allocated string with the final scores. Caller is responsible for freeing it.
  */
-char* game_getFinalScores(game_t* game);
+char* game_getFinalScores(game_t* game, size_t maxBytes);
 
 #endif // __GAME_H
@@ -0,0 +1,178 @@
+/*
+ * gametest.c - unit test of capital-letter moves in the game module (Team 10)
+ *
+ * Usage:
+ *   ./gametest [map.txt ...]
+ *
+ * A capital-letter move is made in one scan along its path (runMove), not
+ * one step at a time, but it must leave the game as the steps would have.
+ * On every map given on the command line, or on every map in ../maps/ and
+ * ../maps/contrib*\/ if none are given (skipping any the game refuses to
+ * load), two games are set up alike: in one a player makes random
+ * capital-letter moves, and in the other the same player repeats the
+ * matching lowercase key until it stops moving.  After each move the
+ * players' positions, purses and `seen` masks must agree.
+ * A second player stands still in both games, to be run over and swapped.
+ *
+ * The game module reports every move on stdout, so failures go to stderr
+ * (`make test` discards stdout).  Exits with the number of failures.
+ *
+ * Team 10
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <glob.h>
+#include "game.h"
+#include "../map_module/map.h"
+
+#define MOVES 100          // capital-letter moves made on each map
+#define SEED 17            // gold and players are placed alike in both games
+
+static int failures = 0;
+
+/**************** local functions ****************/
+static void testMap(const char* path);
+static game_t* newGame(const char* path);
+static player_t* join(game_t* game, int slot, char* name);
+static void refreshChanged(game_t* game);
+static bool samePlayer(const game_t* game, const player_t* run, const player_t* step);
+
+/***************** main *******************************/
+int main(int argc, char* argv[])
+{
+    glob_t maps;
+    memset(&maps, 0, sizeof(maps));
+    if (argc > 1) {
+        maps.gl_pathc = argc - 1;
+        maps.gl_pathv = argv + 1;
+    } else {
+        glob("../maps/*.txt", 0, NULL, &maps);
+        glob("../maps/contrib*/*.txt", GLOB_APPEND, NULL, &maps);
+    }
+    for (size_t i = 0; i < maps.gl_pathc; i++) {
+        testMap(maps.gl_pathv[i]);
+    }
+    if (argc <= 1) {
+        globfree(&maps);
+    }
+
+    fprintf(stderr, "gametest: %d failures\n", failures);
+    return failures;
+}
+
+/**************** testMap ****************/
+/* Makes MOVES random capital-letter moves in one game and the same moves
+ * one step at a time in the other, comparing the players after each.
+ */
+static void testMap(const char* path)
+{
+    game_t* runGame = newGame(path);
+    game_t* stepGame = newGame(path);
+    if (runGame == NULL || stepGame == NULL) {
+        // game_init refuses some contributed maps (rows of uneven length)
+        fprintf(stderr, "skipping %s: the game cannot load it\n", path);
+        game_delete(runGame);
+        game_delete(stepGame);
+        return;
+    }
+
+    player_t* runner = join(runGame, 0, "runner");
+    player_t* stepper = join(stepGame, 0, "runner");
+    player_t* runStander = join(runGame, 1, "stander");
+    player_t* stepStander = join(stepGame, 1, "stander");
+    if (runner == NULL || stepper == NULL || runStander == NULL || stepStander == NULL) {
+        fprintf(stderr, "FAIL: %s: players cannot join\n", path);
+        failures++;
+        game_delete(runGame);
+        game_delete(stepGame);
+        return;
+    }
+
+    const char* capitals = "HJKLYUBN";
+    unsigned int state = SEED;
+    for (int move = 0; move < MOVES; move++) {
+        // our own generator, so the game's use of rand() stays as it was
+        state = state * 1103515245 + 12345;
+        char key = capitals[(state >> 16) % 8];
+
+        game_playerMove(runner->address, runGame, key);
+        refreshChanged(runGame);
+        while (game_playerMove(stepper->address, stepGame, tolower(key))) {
+            refreshChanged(stepGame);
+        }
+
+        if (!samePlayer(runGame, runner, stepper) || !samePlayer(runGame, runStander, stepStander)) {
+            fprintf(stderr, "FAIL: %s: move %d ('%c') from the same spot ends differently\n",
+                    path, move, key);
+            failures++;
+            break;
+        }
+    }
+
+    game_delete(runGame);
+    game_delete(stepGame);
+}
+
+/**************** newGame ****************/
+/* Starts a game on the map at path, with its gold placed from SEED. */
+static game_t* newGame(const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+    // game_init closes the map file
+    return game_init(fp, SEED, 0);
+}
+
+/**************** join ****************/
+/* Adds a player to a game at a made-up address; the spot a player gets
+ * is drawn with rand(), so it is reseeded to put them on the same spot in
+ * both games.
+ */
+static player_t* join(game_t* game, int slot, char* name)
+{
+    addr_t address = message_noAddr();
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(10000 + slot);
+
+    srand(SEED + slot);
+    player_t* player = game_playerInit(game, address, name);
+    refreshChanged(game);
+    return player;
+}
+
+/**************** refreshChanged ****************/
+/* Mirrors the visibility half of the server's updateAllPlayers, which
+ * runs after every KEY.
+ */
+static void refreshChanged(game_t* game)
+{
+    for (int i = 0; i < game->activePlayersCount; i++) {
+        player_t* player = game->slots[i];
+        if (player->changed) {
+            player->changed = false;
+            game_refreshPlayer(game, player);
+        }
+    }
+}
+
+/**************** samePlayer ****************/
+/* True if a player ended up alike in both games: on the same spot, with
+ * the same gold, having seen the same cells.
+ */
+static bool samePlayer(const game_t* game, const player_t* run, const player_t* step)
+{
+    int words = map_mask_words(game->mapWidth, game->mapHeight);
+    return run->xPosition == step->xPosition && run->yPosition == step->yPosition
+        && run->goldCaptured == step->goldCaptured
+        && memcmp(run->seen, step->seen, words * sizeof(uint64_t)) == 0;
+}
@@ -0,0 +1,365 @@
+// Micro-benchmarks of the map module for the Nuggets project
+// CS50, 24F
+// Team 10
+//
+// Usage: ./bench [-n positions] [-r rounds] [-c results.csv] [-j results.json] [map.txt ...]
+//
+// Times each map module kernel (map_get_visible, map_merge, map_compose,
+// map_decode and map_player_init), and the run-length DISPLAY codec of support/wire
+// (wire_rleEncode and wire_rleDecode), on every map given on the command line, or on every map
+// in ../maps/ and ../maps/contrib*/ if none are given.  The visibility and
+// merge kernels are run from up to 'positions' player positions spread
+// evenly over each map's room spots, and every kernel is repeated 'rounds'
+// times.  For each map and kernel the benchmark reports ns per call,
+// ns per map cell, cells per second and heap allocations per call, and for
+// the kernels that produce a DISPLAY payload, its size in bytes.  The codec
+// runs on the player's map after every merge, so its compression ratio is
+// averaged over a player exploring the map, from one room to all of it.
+// A table goes to stdout; -c and -j also write the results as CSV or JSON
+// so they can be compared between builds.
+//
+// Allocations are counted by wrapping malloc/calloc/realloc at link time
+// (see the 'bench' rule in the Makefile), so every allocation made by a
+// kernel is counted, whether or not it goes through mem_malloc.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdbool.h>
+#include<stdint.h>
+#include<unistd.h>
+#include<glob.h>
+#include "map.h"
+#include "../libcs50/mem.h"
+#include "../libcs50/file.h"
+#include "../support/histogram.h"
+#include "../support/wire.h"
+
+#define DEFAULT_POSITIONS 100
+#define DEFAULT_ROUNDS 3
+
+// One row of results
+typedef struct result {
+  const char* map;
+  const char* kernel;
+  int width, height;
+  long calls;
+  uint64_t nanos;
+  long allocs;
+  long bytes;       // payload bytes produced, over all calls
+} result_t;
+
+// LOCAL FUNCTIONS
+static char* loadMap(const char* path, int* width, int* height);
+static void benchMap(const char* path, int positions, int rounds, FILE* csv, FILE* json, bool* firstJson);
+static void report(const result_t* r, FILE* csv, FILE* json, bool* firstJson);
+
+// Allocation counting; the linker routes the kernels' malloc calls here
+static long allocCount = 0;
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void* __wrap_malloc(size_t size) { allocCount++; return __real_malloc(size); }
+void* __wrap_calloc(size_t nmemb, size_t size) { allocCount++; return __real_calloc(nmemb, size); }
+void* __wrap_realloc(void* ptr, size_t size) { allocCount++; return __real_realloc(ptr, size); }
+
+
+int main(int argc, char* argv[]){
+  int positions = DEFAULT_POSITIONS;
+  int rounds = DEFAULT_ROUNDS;
+  FILE* csv = NULL;
+  FILE* json = NULL;
+
+  int opt;
+  while((opt = getopt(argc, argv, "n:r:c:j:")) != -1){
+    switch(opt){
+      case 'n': positions = atoi(optarg); break;
+      case 'r': rounds = atoi(optarg); break;
+      case 'c': csv = fopen(optarg, "w"); if(csv == NULL){ perror(optarg); return 1; } break;
+      case 'j': json = fopen(optarg, "w"); if(json == NULL){ perror(optarg); return 1; } break;
+      default:
+        fprintf(stderr, "Usage: %s [-n positions] [-r rounds] [-c results.csv] [-j results.json] [map.txt ...]\n", argv[0]);
+        return 1;
+    }
+  }
+  if(positions < 1 || rounds < 1){
+    fprintf(stderr, "positions and rounds must be positive\n");
+    return 1;
+  }
+
+  // Collect the maps: command line, or every map we ship
+  glob_t maps;
+  memset(&maps, 0, sizeof(maps));
+  if(optind < argc){
+    maps.gl_pathc = argc - optind;
+    maps.gl_pathv = argv + optind;
+  }else{
+    glob("../maps/*.txt", 0, NULL, &maps);
+    glob("../maps/contrib*/*.txt", GLOB_APPEND, NULL, &maps);
+  }
+  if(maps.gl_pathc == 0){
+    fprintf(stderr, "no maps found\n");
+    return 1;
+  }
+
+  if(csv != NULL){
+    fprintf(csv, "map,kernel,width,height,cells,calls,ns_per_call,ns_per_cell,cells_per_sec,allocs_per_call,bytes_per_call\n");
+  }
+  bool firstJson = true;
+  if(json != NULL){
+    fprintf(json, "[\n");
+  }
+  printf("%-52s %-16s %9s %12s %10s %14s %8s %10s\n",
+         "map", "kernel", "cells", "ns/call", "ns/cell", "cells/sec", "allocs", "bytes");
+
+  for(size_t i = 0; i < maps.gl_pathc; i++){
+    benchMap(maps.gl_pathv[i], positions, rounds, csv, json, &firstJson);
+  }
+
+  if(json != NULL){
+    fprintf(json, "\n]\n");
+    fclose(json);
+  }
+  if(csv != NULL){
+    fclose(csv);
+  }
+  if(optind >= argc){
+    globfree(&maps);
+  }
+  return 0;
+}
+
+/* *** loadMap ***
+Reads a map file into one string without newlines, the way the game module
+stores it.  Lines shorter than the longest line are padded with spaces.
+Returns NULL if the file can't be read; the caller frees the result.
+*/
+static char* loadMap(const char* path, int* width, int* height){
+  FILE* fp = fopen(path, "r");
+  if(fp == NULL){
+    return NULL;
+  }
+
+  // First pass: dimensions
+  *width = 0;
+  *height = 0;
+  char* line;
+  while((line = file_readLine(fp)) != NULL){
+    int len = strlen(line);
+    if(len > *width){
+      *width = len;
+    }
+    (*height)++;
+    mem_free(line);
+  }
+  if(*width == 0){
+    fclose(fp);
+    return NULL;
+  }
+
+  // Second pass: copy rows, padding them to full width
+  rewind(fp);
+  char* map = mem_malloc((*width) * (*height) + 1);
+  memset(map, ' ', (*width) * (*height));
+  map[(*width) * (*height)] = '\0';
+  for(int row = 0; (line = file_readLine(fp)) != NULL; row++){
+    memcpy(map + row*(*width), line, strlen(line));
+    mem_free(line);
+  }
+  fclose(fp);
+  return map;
+}
+
+/* *** benchMap ***
+Runs every kernel on one map and reports the results.
+*/
+static void benchMap(const char* path, int positions, int rounds, FILE* csv, FILE* json, bool* firstJson){
+  int NC, NR;
+  char* map = loadMap(path, &NC, &NR);
+  if(map == NULL){
+    fprintf(stderr, "skipping %s: cannot read map\n", path);
+    return;
+  }
+  int cells = NC*NR;
+  unsigned char* terrain = map_terrain(map, NC, NR);
+
+  // The map module takes its dimensions from a game struct in places
+  game_t game;
+  memset(&game, 0, sizeof(game));
+  game.map = map;
+  game.mapWidth = NC;
+  game.mapHeight = NR;
+  game.encodedMapLength = cells;
+
+  // Pick player positions spread evenly over the room spots
+  int spots = 0;
+  for(int i = 0; i < cells; i++){
+    if(map[i] == '.'){
+      spots++;
+    }
+  }
+  if(spots == 0){
+    fprintf(stderr, "skipping %s: no room spots\n", path);
+    mem_free(terrain);
+    mem_free(map);
+    return;
+  }
+  int numPositions = spots < positions ? spots : positions;
+  int* where = mem_malloc(numPositions * sizeof(int));
+  for(int i = 0, seen = 0, next = 0; i < cells && next < numPositions; i++){
+    if(map[i] == '.'){
+      if(seen == (long)next * spots / numPositions){
+        where[next++] = i;
+      }
+      seen++;
+    }
+  }
+
+  char* visible = mem_malloc(cells + 1);
+  char* playerMap = mem_malloc(cells + 1);
+  int words = map_mask_words(NC, NR);
+  uint64_t* seen = mem_calloc(words, sizeof(uint64_t));
+  uint64_t* seeing = mem_malloc(words * sizeof(uint64_t));
+  uint64_t* previous = mem_calloc(words, sizeof(uint64_t));
+  unsigned char* packed = mem_malloc(2 * cells);
+  char* unpacked = mem_malloc(cells);
+  visible[cells] = '\0';
+  memset(playerMap, ' ', cells);
+  playerMap[cells] = '\0';
+
+  result_t vis = {path, "map_get_visible", NC, NR, 0, 0, 0, 0};
+  result_t merge = {path, "map_merge", NC, NR, 0, 0, 0, 0};
+  result_t compose = {path, "map_compose", NC, NR, 0, 0, 0, 0};
+  result_t decode = {path, "map_decode", NC, NR, 0, 0, 0, 0};
+  result_t init = {path, "map_player_init", NC, NR, 0, 0, 0, 0};
+  result_t rleEncode = {path, "wire_rleEncode", NC, NR, 0, 0, 0, 0};
+  result_t rleDecode = {path, "wire_rleDecode", NC, NR, 0, 0, 0, 0};
+
+  // Visibility and merge, walking the player over every chosen position
+  for(int r = 0; r < rounds; r++){
+    for(int p = 0; p < numPositions; p++){
+      int x = where[p] % NC;
+      int y = where[p] / NC;
+
+      long a0 = allocCount;
+      uint64_t t0 = histogram_nowNanos();
+      map_get_visible(x, y, map, terrain, visible, NC, NR);
+      uint64_t t1 = histogram_nowNanos();
+      long a1 = allocCount;
+      // (packing the visible map into a mask is part of merging it)
+      map_mask_visible(seeing, visible, NC, NR);
+      map_merge(seen, seeing, words);
+      uint64_t t2 = histogram_nowNanos();
+      map_compose(playerMap, NC, map, map, seen, seeing, previous, x, y, NC, NR);
+      uint64_t t3 = histogram_nowNanos();
+      memcpy(previous, seeing, words * sizeof(uint64_t));
+
+      vis.calls++;
+      vis.nanos += t1 - t0;
+      vis.allocs += a1 - a0;
+      merge.calls++;
+      merge.nanos += t2 - t1;
+      merge.allocs += allocCount - a1;
+      compose.calls++;
+      compose.nanos += t3 - t2;
+
+      // Compressing the map as it is now, as the server does for a DISPLAY
+      long a2 = allocCount;
+      t2 = histogram_nowNanos();
+      size_t length = wire_rleEncode(playerMap, cells, packed, 2 * cells);
+      t3 = histogram_nowNanos();
+      bool ok = wire_rleDecode(packed, length, unpacked, cells);
+      uint64_t t4 = histogram_nowNanos();
+      if(!ok || memcmp(unpacked, playerMap, cells) != 0){
+        fprintf(stderr, "%s: run-length codec does not round-trip\n", path);
+      }
+      rleEncode.calls++;
+      rleEncode.nanos += t3 - t2;
+      rleEncode.allocs += allocCount - a2;
+      rleEncode.bytes += length;
+      rleDecode.calls++;
+      rleDecode.nanos += t4 - t3;
+      rleDecode.bytes += cells;
+    }
+  }
+
+  // Decoding the player's map for display, freeing as the server does
+  for(int r = 0; r < rounds * numPositions; r++){
+    long a0 = allocCount;
+    uint64_t t0 = histogram_nowNanos();
+    char* decoded = map_decode(playerMap, &game);
+    uint64_t t1 = histogram_nowNanos();
+    decode.allocs += allocCount - a0;
+    decode.bytes += cells + NR;
+    mem_free(decoded);
+    decode.calls++;
+    decode.nanos += t1 - t0;
+  }
+
+  // Choosing starting positions for a stream of joining players
+  for(int r = 0; r < rounds * numPositions; r++){
+    int x = 0, y = 0;
+    int seed = r + 1;
+    game.activePlayersCount = r % MaxPlayers;
+    long a0 = allocCount;
+    uint64_t t0 = histogram_nowNanos();
+    map_player_init(map, &x, &y, &seed, NC, NR, &game);
+    uint64_t t1 = histogram_nowNanos();
+    init.allocs += allocCount - a0;
+    init.calls++;
+    init.nanos += t1 - t0;
+  }
+
+  report(&vis, csv, json, firstJson);
+  report(&merge, csv, json, firstJson);
+  report(&compose, csv, json, firstJson);
+  report(&decode, csv, json, firstJson);
+  report(&init, csv, json, firstJson);
+  report(&rleEncode, csv, json, firstJson);
+  report(&rleDecode, csv, json, firstJson);
+  printf("%-52s DISPLAY payload: text %d bytes, run-length %.0f bytes on average (%.1fx smaller)\n",
+         path, cells + NR, (double)rleEncode.bytes / rleEncode.calls,
+         rleEncode.bytes > 0 ? (double)(cells + NR) * rleEncode.calls / rleEncode.bytes : 0);
+
+  mem_free(where);
+  mem_free(visible);
+  mem_free(playerMap);
+  mem_free(seen);
+  mem_free(seeing);
+  mem_free(previous);
+  mem_free(packed);
+  mem_free(unpacked);
+  mem_free(terrain);
+  mem_free(map);
+}
+
+/* *** report ***
+Prints one result to stdout and, if requested, to the CSV and JSON files.
+*/
+static void report(const result_t* r, FILE* csv, FILE* json, bool* firstJson){
+  int cells = r->width * r->height;
+  double nsPerCall = r->calls > 0 ? (double)r->nanos / r->calls : 0;
+  double nsPerCell = nsPerCall / cells;
+  double cellsPerSec = r->nanos > 0 ? (double)cells * r->calls * 1e9 / r->nanos : 0;
+  double allocsPerCall = r->calls > 0 ? (double)r->allocs / r->calls : 0;
+  double bytesPerCall = r->calls > 0 ? (double)r->bytes / r->calls : 0;
+
+  printf("%-52s %-16s %9d %12.0f %10.2f %14.0f %8.2f %10.0f\n",
+         r->map, r->kernel, cells, nsPerCall, nsPerCell, cellsPerSec, allocsPerCall, bytesPerCall);
+
+  if(csv != NULL){
+    fprintf(csv, "%s,%s,%d,%d,%d,%ld,%.1f,%.3f,%.0f,%.3f,%.1f\n",
+            r->map, r->kernel, r->width, r->height, cells, r->calls,
+            nsPerCall, nsPerCell, cellsPerSec, allocsPerCall, bytesPerCall);
+  }
+  if(json != NULL){
+    fprintf(json, "%s  {\"map\": \"%s\", \"kernel\": \"%s\", \"width\": %d, \"height\": %d, "
+            "\"cells\": %d, \"calls\": %ld, \"ns_per_call\": %.1f, \"ns_per_cell\": %.3f, "
+            "\"cells_per_sec\": %.0f, \"allocs_per_call\": %.3f, \"bytes_per_call\": %.1f}",
+            *firstJson ? "" : ",\n", r->map, r->kernel, r->width, r->height,
+            cells, r->calls, nsPerCall, nsPerCell, cellsPerSec, allocsPerCall, bytesPerCall);
+    *firstJson = false;
+  }
+}
@@ -9,6 +9,7 @@
 #include<unistd.h>
 #include<math.h>
 #include "../game_module/game.h"
+#include "map.h"
 #include "../libcs50/mem.h"
 
 
@@ -17,7 +18,12 @@
 /*
 Helper function that determines the visibility of one point and returns true or false
 */
-static bool isVisible(int x, int y, int ptX, int ptY, char* masterMap, const int NC);
+static bool isVisible(int x, int y, int ptX, int ptY, const unsigned char* terrain, const int NC);
+
+/*
+Helper function that numbers the 8 directions 0-7, for the tables map_runs makes
+*/
+static int runDirection(int dx, int dy);
 
 
 /// GLOBAL FUNCTIONS 
@@ -43,7 +49,6 @@ void map_player_init(char* masterMap, int* x, int* y, int* seed, const int NC, c
   if(seed == NULL){
     srand(getpid());
   }else{
-    printf("active player count: %d", game->activePlayersCount);
     srand(*seed + game->activePlayersCount);
   }
 
@@ -62,21 +67,22 @@ Inputs:
 int x - a vaild player posistion (number of column the player is in)
 int y - a vaild player posistion (number of row the player is in)
 char* mainMap - the always up to date map with all players and all gold passed from game module
+const unsigned char* terrain - the tile code of each cell (generated by map_terrain)
 char* visibleMap - an empty initialized string that has enough memory allocated to store a map
 const int NC - number of columns in the map 
 const int NR - number of rows in the map
 
 Function that takes in a player's coordinates and the main map and puts the visibleMap (only what the payer sees immediately) 
-into a previously allocated string. 
+into a previously allocated string. Only the terrain decides what blocks the view, so gold and players never do.
 
 */
-void map_get_visible(int x, int y, char* masterMap, char* visibleMap, const int NC, const int NR){
-  int length = strlen(masterMap);
+void map_get_visible(int x, int y, char* masterMap, const unsigned char* terrain, char* visibleMap, const int NC, const int NR){
+  int length = NC*NR;
   int ptX, ptY; // coordinaets of the point we want to determine the visibility of 
   for(int i = 0; i < length; i++){
     ptY = i/NC;
     ptX = i - ptY*NC;
-    if(isVisible(x, y, ptX, ptY, masterMap, NC)){
+    if(isVisible(x, y, ptX, ptY, terrain, NC)){
       visibleMap[i] = masterMap[i];
     }else{
       visibleMap[i] = ' ';
@@ -94,11 +100,11 @@ int x - player location (colunm)
 int y - player location (row)
 int ptX - locaiton of the point we want to determine the visibility of (column)
 int ptY - locaiton of the point we want to determine the visibility of (row)
-char* mainMap - the always up to date map with all players and all gold passed from game module
+const unsigned char* terrain - the tile code of each cell; only room spots can be seen through
 const int NC - number of columns in the map 
 
 */
-static bool isVisible(int x, int y, int ptX, int ptY, char* masterMap, const int NC){
+static bool isVisible(int x, int y, int ptX, int ptY, const unsigned char* terrain, const int NC){
   float k; // k is the slope coefficient
   int yNew, xNew;
   int location;
@@ -110,7 +116,7 @@ static bool isVisible(int x, int y, int ptX, int ptY, char* masterMap, const int
         yNew = y; // the fractional part is discarded in this case
         xNew = x + i;
         location = (yNew)*NC + xNew ;
-        if((masterMap[location] != '.' && masterMap[location] != '*' && (masterMap[location] < 'A' || masterMap[location] > 'Z'))){
+        if(terrain[location] != map_ROOM){
           return false;
         }
       }
@@ -119,7 +125,7 @@ static bool isVisible(int x, int y, int ptX, int ptY, char* masterMap, const int
         yNew = y; // the fractional part is discarded in this case
         xNew = x + i;
         location = (yNew)*NC + xNew ;
-        if((masterMap[location] != '.' && masterMap[location] != '*' && (masterMap[location] < 'A' || masterMap[location] > 'Z'))){
+        if(terrain[location] != map_ROOM){
           return false;
         }
       }
@@ -134,7 +140,7 @@ static bool isVisible(int x, int y, int ptX, int ptY, char* masterMap, const int
         yNew = y + i;
         xNew = x;
         location = (yNew)*NC + xNew;
-        if(masterMap[location] != '.' && masterMap[location] != '*' && (masterMap[location] < 'A' || masterMap[location] > 'Z')){
+        if(terrain[location] != map_ROOM){
           return false;
         }
       }
@@ -143,7 +149,7 @@ static bool isVisible(int x, int y, int ptX, int ptY, char* masterMap, const int
         yNew = y + i; // the fractional part is discarded in this case
         xNew = x;
         location = (yNew)*NC + xNew;
-        if(masterMap[location] != '.' && masterMap[location] != '*' && (masterMap[location] < 'A' || masterMap[location] > 'Z')){
+        if(terrain[location] != map_ROOM){
           return false;
         }
       }
@@ -168,7 +174,7 @@ static bool isVisible(int x, int y, int ptX, int ptY, char* masterMap, const int
           printf("your math is wrong\n");
           return true;
         }
-        if((masterMap[location] != '.' && masterMap[location] != '*' && (masterMap[location] < 'A' || masterMap[location] > 'Z')) && (masterMap[location + NC] != '.' && masterMap[location + NC] != '*' && (masterMap[location+NC] < 'A' || masterMap[location+NC] > 'Z'))){
+        if(terrain[location] != map_ROOM && terrain[location + NC] != map_ROOM){
           return false;
         }
       }
@@ -182,7 +188,7 @@ static bool isVisible(int x, int y, int ptX, int ptY, char* masterMap, const int
           printf("your math is wrong\n");
           return true;
         }
-        if((masterMap[location] != '.' && masterMap[location] != '*' && (masterMap[location] < 'A' || masterMap[location] > 'Z')) && (masterMap[location + NC] != '.' && masterMap[location + NC] != '*' && (masterMap[location+NC] < 'A' || masterMap[location+NC] > 'Z'))){
+        if(terrain[location] != map_ROOM && terrain[location + NC] != map_ROOM){
           return false;
         }
       }
@@ -198,7 +204,7 @@ static bool isVisible(int x, int y, int ptX, int ptY, char* masterMap, const int
           printf("your math is wrong\n");
           return true;
         }
-        if ((masterMap[location] != '.' && masterMap[location] != '*' && (masterMap[location] < 'A' || masterMap[location] > 'Z')) && (masterMap[location + 1] != '.' && masterMap[location + 1] != '*'  && (masterMap[location+1] < 'A' || masterMap[location+1] > 'Z'))){
+        if(terrain[location] != map_ROOM && terrain[location + 1] != map_ROOM){
           return false;
         }
       }
@@ -212,7 +218,7 @@ static bool isVisible(int x, int y, int ptX, int ptY, char* masterMap, const int
           printf("your math is wrong\n");
           return true;
         }
-        if ((masterMap[location] != '.' && masterMap[location] != '*' && (masterMap[location] < 'A' || masterMap[location] > 'Z')) && (masterMap[location + 1] != '.' && masterMap[location + 1] != '*' && (masterMap[location+1] < 'A' || masterMap[location+1] > 'Z'))){
+        if(terrain[location] != map_ROOM && terrain[location + 1] != map_ROOM){
           return false;
         }
       }
@@ -222,30 +228,121 @@ static bool isVisible(int x, int y, int ptX, int ptY, char* masterMap, const int
   }
 }
 
+/* *** map_mask_words ***
+
+Inputs:
+const int NC - number of columns in the map 
+const int NR - number of rows in the map
+
+Output:
+int - how many 64-bit words a mask of one bit per map cell takes
+
+*/
+int map_mask_words(const int NC, const int NR){
+  return (NC*NR + 63)/64;
+}
+
+/* *** map_mask_visible ***
+
+Inputs:
+uint64_t* visible - a mask of map_mask_words words, overwritten
+const char* visibleMap - map of what the player sees immediately from the spot they are at (generated by map_get_visible)
+const int NC and const int NR - dimentions of the map
+
+Function that packs a visible map into a mask: the bit of a cell is set if the cell is not blank. 
+
+*/
+void map_mask_visible(uint64_t* visible, const char* visibleMap, const int NC, const int NR){
+  int length = NC*NR;
+  for(int w = 0; w < map_mask_words(NC, NR); w++){
+    uint64_t bits = 0;
+    int first = 64*w;
+    int last = (first + 64 < length) ? first + 64 : length;
+    for(int i = first; i < last; i++){
+      if(visibleMap[i] != ' '){
+        bits |= (uint64_t)1 << (i - first);
+      }
+    }
+    visible[w] = bits;
+  }
+}
+
 /* *** map_merge ***
 
-char* playerMap - most relevant map of the player (what the user saw before the current update)
-char* visibleMap - map of what the player sees immediately from the spot they are at (generated by map_get_visible)
-int NC and int NR - dimentions of the map
+uint64_t* seen - mask of every cell the player saw before the current update
+const uint64_t* visible - mask of what the player sees immediately from the spot they are at (generated by map_mask_visible)
+const int words - the length of both masks (map_mask_words)
 
-Function that takes in the visible map and the payer's presious map and merges them 
-omitting the gold and other players from previous map. Most relevant map of the player 
-is in playerMap as a result of this function.
+Function that adds what the player sees now to what they have seen, a word of cells at a time. 
+Only the mask is remembered: a spot seen before but not now shows the bare map (see map_compose),
+so the gold and other players that were there are omitted.
 
 */
-void map_merge(char* playerMap, char* visibleMap, int NC, int NR){
-  if(playerMap == NULL || visibleMap == NULL){
+void map_merge(uint64_t* seen, const uint64_t* visible, const int words){
+  if(seen == NULL || visible == NULL){
     return;
   }
+  for(int w = 0; w < words; w++){
+    seen[w] |= visible[w];
+  }
+}
+
+/* *** map_mask_set ***
+
+Inputs:
+uint64_t* mask - a mask of one bit per map cell
+int index - the cell whose bit to set
+
+*/
+void map_mask_set(uint64_t* mask, int index){
+  mask[index/64] |= (uint64_t)1 << (index%64);
+}
+
+/* *** map_compose ***
+
+Inputs:
+char* playerMap - the player's map, to bring up to date
+const int stride - how far apart the rows of playerMap are (NC, or more to leave room for a '\n' after each row)
+const char* masterMap - the always up to date map with all players and all gold
+const char* bareMap - the map with no players and no gold on it
+const uint64_t* seen - the cells the player has ever seen (map_merge)
+const uint64_t* visible - the cells the player sees now (map_mask_visible), all of them also in seen
+const uint64_t* previous - the cells the player saw when playerMap was last composed (all 0 the first time)
+int x, int y - the spot of the player
+const int NC and const int NR - dimentions of the map
+
+Function that builds the map a player is shown: the master map where they can see now, the bare map 
+where they have been, blanks everywhere else, and '@' where they stand. Only words of cells seen then 
+or now are rewritten: a cell seen in neither shows the bare map or a blank, as it did before, so 
+playerMap must start out blank.
+
+*/
+void map_compose(char* playerMap, const int stride, const char* masterMap, const char* bareMap, const uint64_t* seen, const uint64_t* visible, const uint64_t* previous, int x, int y, const int NC, const int NR){
   int length = NC*NR;
-  for(int i = 0; i < length; i++){
-    if(playerMap[i] == '*' || (playerMap[i] >= 'A' && playerMap[i] <= 'Z')){
-      playerMap[i] = '.';
+  for(int w = 0; w < map_mask_words(NC, NR); w++){
+    if((previous[w] | visible[w]) == 0){
+      continue;
     }
-    if(visibleMap[i] != ' '){
-      playerMap[i] = visibleMap[i];
+    int first = 64*w;
+    int last = (first + 64 < length) ? first + 64 : length;
+    int row = first/NC, col = first%NC;
+    for(int i = first; i < last; i++){
+      uint64_t bit = (uint64_t)1 << (i - first);
+      char* cell = playerMap + row*stride + col;
+      if(visible[w] & bit){
+        *cell = masterMap[i];
+      }else if(seen[w] & bit){
+        *cell = bareMap[i];
+      }else{
+        *cell = ' ';
+      }
+      if(++col == NC){
+        col = 0;
+        row++;
+      }
     }
   }
+  playerMap[y*stride+x] = '@';
 }
 
 /* *** map_decode ***
@@ -280,3 +377,294 @@ char* map_decode(char* map, game_t* game)
 
     return result;  // Return the formatted map string
 }
+
+/* *** map_terrain ***
+
+Inputs:
+const char* map - the map with no players and no gold on it
+const int NC - number of columns in the map 
+const int NR - number of rows in the map
+
+Output:
+unsigned char* - the tile code (map_tile_t) of each cell, or NULL if memory runs out
+
+Function that classifies every cell of the map once, when it is loaded, so the game and map_get_visible 
+can tell what a cell is with one load instead of comparing its character against a list.
+
+*/
+unsigned char* map_terrain(const char* map, const int NC, const int NR){
+  int cells = NC*NR;
+  unsigned char* terrain = mem_malloc(cells);
+  if(terrain == NULL){
+    return NULL;
+  }
+  for(int i = 0; i < cells; i++){
+    switch(map[i]){
+      case '.': terrain[i] = map_ROOM; break;
+      case '#': terrain[i] = map_PASSAGE; break;
+      case '-': case '|': case '+': terrain[i] = map_WALL; break;
+      default: terrain[i] = map_SOLID; break;
+    }
+  }
+  return terrain;
+}
+
+/* *** map_segment ***
+
+Inputs:
+const char* map - the map with no players and no gold on it (only '.', '#', walls and solid rock)
+const int NC - number of columns in the map 
+const int NR - number of rows in the map
+
+Output:
+map_segments_t* - the segments of the map, or NULL if memory runs out
+
+Function that splits the spots of the map into rooms and passages. Neighbouring spots of the same kind
+(diagonals included, since players move diagonally) are flood-filled into one segment. A player in a 
+room sees only that room, its walls and the passages that open onto it, so each segment's reach starts 
+as its bounding rectangle grown by one cell; map_segments_learn widens it to whatever the players have 
+actually seen from it, so the reach never misses a cell a player can see.
+
+*/
+map_segments_t* map_segment(const char* map, const int NC, const int NR){
+  int cells = NC*NR;
+  map_segments_t* segments = mem_malloc(sizeof(map_segments_t));
+  if(segments == NULL){
+    return NULL;
+  }
+  segments->count = 0;
+  segments->reach = NULL;
+  segments->cell = mem_malloc(cells * sizeof(int));
+  int* stack = mem_malloc(cells * sizeof(int));
+  if(segments->cell == NULL || stack == NULL){
+    if(stack != NULL){
+      mem_free(stack);
+    }
+    map_segments_delete(segments);
+    return NULL;
+  }
+  for(int i = 0; i < cells; i++){
+    segments->cell[i] = -1;
+  }
+
+  // flood-fill each spot not yet in a segment; the rectangles are grown as the segments are found
+  int capacity = 0;
+  for(int start = 0; start < cells; start++){
+    if((map[start] != '.' && map[start] != '#') || segments->cell[start] >= 0){
+      continue;
+    }
+    if(segments->count == capacity){
+      capacity = (capacity == 0) ? 16 : 2*capacity;
+      int* reach = realloc(segments->reach, 4 * capacity * sizeof(int));
+      if(reach == NULL){
+        mem_free(stack);
+        map_segments_delete(segments);
+        return NULL;
+      }
+      segments->reach = reach;
+    }
+    int id = segments->count++;
+    int* r = &segments->reach[4*id];
+    r[0] = r[2] = start/NC;
+    r[1] = r[3] = start%NC;
+
+    int top = 0;
+    stack[top++] = start;
+    segments->cell[start] = id;
+    while(top > 0){
+      int here = stack[--top];
+      int y = here/NC, x = here%NC;
+      if(y < r[0]) r[0] = y;
+      if(y > r[2]) r[2] = y;
+      if(x < r[1]) r[1] = x;
+      if(x > r[3]) r[3] = x;
+      for(int dy = -1; dy <= 1; dy++){
+        for(int dx = -1; dx <= 1; dx++){
+          int ny = y + dy, nx = x + dx;
+          if(ny < 0 || ny >= NR || nx < 0 || nx >= NC){
+            continue;
+          }
+          int next = ny*NC + nx;
+          if(map[next] == map[start] && segments->cell[next] < 0){
+            segments->cell[next] = id;
+            stack[top++] = next;
+          }
+        }
+      }
+    }
+  }
+  mem_free(stack);
+
+  // the walls around a room, and the cells beside a passage, are seen from it too
+  for(int id = 0; id < segments->count; id++){
+    int* r = &segments->reach[4*id];
+    r[0] = (r[0] > 0) ? r[0] - 1 : 0;
+    r[1] = (r[1] > 0) ? r[1] - 1 : 0;
+    r[2] = (r[2] < NR - 1) ? r[2] + 1 : NR - 1;
+    r[3] = (r[3] < NC - 1) ? r[3] + 1 : NC - 1;
+  }
+  return segments;
+}
+
+/* *** map_segments_learn ***
+
+Inputs:
+map_segments_t* segments - the segments of the map (NULL is ignored)
+int x, int y - the spot the visible map was computed from
+const char* visibleMap - what can be seen from there (generated by map_get_visible)
+const int NC - number of columns in the map 
+const int NR - number of rows in the map
+
+Function that widens the reach of the segment of (x, y) to cover every cell of visibleMap that is not blank. 
+
+*/
+void map_segments_learn(map_segments_t* segments, int x, int y, const char* visibleMap, const int NC, const int NR){
+  if(segments == NULL || segments->cell[y*NC+x] < 0){
+    return;
+  }
+  int* r = &segments->reach[4*segments->cell[y*NC+x]];
+  for(int row = 0; row < NR; row++){
+    const char* line = visibleMap + row*NC;
+    int first = 0, last = NC - 1;
+    while(first < NC && line[first] == ' '){
+      first++;
+    }
+    if(first == NC){
+      continue;
+    }
+    while(line[last] == ' '){
+      last--;
+    }
+    if(row < r[0]) r[0] = row;
+    if(row > r[2]) r[2] = row;
+    if(first < r[1]) r[1] = first;
+    if(last > r[3]) r[3] = last;
+  }
+}
+
+/* *** map_segments_sees ***
+
+Inputs:
+const map_segments_t* segments - the segments of the map
+int x, int y - the spot of a player
+int index - a map cell that has changed
+const int NC - number of columns in the map 
+
+Output:
+bool - false only if the player cannot possibly see the cell, so need not be updated for it
+
+*/
+bool map_segments_sees(const map_segments_t* segments, int x, int y, int index, const int NC){
+  if(segments == NULL || segments->cell[y*NC+x] < 0){
+    return true;
+  }
+  const int* r = &segments->reach[4*segments->cell[y*NC+x]];
+  int row = index/NC, col = index%NC;
+  return row >= r[0] && row <= r[2] && col >= r[1] && col <= r[3];
+}
+
+/* *** map_segments_delete ***
+
+Inputs:
+map_segments_t* segments - segments returned by map_segment (NULL is ignored)
+
+*/
+void map_segments_delete(map_segments_t* segments){
+  if(segments == NULL){
+    return;
+  }
+  if(segments->cell != NULL){
+    mem_free(segments->cell);
+  }
+  free(segments->reach);
+  mem_free(segments);
+}
+
+/* *** map_runs ***
+
+Inputs:
+const char* map - the map with no players and no gold on it
+const int NC - number of columns in the map 
+const int NR - number of rows in the map
+
+Output:
+uint16_t* - for each cell, 8 run lengths indexed by runDirection(dx, dy); NULL if memory runs out
+
+Function that computes, once per map, where every capital-letter move ends. The run from a spot is one step 
+more than the run from the spot next to it in the same direction, or 0 if that spot is not a room or passage 
+spot, so each direction is filled in by one pass over the map, starting from the side the runs head towards.
+A run too long for 16 bits is stored as UINT16_MAX, meaning "at least that far"; map_run_length goes on from 
+there.
+
+*/
+uint16_t* map_runs(const char* map, const int NC, const int NR){
+  int cells = NC*NR;
+  uint16_t* runs = mem_malloc(8 * (size_t)cells * sizeof(uint16_t));
+  if(runs == NULL){
+    return NULL;
+  }
+  for(int dy = -1; dy <= 1; dy++){
+    for(int dx = -1; dx <= 1; dx++){
+      if(dx == 0 && dy == 0){
+        continue;
+      }
+      int d = runDirection(dx, dy);
+      for(int row = 0; row < NR; row++){
+        int y = (dy > 0) ? NR - 1 - row : row;
+        for(int col = 0; col < NC; col++){
+          int x = (dx > 0) ? NC - 1 - col : col;
+          int ny = y + dy, nx = x + dx;
+          int run = 0;
+          if(ny >= 0 && ny < NR && nx >= 0 && nx < NC
+             && (map[ny*NC + nx] == '.' || map[ny*NC + nx] == '#')){
+            run = 1 + runs[8*(ny*NC + nx) + d];
+          }
+          runs[8*(y*NC + x) + d] = (run < UINT16_MAX) ? run : UINT16_MAX;
+        }
+      }
+    }
+  }
+  return runs;
+}
+
+/* *** runDirection ***
+
+Inputs:
+int dx, int dy - a direction, each -1, 0 or 1, not both 0
+
+Output:
+int - its index, 0-7, among a cell's runs
+
+*/
+static int runDirection(int dx, int dy){
+  int d = (dy+1)*3 + (dx+1);  // 0-8, with 4 for staying put
+  return (d < 4) ? d : d - 1;
+}
+
+/* *** map_run_length ***
+
+Inputs:
+const uint16_t* runs - the table made by map_runs
+int x, int y - a spot on the map
+int dx, int dy - the direction of the run, each -1, 0 or 1
+const int NC - number of columns in the map 
+
+Output:
+int - the number of steps the run takes; 0 if dx and dy are both 0
+
+*/
+int map_run_length(const uint16_t* runs, int x, int y, int dx, int dy, const int NC){
+  if(dx == 0 && dy == 0){
+    return 0;
+  }
+  int d = runDirection(dx, dy);
+  int steps = 0;
+  int run;
+  do{  // a saturated count only says the run gets that far; look again from there
+    run = runs[8*(y*NC + x) + d];
+    steps += run;
+    x += run*dx;
+    y += run*dy;
+  }while(run == UINT16_MAX);
+  return steps;
+}
@@ -8,6 +8,7 @@
 #include<stdbool.h>
 #include<unistd.h>
 #include<math.h>
+#include<stdint.h>
 #include "../game_module/game.h"
 
 
@@ -17,14 +18,100 @@ Function that takes in seed and based on it returns a player's starting coordina
 void map_player_init(char* masterMap, int* x, int* y, int* seed, const int NC, const int NR, game_t* game);
 
 /*
-Function that takes in a player's coordinates and the master map and outputs the visibleMap (only what the payer sees immediately)  
+The terrain of a map cell, one byte per cell (see map_terrain). Gold and players are kept apart from it, 
+so the terrain of a map never changes once it is loaded.
 */
-void map_get_visible(int x, int y, char* masterMap, char* visibleMap, const int NC, const int NR);
+typedef enum map_tile {
+  map_SOLID,    // solid rock (' ')
+  map_WALL,     // a wall or corner ('-', '|' or '+')
+  map_ROOM,     // a room spot ('.'), the only kind that can be seen through
+  map_PASSAGE   // a passage spot ('#')
+} map_tile_t;
 
 /*
-Function that takes in the visible map and the payer's presious map and merges them omitting the gold from previous map. 
+Function that takes in a map with no players or gold on it and returns the map_tile_t of every cell, 
+to be freed with mem_free; or NULL on error.
 */
-void map_merge(char* playerMap, char* visibleMap, int NC, int NR);
+unsigned char* map_terrain(const char* map, const int NC, const int NR);
+
+/*
+Function that takes in a player's coordinates, the master map and its terrain and outputs the visibleMap (only what the payer sees immediately)  
+*/
+void map_get_visible(int x, int y, char* masterMap, const unsigned char* terrain, char* visibleMap, const int NC, const int NR);
+
+/*
+A player's memory of the map is a mask of one bit per map cell (bit i%64 of word i/64), set for the cells 
+they have seen; the map they are shown is composed from it when it is sent. 
+Function that returns how many words such a mask takes.
+*/
+int map_mask_words(const int NC, const int NR);
+
+/*
+Function that packs a visibleMap into a mask of its cells that are not blank.
+*/
+void map_mask_visible(uint64_t* visible, const char* visibleMap, const int NC, const int NR);
+
+/*
+Function that merges what the player sees now into what they have seen, omitting the gold and other players 
+from the previous map (only the mask is kept). 
+*/
+void map_merge(uint64_t* seen, const uint64_t* visible, const int words);
+
+/*
+Function that sets the bit of one cell in a mask.
+*/
+void map_mask_set(uint64_t* mask, int index);
+
+/*
+Function that composes a player's map, with rows 'stride' apart, from the master map where they see now, 
+the bare map where they have seen before, and blanks elsewhere, with '@' at (x, y). Only the cells they saw 
+at the last call ('previous') or see now are rewritten, so playerMap must start out blank.
+*/
+void map_compose(char* playerMap, const int stride, const char* masterMap, const char* bareMap, const uint64_t* seen, const uint64_t* visible, const uint64_t* previous, int x, int y, const int NC, const int NR);
 
 
-char* map_decode(char* map, game_t* game);
\ No newline at end of file
+char* map_decode(char* map, game_t* game);
+
+/*
+The rooms and passages of a map, found once when it is loaded: every connected region of room spots ('.') 
+is one segment, and so is every connected region of passage spots ('#'). For each segment, reach holds the 
+rectangle (top, left, bottom, right) that covers everything seen so far from any spot in it.
+*/
+typedef struct map_segments {
+  int count;    // number of segments
+  int* cell;    // the segment of each map cell, or -1 for walls and solid rock
+  int* reach;   // 4 ints per segment: top, left, bottom, right
+} map_segments_t;
+
+/*
+Function that segments a map with no players or gold on it into rooms and passages. Returns NULL on error; 
+the result is freed with map_segments_delete.
+*/
+map_segments_t* map_segment(const char* map, const int NC, const int NR);
+
+/*
+Function that widens the reach of the segment of spot (x, y) to cover a visibleMap computed from there.
+*/
+void map_segments_learn(map_segments_t* segments, int x, int y, const char* visibleMap, const int NC, const int NR);
+
+/*
+Function that tells whether a change to map cell 'index' could be seen by a player at spot (x, y).
+*/
+bool map_segments_sees(const map_segments_t* segments, int x, int y, int index, const int NC);
+
+/*
+Function that frees what map_segment allocated.
+*/
+void map_segments_delete(map_segments_t* segments);
+
+/*
+Function that measures, on a map with no players or gold on it, how many steps a player can run from each spot 
+in each of the 8 directions before the next step would hit a wall. Returns a table of 8 counts per cell, 
+each at most UINT16_MAX, to be read with map_run_length and freed with mem_free; or NULL on error.
+*/
+uint16_t* map_runs(const char* map, const int NC, const int NR);
+
+/*
+Function that looks up how many steps a player at (x, y) can run in direction (dx, dy), each -1, 0 or 1.
+*/
+int map_run_length(const uint16_t* runs, int x, int y, int dx, int dy, const int NC);
\ No newline at end of file
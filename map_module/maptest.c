@@ -0,0 +1,236 @@
+// Unit test of the map module's run and segment tables for the Nuggets project
+// CS50, 24F
+// Team 10
+//
+// Usage: ./maptest [map.txt ...]
+//
+// Checks map_runs and map_run_length, and map_segment with map_segments_sees
+// and map_segments_learn, on small maps written out below, and checks
+// map_runs and map_segment against plain step-by-step walks and flood
+// fills on every map given on the command line, or on every map in
+// ../maps/ and ../maps/contrib*/ if none are given.  Prints each failed
+// check and exits with the number of failures.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdbool.h>
+#include<stdint.h>
+#include<glob.h>
+#include "map.h"
+#include "../libcs50/mem.h"
+#include "../libcs50/file.h"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  do { if (!(cond)) { printf("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+// LOCAL FUNCTIONS
+static void testSmall(void);
+static void testLongRun(void);
+static void testMap(const char* path);
+static bool isSpot(const char* map, int x, int y, const int NC, const int NR);
+static char* loadMap(const char* path, int* width, int* height);
+
+// A room, and a passage leaving its east wall that turns south and
+// then steps diagonally
+static const char* small =
+  "+---+     "
+  "|...|     "
+  "|...####  "
+  "+---+  #  "
+  "        # ";
+
+
+int main(int argc, char* argv[]){
+  testSmall();
+  testLongRun();
+
+  glob_t maps;
+  memset(&maps, 0, sizeof(maps));
+  if(argc > 1){
+    maps.gl_pathc = argc - 1;
+    maps.gl_pathv = argv + 1;
+  }else{
+    glob("../maps/*.txt", 0, NULL, &maps);
+    glob("../maps/contrib*/*.txt", GLOB_APPEND, NULL, &maps);
+  }
+  for(size_t i = 0; i < maps.gl_pathc; i++){
+    testMap(maps.gl_pathv[i]);
+  }
+  if(argc <= 1){
+    globfree(&maps);
+  }
+
+  printf("maptest: %d failures\n", failures);
+  return failures;
+}
+
+/* *** testSmall ***
+
+Checks the runs and segments of the small map above against counts worked out by hand.
+
+*/
+static void testSmall(void){
+  const int NC = 10, NR = 5;
+  uint16_t* runs = map_runs(small, NC, NR);
+  CHECK(runs != NULL);
+  CHECK(map_run_length(runs, 1, 1, 1, 0, NC) == 2);    // along the room
+  CHECK(map_run_length(runs, 1, 1, 0, 1, NC) == 1);
+  CHECK(map_run_length(runs, 1, 1, 1, 1, NC) == 1);
+  CHECK(map_run_length(runs, 1, 1, -1, 0, NC) == 0);   // into the wall
+  CHECK(map_run_length(runs, 1, 1, 0, 0, NC) == 0);    // staying put
+  CHECK(map_run_length(runs, 3, 2, 1, 0, NC) == 4);    // out through the doorway
+  CHECK(map_run_length(runs, 7, 2, 0, 1, NC) == 1);
+  CHECK(map_run_length(runs, 7, 3, 1, 1, NC) == 1);
+  CHECK(map_run_length(runs, 8, 4, -1, -1, NC) == 2);   // and on into the passage
+  CHECK(map_run_length(runs, 7, 2, -1, 0, NC) == 6);   // back across the room
+  mem_free(runs);
+
+  map_segments_t* segments = map_segment(small, NC, NR);
+  CHECK(segments != NULL && segments->count == 2);
+  int room = segments->cell[1*NC + 1];
+  int passage = segments->cell[2*NC + 4];
+  CHECK(room >= 0 && passage >= 0 && room != passage);
+  CHECK(segments->cell[2*NC + 3] == room);
+  CHECK(segments->cell[4*NC + 8] == passage);          // joined diagonally
+  CHECK(segments->cell[0] == -1 && segments->cell[2*NC + 9] == -1);
+
+  // the room sees its walls and the doorway, not the far end of the passage
+  CHECK(map_segments_sees(segments, 1, 1, 0, NC));
+  CHECK(map_segments_sees(segments, 1, 1, 3*NC + 4, NC));
+  CHECK(!map_segments_sees(segments, 1, 1, 4*NC + 8, NC));
+  CHECK(map_segments_sees(segments, 7, 3, 4*NC + 9, NC));
+  CHECK(!map_segments_sees(segments, 7, 3, 0, NC));
+  CHECK(map_segments_sees(segments, 0, 0, 4*NC + 9, NC));  // from a wall: anything
+
+  // having seen further from the room, it sees that far from then on
+  char visible[10*5];
+  memset(visible, ' ', sizeof(visible));
+  visible[4*NC + 8] = '#';
+  map_segments_learn(segments, 2, 1, visible, NC, NR);
+  CHECK(map_segments_sees(segments, 1, 1, 4*NC + 8, NC));
+  CHECK(map_segments_sees(segments, 1, 1, 3*NC + 6, NC));
+  map_segments_delete(segments);
+}
+
+/* *** testLongRun ***
+
+Checks a run longer than a 16-bit count holds: one column of passage 70000 rows tall.
+
+*/
+static void testLongRun(void){
+  const int NC = 1, NR = 70000;
+  char* map = mem_malloc(NR + 1);
+  memset(map, '#', NR);
+  map[NR] = '\0';
+  uint16_t* runs = map_runs(map, NC, NR);
+  CHECK(runs != NULL);
+  CHECK(map_run_length(runs, 0, 0, 0, 1, NC) == NR - 1);
+  CHECK(map_run_length(runs, 0, 10, 0, 1, NC) == NR - 11);
+  CHECK(map_run_length(runs, 0, NR - 1, 0, -1, NC) == NR - 1);
+  CHECK(map_run_length(runs, 0, 4464, 0, 1, NC) == 65535);
+  CHECK(map_run_length(runs, 0, 4463, 0, 1, NC) == 65536);
+  CHECK(map_run_length(runs, 0, 0, 1, 1, NC) == 0);
+  mem_free(runs);
+  mem_free(map);
+}
+
+/* *** testMap ***
+
+Checks every run on a map against a walk, step by step, and checks that every spot is in a segment
+with its neighbours of the same kind, and in its segment's reach.
+
+*/
+static void testMap(const char* path){
+  int NC, NR;
+  char* map = loadMap(path, &NC, &NR);
+  if(map == NULL){
+    printf("FAIL: cannot load %s\n", path);
+    failures++;
+    return;
+  }
+  uint16_t* runs = map_runs(map, NC, NR);
+  map_segments_t* segments = map_segment(map, NC, NR);
+  CHECK(runs != NULL && segments != NULL);
+  int wrong = 0;
+  for(int y = 0; y < NR; y++){
+    for(int x = 0; x < NC; x++){
+      for(int dy = -1; dy <= 1; dy++){
+        for(int dx = -1; dx <= 1; dx++){
+          int steps = 0;
+          while((dx != 0 || dy != 0) && isSpot(map, x + (steps+1)*dx, y + (steps+1)*dy, NC, NR)){
+            steps++;
+          }
+          if(map_run_length(runs, x, y, dx, dy, NC) != steps){
+            wrong++;
+          }
+          int id = segments->cell[y*NC + x];
+          if(isSpot(map, x, y, NC, NR) != (id >= 0)){
+            wrong++;
+          }else if(id >= 0 && (!map_segments_sees(segments, x, y, y*NC + x, NC)
+                   || (isSpot(map, x+dx, y+dy, NC, NR) && map[(y+dy)*NC + x+dx] == map[y*NC + x]
+                       && segments->cell[(y+dy)*NC + x+dx] != id))){
+            wrong++;
+          }
+        }
+      }
+    }
+  }
+  if(wrong > 0){
+    printf("FAIL: %s: %d runs or segments wrong\n", path, wrong);
+    failures++;
+  }
+  mem_free(runs);
+  map_segments_delete(segments);
+  mem_free(map);
+}
+
+/* *** isSpot ***
+
+True if (x, y) is on the map and a room or passage spot.
+
+*/
+static bool isSpot(const char* map, int x, int y, const int NC, const int NR){
+  return x >= 0 && x < NC && y >= 0 && y < NR && (map[y*NC + x] == '.' || map[y*NC + x] == '#');
+}
+
+/* *** loadMap ***
+
+Reads a map file into one string, its rows padded with blanks to the widest; as in bench.c.
+
+*/
+static char* loadMap(const char* path, int* width, int* height){
+  FILE* fp = fopen(path, "r");
+  if(fp == NULL){
+    return NULL;
+  }
+  *width = 0;
+  *height = 0;
+  char* line;
+  while((line = file_readLine(fp)) != NULL){
+    int len = strlen(line);
+    if(len > *width){
+      *width = len;
+    }
+    (*height)++;
+    mem_free(line);
+  }
+  if(*width == 0){
+    fclose(fp);
+    return NULL;
+  }
+  rewind(fp);
+  char* map = mem_malloc((*width) * (*height) + 1);
+  memset(map, ' ', (*width) * (*height));
+  map[(*width) * (*height)] = '\0';
+  for(int row = 0; (line = file_readLine(fp)) != NULL; row++){
+    memcpy(map + row*(*width), line, strlen(line));
+    mem_free(line);
+  }
+  fclose(fp);
+  return map;
+}
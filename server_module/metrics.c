@@ -0,0 +1,206 @@
+/*
+ * metrics.c - hot-path instrumentation for the Nuggets server (Team 10)
+ *
+ * see metrics.h for more information.
+ *
+ * Team 10
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "metrics.h"
+#include "../support/histogram.h"
+#include "../support/wire.h"
+
+/**************** local constants ****************/
+static const char* typeNames[metrics_NumTypes] = {"PLAY", "SPECTATE", "KEY", "KEYS", "other"};
+static const char* stageNames[metrics_NumStages] = {"handle", "move", "visibility", "encode", "send"};
+
+/**************** local variables ****************/
+/* Like the message module, this module keeps its state in file-local
+ * globals: there is one server per process, and passing a metrics object
+ * into every function on the hot path would gain nothing.
+ */
+static bool initialized = false;
+static histogram_t* latency[metrics_NumTypes][metrics_NumStages];
+static uint64_t messagesIn[metrics_NumTypes];
+static uint64_t messagesOut[metrics_NumTypes];
+static uint64_t bytesIn[metrics_NumTypes];
+static uint64_t bytesOut[metrics_NumTypes];
+static metrics_type_t current = metrics_Other;   // type of message being handled
+static uint64_t currentStart = 0;                // when handling began
+
+/**************** metrics_init ****************/
+/* See metrics.h for details. */
+bool metrics_init(void)
+{
+    if (initialized) {
+        return true;
+    }
+    for (int t = 0; t < metrics_NumTypes; t++) {
+        for (int s = 0; s < metrics_NumStages; s++) {
+            latency[t][s] = histogram_new();
+            if (latency[t][s] == NULL) {
+                metrics_delete();
+                return false;
+            }
+        }
+        messagesIn[t] = messagesOut[t] = bytesIn[t] = bytesOut[t] = 0;
+    }
+    initialized = true;
+    return true;
+}
+
+/**************** metrics_typeOf ****************/
+/* See metrics.h for details. */
+metrics_type_t metrics_typeOf(const char* message)
+{
+    if (strncmp(message, "KEY ", 4) == 0
+        || (unsigned char)message[0] == wire_Key) {
+        return metrics_Key;
+    } else if (strncmp(message, "KEYS ", 5) == 0) {
+        return metrics_Keys;
+    } else if (strncmp(message, "PLAY ", 5) == 0) {
+        return metrics_Play;
+    } else if (strcmp(message, "SPECTATE") == 0) {
+        return metrics_Spectate;
+    }
+    return metrics_Other;
+}
+
+/**************** metrics_begin ****************/
+/* See metrics.h for details. */
+void metrics_begin(metrics_type_t type, size_t bytes)
+{
+    if (!initialized) {
+        return;
+    }
+    current = type;
+    messagesIn[type]++;
+    bytesIn[type] += bytes;
+    currentStart = histogram_nowNanos();
+}
+
+/**************** metrics_end ****************/
+/* See metrics.h for details. */
+void metrics_end(void)
+{
+    metrics_record(metrics_Handle, currentStart);
+}
+
+/**************** metrics_now ****************/
+/* See metrics.h for details. */
+uint64_t metrics_now(void)
+{
+    return initialized ? histogram_nowNanos() : 0;
+}
+
+/**************** metrics_record ****************/
+/* See metrics.h for details. */
+void metrics_record(metrics_stage_t stage, uint64_t start)
+{
+    if (!initialized) {
+        return;
+    }
+    histogram_record(latency[current][stage], histogram_nowNanos() - start);
+}
+
+/**************** metrics_sent ****************/
+/* See metrics.h for details. */
+void metrics_sent(size_t bytes)
+{
+    if (!initialized) {
+        return;
+    }
+    messagesOut[current]++;
+    bytesOut[current] += bytes;
+}
+
+/**************** metrics_print ****************/
+/* See metrics.h for details. */
+void metrics_print(FILE* fp, const game_t* game)
+{
+    if (fp == NULL || !initialized) {
+        return;
+    }
+
+    if (game != NULL) {
+        fprintf(fp, "nuggets_players %d\n", game->activePlayersCount);
+        fprintf(fp, "nuggets_max_players %d\n", game->maxPlayers);
+        fprintf(fp, "nuggets_spectators %d\n", game->hasSpectator ? 1 : 0);
+        fprintf(fp, "nuggets_gold_remaining %d\n", game->goldRemaining);
+    }
+
+    for (int t = 0; t < metrics_NumTypes; t++) {
+        fprintf(fp, "nuggets_messages_total{type=\"%s\"} %llu\n",
+                typeNames[t], (unsigned long long)messagesIn[t]);
+        fprintf(fp, "nuggets_bytes_in_total{type=\"%s\"} %llu\n",
+                typeNames[t], (unsigned long long)bytesIn[t]);
+        fprintf(fp, "nuggets_messages_out_total{type=\"%s\"} %llu\n",
+                typeNames[t], (unsigned long long)messagesOut[t]);
+        fprintf(fp, "nuggets_bytes_out_total{type=\"%s\"} %llu\n",
+                typeNames[t], (unsigned long long)bytesOut[t]);
+    }
+
+    for (int t = 0; t < metrics_NumTypes; t++) {
+        for (int s = 0; s < metrics_NumStages; s++) {
+            const histogram_t* h = latency[t][s];
+            if (histogram_count(h) == 0) {
+                continue;
+            }
+            const char* labels = "type=\"%s\",stage=\"%s\"";
+            char label[64];
+            snprintf(label, sizeof(label), labels, typeNames[t], stageNames[s]);
+            fprintf(fp, "nuggets_latency_ns_count{%s} %llu\n", label,
+                    (unsigned long long)histogram_count(h));
+            fprintf(fp, "nuggets_latency_ns_sum{%s} %llu\n", label,
+                    (unsigned long long)histogram_sum(h));
+            fprintf(fp, "nuggets_latency_ns{%s,quantile=\"0.5\"} %llu\n", label,
+                    (unsigned long long)histogram_percentile(h, 50));
+            fprintf(fp, "nuggets_latency_ns{%s,quantile=\"0.99\"} %llu\n", label,
+                    (unsigned long long)histogram_percentile(h, 99));
+            fprintf(fp, "nuggets_latency_ns{%s,quantile=\"0.999\"} %llu\n", label,
+                    (unsigned long long)histogram_percentile(h, 99.9));
+            fprintf(fp, "nuggets_latency_ns{%s,quantile=\"1\"} %llu\n", label,
+                    (unsigned long long)histogram_max(h));
+        }
+    }
+}
+
+/**************** metrics_dump ****************/
+/* See metrics.h for details. */
+bool metrics_dump(const char* path, const game_t* game)
+{
+    if (path == NULL || !initialized) {
+        return false;
+    }
+
+    char tmpPath[strlen(path) + 5];
+    sprintf(tmpPath, "%s.tmp", path);
+    FILE* fp = fopen(tmpPath, "w");
+    if (fp == NULL) {
+        return false;
+    }
+    metrics_print(fp, game);
+    if (fclose(fp) != 0 || rename(tmpPath, path) != 0) {
+        remove(tmpPath);
+        return false;
+    }
+    return true;
+}
+
+/**************** metrics_delete ****************/
+/* See metrics.h for details. */
+void metrics_delete(void)
+{
+    for (int t = 0; t < metrics_NumTypes; t++) {
+        for (int s = 0; s < metrics_NumStages; s++) {
+            histogram_delete(latency[t][s]);
+            latency[t][s] = NULL;
+        }
+    }
+    initialized = false;
+}
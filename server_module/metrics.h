@@ -0,0 +1,130 @@
+/*
+ * metrics.h - hot-path instrumentation for the Nuggets server (Team 10)
+ *
+ * Counts every message the server handles and records, per message type,
+ * latency histograms for the stages of handling it: the whole handler,
+ * the game move, visibility computation, encoding the DISPLAY, and
+ * sending.  It also keeps byte counters and reports gauges taken from the
+ * game (players, spectators, gold remaining).
+ *
+ * The server is single-threaded, so counters are plain integers updated
+ * without locks, and time is read from the vDSO-backed monotonic clock
+ * (histogram_nowNanos); recording a sample costs a clock read and a few
+ * additions.  Until metrics_init is called every recording function is a
+ * no-op.
+ *
+ * Reports use a line-oriented "name{labels} value" text format that is
+ * easy to read and to scrape, e.g.:
+ *   nuggets_messages_total{type="KEY"} 1234
+ *   nuggets_latency_ns{type="KEY",stage="visibility",quantile="0.99"} 48211
+ *
+ * Team 10
+ */
+
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "../game_module/game.h"
+
+/**************** global types ****************/
+// Kinds of inbound message
+typedef enum metrics_type {
+    metrics_Play,
+    metrics_Spectate,
+    metrics_Key,
+    metrics_Keys,
+    metrics_Other,
+    metrics_NumTypes
+} metrics_type_t;
+
+// Stages of handling a message
+typedef enum metrics_stage {
+    metrics_Handle,        // the whole handler
+    metrics_Move,          // game_playerMove
+    metrics_Visibility,    // visibility and merge for one player
+    metrics_Encode,        // building one DISPLAY message
+    metrics_Send,          // one message_send
+    metrics_NumStages
+} metrics_stage_t;
+
+/**************** functions ****************/
+
+/**************** metrics_init ****************/
+/* Starts collecting metrics.
+ * Returns:
+ *   - true on success, false if out of memory.
+ */
+bool metrics_init(void);
+
+/**************** metrics_typeOf ****************/
+/* Classifies an inbound message by its first word.
+ *
+ * Caller provides:
+ *   - message: the message text, or a binary frame (wire.h).
+ * Returns:
+ *   - the message type.
+ */
+metrics_type_t metrics_typeOf(const char* message);
+
+/**************** metrics_begin ****************/
+/* Marks the start of handling one message; later stage samples are
+ * attributed to this message's type until metrics_end.
+ *
+ * Caller provides:
+ *   - type: the message type.
+ *   - bytes: the size of the message.
+ */
+void metrics_begin(metrics_type_t type, size_t bytes);
+
+/**************** metrics_end ****************/
+/* Marks the end of handling the current message and records its latency. */
+void metrics_end(void);
+
+/**************** metrics_now ****************/
+/* Returns the current time in nanoseconds, for timing a stage. */
+uint64_t metrics_now(void);
+
+/**************** metrics_record ****************/
+/* Records one stage sample for the current message type.
+ *
+ * Caller provides:
+ *   - stage: the stage that was timed.
+ *   - start: the metrics_now() value taken when the stage started.
+ */
+void metrics_record(metrics_stage_t stage, uint64_t start);
+
+/**************** metrics_sent ****************/
+/* Counts one outbound message of the given size. */
+void metrics_sent(size_t bytes);
+
+/**************** metrics_print ****************/
+/* Prints every counter, gauge and latency summary.
+ *
+ * Caller provides:
+ *   - fp: where to print.
+ *   - game: the game, for the gauges (may be NULL).
+ */
+void metrics_print(FILE* fp, const game_t* game);
+
+/**************** metrics_dump ****************/
+/* Replaces the contents of a file with a fresh metrics report.  The report
+ * is written to a temporary file and renamed, so a scraper never sees a
+ * partial report.
+ *
+ * Caller provides:
+ *   - path: the file to write.
+ *   - game: the game, for the gauges (may be NULL).
+ * Returns:
+ *   - true on success.
+ */
+bool metrics_dump(const char* path, const game_t* game);
+
+/**************** metrics_delete ****************/
+/* Stops collecting metrics and frees their memory. */
+void metrics_delete(void);
+
+#endif // __METRICS_H
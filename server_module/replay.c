@@ -0,0 +1,225 @@
+/*
+ * replay.c - Nuggets replay recorder (Team 10)
+ *
+ * see replay.h for more information.
+ *
+ * Team 10
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "replay.h"
+#include "../libcs50/mem.h"
+
+#define REPLAY_BUFFER_SIZE 65536   // bytes buffered before a forced flush
+#define REPLAY_VERSION 3    // 2: 16-bit player slots, and the cap on players
+                            // 3: KEYS batches as one record
+
+static const char replayMagic[4] = {'N', 'G', 'R', 'P'};
+
+/**************** global types ****************/
+struct replay {
+    FILE* fp;                           // replay file
+    uint64_t lastMicros;                // time of the previous record
+    size_t used;                        // bytes of buffer in use
+    unsigned char buffer[REPLAY_BUFFER_SIZE];
+};
+
+/**************** local functions ****************/
+static uint64_t nowMicros(void);
+static void put16(unsigned char* p, uint32_t value);
+static void put32(unsigned char* p, uint32_t value);
+static uint32_t get16(const unsigned char* p);
+static uint32_t get32(const unsigned char* p);
+
+/**************** replay_mapHash ****************/
+/* See replay.h for details. */
+uint32_t replay_mapHash(const char* map)
+{
+    uint32_t hash = 2166136261u;
+    for (const char* p = map; p != NULL && *p != '\0'; p++) {
+        hash ^= (unsigned char)*p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**************** replay_open ****************/
+/* See replay.h for details. */
+replay_t* replay_open(const char* path, const game_t* game)
+{
+    if (path == NULL || game == NULL) {
+        return NULL;
+    }
+
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: cannot create replay file %s\n", path);
+        return NULL;
+    }
+
+    replay_t* rec = mem_malloc(sizeof(replay_t));
+    if (rec == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+    rec->fp = fp;
+    rec->lastMicros = nowMicros();
+    rec->used = 0;
+
+    // The header goes through the buffer like any other record.
+    unsigned char* p = rec->buffer;
+    memcpy(p, replayMagic, sizeof(replayMagic));
+    p[4] = REPLAY_VERSION;
+    put32(p + 5, (uint32_t)game->seed);
+    put32(p + 9, replay_mapHash(game->mapWithNoPlayers));
+    put16(p + 13, (uint32_t)game->mapHeight);
+    put16(p + 15, (uint32_t)game->mapWidth);
+    put16(p + 17, (uint32_t)game->maxPlayers);
+    rec->used = 19;
+
+    replay_flush(rec);
+    return rec;
+}
+
+/**************** replay_record ****************/
+/* See replay.h for details. */
+void replay_record(replay_t* rec, char type, int player, const char* payload)
+{
+    if (rec == NULL) {
+        return;
+    }
+
+    size_t length = (payload == NULL) ? 0 : strlen(payload);
+    if (length > replay_MaxPayload) {
+        length = replay_MaxPayload;
+    }
+    if (rec->used + 8 + length > REPLAY_BUFFER_SIZE) {
+        replay_flush(rec);
+    }
+
+    uint64_t now = nowMicros();
+    uint64_t delta = now - rec->lastMicros;
+    rec->lastMicros = now;
+    if (delta > UINT32_MAX) {
+        delta = UINT32_MAX;
+    }
+
+    unsigned char* p = rec->buffer + rec->used;
+    p[0] = (unsigned char)type;
+    put16(p + 1, (uint32_t)player & 0xffff);
+    put32(p + 3, (uint32_t)delta);
+    p[7] = (unsigned char)length;
+    memcpy(p + 8, payload, length);
+    rec->used += 8 + length;
+}
+
+/**************** replay_flush ****************/
+/* See replay.h for details. */
+void replay_flush(replay_t* rec)
+{
+    if (rec == NULL || rec->used == 0) {
+        return;
+    }
+    if (fwrite(rec->buffer, 1, rec->used, rec->fp) != rec->used) {
+        fprintf(stderr, "Error: failed to write replay file\n");
+    }
+    fflush(rec->fp);
+    rec->used = 0;
+}
+
+/**************** replay_close ****************/
+/* See replay.h for details. */
+void replay_close(replay_t* rec)
+{
+    if (rec == NULL) {
+        return;
+    }
+    replay_flush(rec);
+    fclose(rec->fp);
+    mem_free(rec);
+}
+
+/**************** replay_readHeader ****************/
+/* See replay.h for details. */
+bool replay_readHeader(FILE* fp, int* seed, uint32_t* mapHash,
+                       int* mapHeight, int* mapWidth, int* maxPlayers)
+{
+    unsigned char header[19];
+    if (fp == NULL || fread(header, 1, sizeof(header), fp) != sizeof(header)) {
+        return false;
+    }
+    if (memcmp(header, replayMagic, sizeof(replayMagic)) != 0
+        || header[4] != REPLAY_VERSION) {
+        return false;
+    }
+
+    *seed = (int)get32(header + 5);
+    *mapHash = get32(header + 9);
+    *mapHeight = (int)get16(header + 13);
+    *mapWidth = (int)get16(header + 15);
+    *maxPlayers = (int)get16(header + 17);
+    return true;
+}
+
+/**************** replay_readEvent ****************/
+/* See replay.h for details. */
+bool replay_readEvent(FILE* fp, replay_event_t* event)
+{
+    unsigned char head[8];
+    if (fp == NULL || event == NULL || fread(head, 1, sizeof(head), fp) != sizeof(head)) {
+        return false;
+    }
+
+    event->type = (char)head[0];
+    uint32_t player = get16(head + 1);
+    event->player = (player == 0xffff) ? replay_Spectator : (int)player;
+    event->deltaMicros = get32(head + 3);
+
+    size_t length = head[7];
+    if (fread(event->payload, 1, length, fp) != length) {
+        return false;
+    }
+    event->payload[length] = '\0';
+    return true;
+}
+
+/************* HELPER FUNCTIONS *****************/
+
+/**************** nowMicros ****************/
+static uint64_t nowMicros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**************** put16, put32, get16, get32 ****************/
+/* Little-endian encoding so replay files are portable between hosts. */
+static void put16(unsigned char* p, uint32_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+}
+
+static void put32(unsigned char* p, uint32_t value)
+{
+    put16(p, value & 0xffff);
+    put16(p + 2, value >> 16);
+}
+
+static uint32_t get16(const unsigned char* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char* p)
+{
+    return get16(p) | (get16(p + 2) << 16);
+}
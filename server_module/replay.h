@@ -0,0 +1,134 @@
+/*
+ * replay.h - header file for the Nuggets replay recorder (Team 10)
+ *
+ * A *replay* is an append-only binary log of everything the server
+ * accepted during one game: the random seed, a hash of the map, and every
+ * PLAY, SPECTATE, KEY and KEYS event together with a timestamp and the slot of
+ * the player who sent it.  Because the game module is deterministic for a
+ * given seed and sequence of events, feeding the log back through the game
+ * module (see replayer.c) reconstructs the exact game state.
+ *
+ * File layout (all integers little-endian):
+ *   header:  "NGRP" version(1) seed(4) mapHash(4) mapHeight(2) mapWidth(2)
+ *            maxPlayers(2)
+ *   records: type(1) player(2) deltaMicros(4) length(1) payload(length)
+ * where type is one of the replay_Play, replay_Spectate, replay_Key,
+ * replay_Keys codes, player is the sender's slot in game->slots (0xffff for
+ * the spectator), deltaMicros is the time since the previous record, and the
+ * payload is the player name (PLAY), the key pressed (KEY), or the keys of a
+ * batch that the server applied before one update (KEYS).  Slots, unlike letters, stay
+ * distinct however many players join.
+ *
+ * Records are collected in an in-memory buffer and only written to disk by
+ * replay_flush (called by the server when it is idle) or when the buffer
+ * fills, so recording costs a memcpy on the message-handling path.
+ *
+ * Team 10
+ */
+
+#ifndef __REPLAY_H
+#define __REPLAY_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "../game_module/game.h"
+
+/**************** constants ****************/
+static const char replay_Play = 'P';
+static const char replay_Spectate = 'S';
+static const char replay_Key = 'K';
+static const char replay_Keys = 'B';     // a KEYS batch, refreshed once
+static const int replay_Spectator = -1;  // "slot" of the spectator
+static const int replay_MaxPayload = 255;
+
+/**************** global types ****************/
+typedef struct replay replay_t;  // opaque to users of the module
+
+// One event read back from a replay file.
+typedef struct replay_event {
+    char type;               // replay_Play, replay_Spectate, replay_Key or replay_Keys
+    int player;              // player slot, or replay_Spectator
+    uint32_t deltaMicros;    // microseconds since the previous event
+    char payload[256];       // NUL-terminated payload (name or keys)
+} replay_event_t;
+
+/**************** functions ****************/
+
+/**************** replay_mapHash ****************/
+/* Computes the 32-bit FNV-1a hash of a map string.
+ *
+ * Caller provides:
+ *   - map: the encoded map (without players or gold).
+ * Returns:
+ *   - the hash, which is stored in the replay header to detect a mismatched map.
+ */
+uint32_t replay_mapHash(const char* map);
+
+/**************** replay_open ****************/
+/* Creates a new replay file and writes its header.
+ *
+ * Caller provides:
+ *   - path: the file to create (truncated if it exists).
+ *   - game: the freshly initialized game, before any player joins.
+ * Returns:
+ *   - a recorder to pass to the other functions, or NULL on error.
+ *   Caller is responsible for calling replay_close.
+ */
+replay_t* replay_open(const char* path, const game_t* game);
+
+/**************** replay_record ****************/
+/* Appends one event to the recorder's buffer.
+ *
+ * Caller provides:
+ *   - rec: a recorder from replay_open (NULL is ignored).
+ *   - type: replay_Play, replay_Spectate, replay_Key or replay_Keys.
+ *   - player: the player's slot, or replay_Spectator.
+ *   - payload: the player name, key or keys; may be NULL.
+ * Notes:
+ *   Payloads longer than replay_MaxPayload bytes are truncated.
+ *   Nothing is written to disk unless the buffer is full.
+ */
+void replay_record(replay_t* rec, char type, int player, const char* payload);
+
+/**************** replay_flush ****************/
+/* Writes any buffered events to disk.
+ *
+ * Caller provides:
+ *   - rec: a recorder from replay_open (NULL is ignored).
+ */
+void replay_flush(replay_t* rec);
+
+/**************** replay_close ****************/
+/* Flushes any buffered events, closes the file and frees the recorder.
+ *
+ * Caller provides:
+ *   - rec: a recorder from replay_open (NULL is ignored).
+ */
+void replay_close(replay_t* rec);
+
+/**************** replay_readHeader ****************/
+/* Reads and validates the header of a replay file.
+ *
+ * Caller provides:
+ *   - fp: a replay file open for reading, positioned at its start.
+ *   - seed, mapHash, mapHeight, mapWidth, maxPlayers: where to store the
+ *     header fields.
+ * Returns:
+ *   - true if the header is valid, false otherwise.
+ */
+bool replay_readHeader(FILE* fp, int* seed, uint32_t* mapHash,
+                       int* mapHeight, int* mapWidth, int* maxPlayers);
+
+/**************** replay_readEvent ****************/
+/* Reads the next event from a replay file.
+ *
+ * Caller provides:
+ *   - fp: a replay file whose header has already been read.
+ *   - event: where to store the event.
+ * Returns:
+ *   - true if an event was read, false at end of file or on a truncated record.
+ */
+bool replay_readEvent(FILE* fp, replay_event_t* event);
+
+#endif // __REPLAY_H
@@ -0,0 +1,205 @@
+/*
+ * replayer.c - replays a Nuggets game recorded with `server -r` (Team 10)
+ *
+ * Usage:
+ *   ./replayer map.txt game.replay [-v]
+ *
+ * Re-initializes the game from the map and the recorded seed, then feeds
+ * every recorded PLAY, SPECTATE, KEY and KEYS event through the game
+ * module in the order the server accepted them.  Because the game module is
+ * deterministic for a given seed and sequence of events, the resulting
+ * state is exactly the state the server had.  With -v, the master map is
+ * printed after every event; otherwise only the final state is printed.
+ *
+ * Team 10
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include "../game_module/game.h"
+#include "../libcs50/hashtable.h"
+#include "../libcs50/mem.h"
+#include "replay.h"
+
+/**************** local functions ****************/
+static addr_t slotAddress(int slot);
+static void refreshAllPlayers(game_t* game);
+static bool applyEvent(game_t* game, const replay_event_t* event);
+
+/***************** main *******************************/
+int main(int argc, char* argv[])
+{
+    bool verbose = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        if (opt == 'v') {
+            verbose = true;
+        } else {
+            fprintf(stderr, "Usage: %s map.txt game.replay [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        fprintf(stderr, "Usage: %s map.txt game.replay [-v]\n", argv[0]);
+        return 1;
+    }
+
+    const char* mapFilename = argv[optind];
+    const char* replayFilename = argv[optind + 1];
+
+    FILE* replayFile = fopen(replayFilename, "rb");
+    if (replayFile == NULL) {
+        fprintf(stderr, "Failed to open %s\n", replayFilename);
+        return 1;
+    }
+
+    int seed, mapHeight, mapWidth, maxPlayers;
+    uint32_t mapHash;
+    if (!replay_readHeader(replayFile, &seed, &mapHash, &mapHeight, &mapWidth, &maxPlayers)) {
+        fprintf(stderr, "%s is not a replay file\n", replayFilename);
+        fclose(replayFile);
+        return 1;
+    }
+
+    FILE* mapFile = fopen(mapFilename, "r");
+    if (mapFile == NULL) {
+        fprintf(stderr, "Failed to open %s\n", mapFilename);
+        fclose(replayFile);
+        return 1;
+    }
+
+    // game_init closes the map file
+    game_t* game = game_init(mapFile, seed, maxPlayers);
+    if (game == NULL || game->map == NULL) {
+        fprintf(stderr, "Error: Failed to initialize game\n");
+        fclose(replayFile);
+        return 1;
+    }
+    if (replay_mapHash(game->mapWithNoPlayers) != mapHash
+        || game->mapHeight != mapHeight || game->mapWidth != mapWidth) {
+        fprintf(stderr, "Error: %s is not the map this game was recorded on\n", mapFilename);
+        game_delete(game);
+        fclose(replayFile);
+        return 1;
+    }
+
+    // Feed every event back through the game module
+    replay_event_t event;
+    int eventCount = 0;
+    double elapsed = 0;
+    while (replay_readEvent(replayFile, &event)) {
+        eventCount++;
+        elapsed += event.deltaMicros / 1e6;
+        bool changed = applyEvent(game, &event);
+
+        if (verbose) {
+            printf("\n[%.6f] event %d: %c %d '%s'%s\n", elapsed, eventCount,
+                   event.type, event.player, event.payload, changed ? "" : " (no effect)");
+            game_print(game);
+        }
+        if (game->goldRemaining == 0) {
+            break;
+        }
+    }
+    fclose(replayFile);
+
+    printf("\nReplayed %d events covering %.3f seconds\n", eventCount, elapsed);
+    game_print(game);
+    char* finalScores = game_getFinalScores(game, 0);
+    if (finalScores != NULL) {
+        printf("%s", finalScores);
+        mem_free(finalScores);
+    }
+
+    game_delete(game);
+    return 0;
+}
+
+/**************** slotAddress ****************/
+/* The replay stores slots, not network addresses; the game module only
+ * needs each player to have a distinct address, so make one up per slot.
+ */
+static addr_t slotAddress(int slot)
+{
+    addr_t address = message_noAddr();
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(10000 + slot);
+    return address;
+}
+
+/**************** refreshAllPlayers ****************/
+/* Mirrors the visibility half of the server's updateAllPlayers. */
+static void refreshAllPlayers(game_t* game)
+{
+    for (int i = 0; i < game->activePlayersCount; i++) {
+        player_t* player = game->slots[i];
+        if (player->changed) {
+            player->changed = false;
+            game_refreshPlayer(game, player);
+        }
+    }
+}
+
+/**************** applyEvent ****************/
+/* Applies one recorded event exactly as server.c's handleMessage did.
+ * Returns true if the event changed the game state.
+ */
+static bool applyEvent(game_t* game, const replay_event_t* event)
+{
+    if (event->type == replay_Spectate) {
+        game->hasSpectator = true;
+        return true;
+    }
+
+    if (event->type == replay_Play) {
+        player_t* player = game_playerInit(game, slotAddress(event->player), (char*)event->payload);
+        if (player == NULL || player->slot != event->player) {
+            fprintf(stderr, "Warning: replayed player '%s' did not get slot %d\n",
+                    event->payload, event->player);
+        }
+        refreshAllPlayers(game);
+        return player != NULL;
+    }
+
+    if (event->type == replay_Key) {
+        char key = event->payload[0];
+        if (event->player == replay_Spectator) {
+            if (key == 'Q' || key == 'q') {
+                game->hasSpectator = false;
+                return true;
+            }
+            return false;
+        }
+        if (key == 'Q' || key == 'q') {
+            game_playerQuit(game, slotAddress(event->player));
+            refreshAllPlayers(game);
+            return true;
+        }
+        if (game_playerMove(slotAddress(event->player), game, key)) {
+            refreshAllPlayers(game);
+            return true;
+        }
+        return false;
+    }
+
+    if (event->type == replay_Keys) {
+        // the server moves through the whole batch, then updates once
+        bool moved = false;
+        for (const char* key = event->payload; *key != '\0' && game->goldRemaining > 0; key++) {
+            if (game_playerMove(slotAddress(event->player), game, *key)) {
+                moved = true;
+            }
+        }
+        if (moved) {
+            refreshAllPlayers(game);
+        }
+        return moved;
+    }
+
+    fprintf(stderr, "Warning: skipping unknown replay event type '%c'\n", event->type);
+    return false;
+}
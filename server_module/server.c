@@ -10,31 +10,94 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include "../game_module/game.h"
 #include "server.h"
 #include "../support/message.h"
+#include "../support/wire.h"
 #include "../libcs50/mem.h"
 #include <ctype.h>
 #include "../map_module/map.h"
+#include "replay.h"
+#include "metrics.h"
 #include <getopt.h>
 
 #define MAX_NAME_LENGTH 50 // max number of chars in playerName
-// Function prototypes
-bool handleInput(void* arg);
-bool handleMessage(void* arg, const addr_t from, const char* buf);
-void updateAllPlayers(game_t* game);
-
+#define IDLE_SECONDS 1     // idle time after which buffered work is flushed
+#define METRICS_SECONDS 5  // interval between metrics dumps
+#define MAX_BATCH_KEYS 255 // most keys one KEYS message may expand to (one replay record)
+#define FLUSH_SECONDS 2    // how long to wait at exit for QUITs to be acknowledged
+
+// How each message goes to a client that accepted "reliable": OK, GRID and
+// QUIT must arrive; of DISPLAY and GOLD only the newest matters
+#define RELIABLE -1
+#define DISPLAY_CHANNEL 0
+#define GOLD_CHANNEL 1
+
+// The part of the map sent to a client whose screen is too small for all
+// of it ("view"): rows x cols cells from (top, left)
+typedef struct window {
+    int top;
+    int left;
+    int rows;
+    int cols;
+} window_t;
+
+// Replay recorder; NULL unless the server was started with -r
+static replay_t* recorder = NULL;
+
+// Metrics dump file; NULL unless the server was started with -m
+static const char* metricsPath = NULL;
+static uint64_t lastMetricsDump = 0;
+
+// Protocol options (wire.h) the server accepts, those offered by clients
+// that have not yet joined, keyed by address, and the spectator's
+static const int acceptedCaps = wire_CapBinary | wire_CapRle | wire_CapReliable
+                              | wire_CapView | wire_CapState | wire_CapSeq;
+static hashtable_t* pendingCaps = NULL;
+static int spectatorCaps = 0;
+
+// The map area of the spectator's screen ("SIZE"), or 0 for the whole map
+static int spectatorViewRows = 0;
+static int spectatorViewCols = 0;
+
+static bool processMessage(game_t* game, const addr_t from, const char* buf);
+static bool handleKey(game_t* game, const addr_t from, const char key,
+                      const bool sequenced, const unsigned int keySeq);
+static bool handleBinary(game_t* game, const addr_t from, const char* buf);
+static int takeCaps(const addr_t from);
+static int capsOf(game_t* game, const addr_t addr);
+static void sendMessage(const addr_t to, const char* message);
+static void sendText(const addr_t to, int caps, int channel, const char* message);
+static void sendBytes(const addr_t to, int caps, int channel, const void* bytes, size_t length);
+static void sendOk(const addr_t to, int caps, char letter);
+static void sendGrid(game_t* game, const addr_t to, int caps);
+static void sendGold(const addr_t to, int caps, int n, int p, int r);
+static void sendDisplay(game_t* game, const addr_t to, int caps, char* map,
+                        int stride, const int* gold,
+                        const window_t* window, bool sequenced, unsigned int seq);
+static void sendPlayerDisplay(game_t* game, player_t* player, bool withGold);
+static void sendSpectatorDisplay(game_t* game, bool withGold);
+static bool windowAround(game_t* game, int rows, int cols, int row, int col,
+                         window_t* window);
+static void sendGameOver(game_t* game);
+static int expandKeys(const char* text, char* keys, int maxKeys, const char** end);
+static void dumpMetrics(game_t* game, bool force);
+
+// serverbench.c supplies its own main and drives the handlers directly
+#ifndef SERVER_BENCH
 int main(int argc, char* argv[])
 {
 
-  int seed;
+  int seed, maxPlayers;
+  const char* replayPath = NULL;
   
   // Parse args and open map file
-  FILE* mapFile = parseArgs(argc, argv, &seed);
+  FILE* mapFile = parseArgs(argc, argv, &seed, &maxPlayers, &replayPath, &metricsPath);
 
   // initialize the game
-  game_t* game = game_init(mapFile, seed);
+  game_t* game = game_init(mapFile, seed, maxPlayers);
   if (game == NULL) {
     fprintf(stderr, "Error: Failed to initialize game\n");
     return 1;
@@ -48,31 +111,85 @@ int main(int argc, char* argv[])
       return 1;
   }
 
+  // Reliable-delivery state is kept for every player, and the spectator;
+  // anyone else gets theirs (a QUIT) released as soon as it is delivered
+  message_setMaxPeers(game->maxPlayers + 1);
+
   //game_test(game);
 
-  bool success = message_loop(game, 0, NULL, handleInput, handleMessage);
+  if (!metrics_init()) {
+    fprintf(stderr, "Error: Failed to initialize metrics\n");
+    game_delete(game);
+    message_done();
+    return 1;
+  }
+
+  // Start recording before anyone can join
+  if (replayPath != NULL) {
+    recorder = replay_open(replayPath, game);
+    if (recorder == NULL) {
+      game_delete(game);
+      message_done();
+      return 1;
+    }
+  }
+
+  bool success = message_loop(game, IDLE_SECONDS, handleTimeout, handleInput, handleMessage);
 
   if (!success) {
     fprintf(stderr, "Error in message loop\n");
   }
 
-  // Clean up after the loop ends
+  // Clean up after the loop ends, once the last QUITs have arrived
+  message_flush(FLUSH_SECONDS);
+  dumpMetrics(game, true);
+  metrics_delete();
+  replay_close(recorder);
+  if (pendingCaps != NULL) {
+    hashtable_delete(pendingCaps, mem_free);
+  }
   game_delete(game);
   fclose(stdout);
   message_done();
   return 0;
   
 }
+#endif // SERVER_BENCH
 
 
 // Function to parse command-line arguments, validate them, and open the map file
-FILE* parseArgs(int argc, char* argv[], int* seed) {
+FILE* parseArgs(int argc, char* argv[], int* seed, int* maxPlayers,
+                const char** replayPath, const char** metricsPath) {
 
     *seed = 0;  // Default seed (will use getpid() if not specified)
+    *maxPlayers = MaxPlayers;
+
+    // Parse options
+    int opt;
+    while ((opt = getopt(argc, argv, "p:r:m:")) != -1) {
+        switch (opt) {
+            case 'p':
+                *maxPlayers = atoi(optarg);
+                if (*maxPlayers < 1 || *maxPlayers > MaxPlayersLimit) {
+                    fprintf(stderr, "Players must be between 1 and %d.\n", MaxPlayersLimit);
+                    exit(1);
+                }
+                break;
+            case 'r':
+                *replayPath = optarg;
+                break;
+            case 'm':
+                *metricsPath = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s map.txt [seed] [-p maxPlayers] [-r replayFile] [-m metricsFile]\n", argv[0]);
+                exit(1);
+        }
+    }
 
     // Validate positional arguments
     if (optind >= argc) {
-        fprintf(stderr, "Usage: %s map.txt [seed] [options]\n", argv[0]);
+        fprintf(stderr, "Usage: %s map.txt [seed] [-p maxPlayers] [-r replayFile] [-m metricsFile]\n", argv[0]);
         exit(1);
     }
 
@@ -111,21 +228,66 @@ bool handleInput(void* arg)
             return true;  // Return true to exit the message loop
         } else if (strcmp(input, "status\n") == 0) {
             printf("Server status: running...\n");
-            // Optionally provide more detailed game status info here
+            metrics_print(stdout, (game_t*) arg);
+            fflush(stdout);
         }
     }
     return false;  // Return false to keep the loop running
 }
 
+bool handleTimeout(void* arg)
+{
+    // Nothing is happening, so do the deferred disk writes now
+    replay_flush(recorder);
+    dumpMetrics((game_t*) arg, false);
+    return false;  // Keep the loop running
+}
+
 bool handleMessage(void* arg, const addr_t from, const char* buf) 
 {
     game_t* game = (game_t*) arg;
 
+    metrics_begin(metrics_typeOf(buf), message_length());
+    bool gameOver = processMessage(game, from, buf);
+    metrics_end();
+
+    dumpMetrics(game, false);
+    return gameOver;
+}
+
+// Handle one message; returns true when the game is over
+static bool processMessage(game_t* game, const addr_t from, const char* buf)
+{
+    if (wire_isBinary(buf)) {
+        printf("Received message from %s: binary frame of %zu bytes\n",
+               message_stringAddr(from), message_length());
+        return handleBinary(game, from, buf);
+    }
     printf("Received message from %s: %s\n", message_stringAddr(from), buf);
 
-    if (strncmp(buf, "PLAY ", 5) == 0) {
-        // Handle player joining
-        if (game->activePlayersCount < 26) {
+    if (strncmp(buf, "CAPS", 4) == 0 && (buf[4] == ' ' || buf[4] == '\0')) {
+        // Remember the options this client can use, until it joins
+        if (pendingCaps == NULL) {
+            pendingCaps = hashtable_new(game->maxPlayers + 1);
+        }
+        int caps = wire_parseCaps(buf + 4) & acceptedCaps;
+        if (!(caps & wire_CapBinary)) {
+            caps &= ~wire_CapRle;   // only binary DISPLAY frames are compressed
+        }
+        int* saved = hashtable_find(pendingCaps, message_stringAddr(from));
+        if (saved == NULL) {
+            saved = mem_malloc(sizeof(int));
+            hashtable_insert(pendingCaps, message_stringAddr(from), saved);
+        }
+        *saved = caps;
+
+        char reply[64];
+        sendMessage(from, wire_formatCaps(caps, reply, sizeof(reply)));
+    }
+    else if (strncmp(buf, "PLAY ", 5) == 0) {
+        // Handle player joining; any earlier client at this address is gone
+        message_forget(from);
+        if (game->activePlayersCount < game->maxPlayers) {
             const char* playerName = buf + 5;
             if (strlen(playerName) > 0) {
                 char acceptedName[MAX_NAME_LENGTH + 1];
@@ -143,128 +305,125 @@ bool handleMessage(void* arg, const addr_t from, const char* buf)
                 if (player == NULL) {
                     printf("Player not initialized properly\n");
                     fflush(stdout);
+                    sendText(from, capsOf(game, from), RELIABLE, "QUIT Sorry - cannot add another player.");
+                    message_release(from);
+                    return false;
                 }
+                player->caps = takeCaps(from);
+                replay_record(recorder, replay_Play, player->slot, acceptedName);
 
-                // Send acknowledgment and initial game data
-                char response[5];
-                sprintf(response, "OK %c", player->playerLetter);
-                message_send(from, response);
-
-                char result[50];
-                sprintf(result, "GRID %d %d", game->mapHeight, game->mapWidth);
-                message_send(from, result);
-
-                char gold[12];
-                sprintf(gold, "GOLD %d %d %d", 0, 0, game->goldRemaining);
-                message_send(from, gold);
-
-                char first_part[] = "DISPLAY\n";
-                char* map = map_decode(player->playerMap, game);
-                char message[message_MaxBytes];
-                snprintf(message, sizeof(message), "%s%s", first_part, map);
-                message_send(from, message);
-                mem_free(map);
+                // Send acknowledgment and the grid; the new player's
+                // first DISPLAY goes out with the update below
+                sendOk(from, player->caps, player->playerLetter);
+                sendGrid(game, from, player->caps);
 
-                // Update all players and the spectator
+                // Update the players who can see the newcomer, and the spectator
                 updateAllPlayers(game);
             } else {
-                message_send(from, "QUIT Sorry - you must provide a player's name.");
+                sendText(from, capsOf(game, from), RELIABLE, "QUIT Sorry - you must provide a player's name.");
+                message_release(from);
             }
         } else {
-            message_send(from, "QUIT Game is full: no more players can join.");
+            sendText(from, capsOf(game, from), RELIABLE, "QUIT Game is full: no more players can join.");
+            message_release(from);
         }
     } 
     else if (strcmp(buf, "SPECTATE") == 0) {
         // Handle spectator joining or replacing an existing spectator
         if (game->hasSpectator) {
-            message_send(game->spectatorAddress, "QUIT You have been replaced by a new spectator");
+            sendText(game->spectatorAddress, spectatorCaps, RELIABLE, "QUIT You have been replaced by a new spectator");
+            message_release(game->spectatorAddress);
         } else {
             game->hasSpectator = true;
         }
         game->spectatorAddress = from;
+        message_forget(from);
+        spectatorCaps = takeCaps(from);
+        spectatorViewRows = spectatorViewCols = 0;
+        replay_record(recorder, replay_Spectate, replay_Spectator, NULL);
 
         printf("Spectator joining.\n");
 
-        // Send initial grid dimensions
-        char result[50];
-        snprintf(result, sizeof(result), "GRID %d %d", game->mapHeight, game->mapWidth);
-        message_send(from, result);
-
-        // Send initial gold information
-        char gold[12];
-        snprintf(gold, sizeof(gold), "GOLD %d %d %d", 0, 0, game->goldRemaining);
-        message_send(from, gold);
-
-        // Send the current game state
-        char first_part[] = "DISPLAY\n";
-        char* map = map_decode(game->map, game);
-        char message[message_MaxBytes];
-        snprintf(message, sizeof(message), "%s%s", first_part, map);
-        message_send(from, message);
-        mem_free(map);
+        // Send initial grid dimensions, then gold information and the
+        // current game state
+        sendGrid(game, from, spectatorCaps);
+        sendSpectatorDisplay(game, true);
     } 
+    else if (strncmp(buf, "SIZE ", 5) == 0) {
+        // "SIZE rows cols": the map area of the screen of a client that
+        // accepted "view"; from now on it is sent only that much
+        player_t* player = hashtable_find(game->players, message_stringAddr(from));
+        bool isSpectator = game->hasSpectator && message_eqAddr(from, game->spectatorAddress);
+        int rows, cols;
+        if ((player == NULL && !isSpectator) || !(capsOf(game, from) & wire_CapView)
+            || sscanf(buf + 5, "%d %d", &rows, &cols) != 2 || rows < 1 || cols < 1) {
+            sendMessage(from, "ERROR Not a valid input");
+            return false;
+        }
+        if (isSpectator) {
+            spectatorViewRows = rows;
+            spectatorViewCols = cols;
+            sendSpectatorDisplay(game, false);
+        } else {
+            player->viewRows = rows;
+            player->viewCols = cols;
+            sendPlayerDisplay(game, player, false);
+        }
+    }
     else if (strncmp(buf, "KEY ", 4) == 0) {
-        // Handle player movement or quitting
-        char key = buf[4];
-        printf("Key received from player: %c\n", key);
-
-        if (key == 'Q' || key == 'q') {
-            // Handle player quitting
-            if (message_eqAddr(from, game->spectatorAddress)) {
-                message_send(from, "QUIT Thanks for watching");
-                game->hasSpectator = false;
-            } else {
-                message_send(from, "QUIT Thanks for playing");
-                player_t* quittingPlayer = hashtable_find(game->players, message_stringAddr(from));
-                if (quittingPlayer != NULL) {
-                    int indexToLeave = quittingPlayer->yPosition * game->mapWidth + quittingPlayer->xPosition;
-                    char originalTile = game->mapWithNoPlayers[indexToLeave];
-                    game->map[indexToLeave] = originalTile;
-                }
+        // "KEY k seq": the client numbers its keys and wants each DISPLAY
+        // to say which key it reflects, to reconcile its predicted moves
+        unsigned int keySeq = 0;
+        bool sequenced = (buf[4] != '\0' && sscanf(buf + 5, " %u", &keySeq) == 1);
+        return handleKey(game, from, buf[4], sequenced, keySeq);
+    }
+    else if (strncmp(buf, "KEYS ", 5) == 0) {
+        // "KEYS keys [seq]": a batch of movement keys, applied in order with
+        // a single update afterwards; a key may carry a repeat count, so
+        // "KEYS 3h2jk" is the same as "KEYS hhhjjk"
+        player_t* mover = hashtable_find(game->players, message_stringAddr(from));
+        char keys[MAX_BATCH_KEYS];
+        const char* rest;
+        int count = expandKeys(buf + 5, keys, MAX_BATCH_KEYS, &rest);
+        unsigned int keySeq;
+        bool sequenced = (sscanf(rest, " %u", &keySeq) == 1);
+        if (mover == NULL || count <= 0 || (!sequenced && *rest != '\0')) {
+            sendMessage(from, "ERROR Not a valid input");
+            return false;
+        }
+        printf("Keys received from player: %.*s\n", count, keys);
+
+        if (sequenced) {
+            mover->keysSequenced = true;
+            mover->lastKeySeq = keySeq;
+        }
+
+        bool moved = false;
+        int applied = 0;
+        for (; applied < count && game->goldRemaining > 0; applied++) {
+            uint64_t moveStart = metrics_now();
+            if (game_playerMove(from, game, keys[applied])) {
+                moved = true;
             }
+            metrics_record(metrics_Move, moveStart);
+        }
+        // one record for the batch, so the replayer refreshes once too
+        char keyString[MAX_BATCH_KEYS + 1];
+        snprintf(keyString, sizeof(keyString), "%.*s", applied, keys);
+        replay_record(recorder, replay_Keys, mover->slot, keyString);
 
-            // Update all players and the spectator
+        if (moved) {
             updateAllPlayers(game);
-        } else {
-            // Process valid movement keys
-            char valid_chars[] = "QhljkyubnHLJKYUBN";
-            if (strchr(valid_chars, key)) {
-                if (game_playerMove(from, game, key)) {
-                    // Movement succeeded, update all players and the spectator
-                    updateAllPlayers(game);
-
-                    // Check if game is over
-                    if (game->goldRemaining == 0) {
-                        char end_part[] = "QUIT GAME OVER:\n";
-                        char* finalScores = game_getFinalScores(game);
-
-                        // Notify all players
-                        for (int i = 0; i < MaxPlayers; i++) {
-                            if (message_isAddr(game->activePlayers[i])) {
-                                char end_message[message_MaxBytes];
-                                snprintf(end_message, sizeof(end_message), "%s%s", end_part, finalScores);
-                                message_send(game->activePlayers[i], end_message);
-                            }
-                        }
-
-                        // Notify spectator if present
-                        if (game->hasSpectator) {
-                            char end_message[message_MaxBytes];
-                            snprintf(end_message, sizeof(end_message), "%s%s", end_part, finalScores);
-                            message_send(game->spectatorAddress, end_message);
-                        }
-
-                        mem_free(finalScores);
-                        return true; // Exit the game loop
-                    }
-                }
-            } else {
-                message_send(from, "ERROR Not a valid input");
+            if (game->goldRemaining == 0) {
+                sendGameOver(game);
+                return true; // Exit the game loop
             }
+        } else if (sequenced) {
+            sendPlayerDisplay(game, mover, false);
         }
     } else {
         // Handle unrecognized command
-        message_send(from, "ERROR Unrecognized command");
+        sendMessage(from, "ERROR Unrecognized command");
     }
 
     return false; // Keep the loop running
@@ -272,33 +431,454 @@ bool handleMessage(void* arg, const addr_t from, const char* buf)
 
 
 void updateAllPlayers(game_t* game) {
-    for (int i = 0; i < MaxPlayers; i++) {
-        if (message_isAddr(game->activePlayers[i])) {
-            player_t* player = hashtable_find(game->players, message_stringAddr(game->activePlayers[i]));
-            if (player != NULL) {
-                // Update the player's visible map
-                char* visibleMap = mem_malloc(strlen(game->map) + 1);
-                memset(visibleMap, 0, strlen(game->map) + 1);
-                map_get_visible(player->xPosition, player->yPosition, game->map, visibleMap, game->mapWidth, game->mapHeight);
-                map_merge(player->playerMap, visibleMap, game->mapWidth, game->mapHeight);
-                mem_free(visibleMap);
-
-                // Send the updated map to the player
-                char first_part[] = "DISPLAY\n";
-                char* map = map_decode(player->playerMap, game);
-                char message[message_MaxBytes];
-                memset(message, 0, sizeof(message));
-                snprintf(message, message_MaxBytes, "%s%s", first_part, map);
-                message_send(game->activePlayers[i], message);
-                mem_free(map);
-
-                // Send updated gold info
-                char goldInfo[50];
-                snprintf(goldInfo, sizeof(goldInfo), "GOLD %d %d %d", player->goldJustCaptured, player->goldCaptured, game->goldRemaining);
-                message_send(game->activePlayers[i], goldInfo);
+    for (int i = 0; i < game->activePlayersCount; i++) {
+        player_t* player = game->slots[i];
+        // Players who cannot see anything that changed get nothing
+        if (player->changed) {
+            player->changed = false;
+
+            // Update the player's visible map
+            uint64_t stageStart = metrics_now();
+            game_refreshPlayer(game, player);
+            metrics_record(metrics_Visibility, stageStart);
+
+            // Send the updated map and gold info to the player
+            sendPlayerDisplay(game, player, true);
+        }
+    }
+    if (game->hasSpectator) {
+        sendSpectatorDisplay(game, true);
+    }
+}
+
+
+// Handle one key from a player or the spectator; returns true when the
+// game is over
+static bool handleKey(game_t* game, const addr_t from, const char key,
+                      const bool sequenced, const unsigned int keySeq)
+{
+    // Handle player movement or quitting
+    char keyString[2] = {key, '\0'};
+    printf("Key received from player: %c\n", key);
+
+    if (key == 'Q' || key == 'q') {
+        // Handle player quitting
+        if (message_eqAddr(from, game->spectatorAddress)) {
+            sendText(from, spectatorCaps, RELIABLE, "QUIT Thanks for watching");
+            message_release(from);
+            game->hasSpectator = false;
+            replay_record(recorder, replay_Key, replay_Spectator, keyString);
+        } else {
+            sendText(from, capsOf(game, from), RELIABLE, "QUIT Thanks for playing");
+            message_release(from);
+            player_t* quittingPlayer = hashtable_find(game->players, message_stringAddr(from));
+            if (quittingPlayer != NULL) {
+                replay_record(recorder, replay_Key, quittingPlayer->slot, keyString);
             }
+            game_playerQuit(game, from);
+        }
+
+        // Update all players and the spectator
+        updateAllPlayers(game);
+    } else {
+        // Process valid movement keys
+        char valid_chars[] = "QhljkyubnHLJKYUBN";
+        if (strchr(valid_chars, key)) {
+            player_t* mover = hashtable_find(game->players, message_stringAddr(from));
+            if (mover != NULL) {
+                replay_record(recorder, replay_Key, mover->slot, keyString);
+                if (sequenced) {
+                    mover->keysSequenced = true;
+                    mover->lastKeySeq = keySeq;
+                }
+            }
+            uint64_t moveStart = metrics_now();
+            bool moved = game_playerMove(from, game, key);
+            metrics_record(metrics_Move, moveStart);
+            if (!moved && mover != NULL && sequenced) {
+                // Nothing changed, but the client is waiting to learn
+                // that this key was handled
+                sendPlayerDisplay(game, mover, false);
+            }
+            if (moved) {
+                // Movement succeeded, update all players and the spectator
+                updateAllPlayers(game);
+
+                // Check if game is over
+                if (game->goldRemaining == 0) {
+                    sendGameOver(game);
+                    return true; // Exit the game loop
+                }
+            }
+        } else {
+            sendMessage(from, "ERROR Not a valid input");
+        }
+    }
+
+    return false;
+}
+
+
+// Tell every player and the spectator the game is over, with the scores.
+// A reliable message carries the whole table; one datagram, for a client
+// without "reliable", may have room for only some of it, and then says so
+static void sendGameOver(game_t* game)
+{
+    char end_part[] = "QUIT GAME OVER:\n";
+    char* messages[2] = { NULL, NULL };     // [0] one datagram, [1] reliable
+    for (int r = 0; r < 2; r++) {
+        size_t limit = r ? message_MaxReliableBytes : message_MaxBytes;
+        char* finalScores = game_getFinalScores(game, limit - strlen(end_part) + 1);
+        if (finalScores == NULL) {
+            continue;
+        }
+        messages[r] = mem_malloc(strlen(end_part) + strlen(finalScores) + 1);
+        if (messages[r] != NULL) {
+            strcpy(messages[r], end_part);
+            strcat(messages[r], finalScores);
+        }
+        mem_free(finalScores);
+    }
+
+    // Notify all players, then the spectator if present
+    for (int i = 0; i <= game->activePlayersCount; i++) {
+        bool spectator = (i == game->activePlayersCount);
+        if (spectator && !game->hasSpectator) {
+            break;
+        }
+        addr_t to = spectator ? game->spectatorAddress : game->slots[i]->address;
+        int caps = spectator ? spectatorCaps : game->slots[i]->caps;
+        char* end_message = messages[(caps & wire_CapReliable) ? 1 : 0];
+        if (end_message != NULL) {
+            sendText(to, caps, RELIABLE, end_message);
+        }
+    }
+
+    for (int r = 0; r < 2; r++) {
+        if (messages[r] != NULL) {
+            mem_free(messages[r]);
+        }
+    }
+}
+
+
+// Expand the run-length key list of a KEYS message into 'keys'; returns
+// the number of keys, or -1 if a key is not a movement key or there are
+// more than maxKeys; *end is set to the text after the list
+static int expandKeys(const char* text, char* keys, int maxKeys, const char** end)
+{
+    const char* movementKeys = "hljkyubnHLJKYUBN";
+    int count = 0;
+    const char* p = text;
+    while (*p != '\0' && *p != ' ') {
+        int repeat = 1;
+        if (isdigit((unsigned char)*p)) {
+            repeat = 0;
+            while (isdigit((unsigned char)*p) && repeat <= maxKeys) {
+                repeat = repeat * 10 + (*p++ - '0');
+            }
+        }
+        if (*p == '\0' || strchr(movementKeys, *p) == NULL
+            || repeat < 1 || count + repeat > maxKeys) {
+            return -1;
+        }
+        for (int i = 0; i < repeat; i++) {
+            keys[count++] = *p;
         }
+        p++;
     }
+    *end = p;
+    return count;
 }
 
 
+// Send a player their current map, or the window of it around them that
+// fits their screen, and with 'withGold' their gold as well; if they number
+// their keys, the DISPLAY header carries the number of the last key handled
+// ("DISPLAY seq")
+static void sendPlayerDisplay(game_t* game, player_t* player, bool withGold)
+{
+    window_t window;
+    bool windowed = windowAround(game, player->viewRows, player->viewCols,
+                                 player->yPosition, player->xPosition, &window);
+    int gold[3] = { player->goldJustCaptured, player->goldCaptured, game->goldRemaining };
+    sendDisplay(game, player->address, player->caps, player->display, game->mapWidth + 1,
+                withGold ? gold : NULL, windowed ? &window : NULL,
+                player->keysSequenced, player->lastKeySeq);
+}
+
+
+// Send the spectator the whole map, or the middle of it that fits their
+// screen, and with 'withGold' the gold remaining
+static void sendSpectatorDisplay(game_t* game, bool withGold)
+{
+    window_t window;
+    bool windowed = windowAround(game, spectatorViewRows, spectatorViewCols,
+                                 game->mapHeight / 2, game->mapWidth / 2, &window);
+    int gold[3] = { 0, 0, game->goldRemaining };
+    sendDisplay(game, game->spectatorAddress, spectatorCaps, game->map, game->mapWidth,
+                withGold ? gold : NULL, windowed ? &window : NULL, false, 0);
+}
+
+
+// The window of at most rows x cols cells centred on (row, col), moved as
+// needed to lie within the map; false if there is no limit (rows or cols
+// is 0) or the window would cover the whole map
+static bool windowAround(game_t* game, int rows, int cols, int row, int col,
+                         window_t* window)
+{
+    if (rows <= 0 || cols <= 0 || (rows >= game->mapHeight && cols >= game->mapWidth)) {
+        return false;
+    }
+    window->rows = (rows < game->mapHeight) ? rows : game->mapHeight;
+    window->cols = (cols < game->mapWidth) ? cols : game->mapWidth;
+    window->top = row - window->rows / 2;
+    window->left = col - window->cols / 2;
+    if (window->top > game->mapHeight - window->rows) {
+        window->top = game->mapHeight - window->rows;
+    }
+    if (window->left > game->mapWidth - window->cols) {
+        window->left = game->mapWidth - window->cols;
+    }
+    if (window->top < 0) {
+        window->top = 0;
+    }
+    if (window->left < 0) {
+        window->left = 0;
+    }
+    return true;
+}
+
+
+// Send a map (rows of cols cells, 'stride' apart), or a window of it, as a
+// DISPLAY (or VIEW), in the client's encoding: text inserts the newlines,
+// binary sends the cells as they are or, with "rle", run-length encoded.
+// A player's display (stride cols+1) is a text DISPLAY already, with room
+// for the header before it, so the whole of it is sent where it lies.
+// The message is sized to the window; one too large for one datagram
+// reaches only "reliable" clients, whose message module splits it up.
+// 'gold' (n p r), unless NULL, goes along: in the same message, as a STATE,
+// to a client that accepted "state", and otherwise first as a GOLD
+static void sendDisplay(game_t* game, const addr_t to, int caps, char* map,
+                        int stride, const int* gold,
+                        const window_t* window, bool sequenced, unsigned int seq)
+{
+    if (gold != NULL && !(caps & wire_CapState)) {
+        sendGold(to, caps, gold[0], gold[1], gold[2]);
+        gold = NULL;
+    }
+
+    uint64_t encodeStart = metrics_now();
+    window_t whole = { 0, 0, game->mapHeight, game->mapWidth };
+    const window_t* w = (window != NULL) ? window : &whole;
+    size_t cells = (size_t)w->rows * w->cols;
+
+    if (caps & wire_CapBinary) {
+        // the window's rows, gathered into one block
+        char* block = map;
+        if (window != NULL || stride != w->cols) {
+            block = mem_malloc(cells);
+            for (int row = 0; row < w->rows; row++) {
+                memcpy(block + row * w->cols,
+                       map + (w->top + row) * stride + w->left, w->cols);
+            }
+        }
+        size_t size = 2 * wire_MaxHeader + cells;
+        unsigned char* frame = mem_malloc(size);
+        size_t start = (gold != NULL) ? wire_encodeState(frame, gold[0], gold[1], gold[2]) : 0;
+        size_t length = start + ((window != NULL)
+            ? wire_encodeView(frame + start, size - start, caps & wire_CapRle, sequenced, seq,
+                              w->top, w->left, w->rows, w->cols, block)
+            : wire_encodeDisplay(frame + start, size - start, caps & wire_CapRle, sequenced, seq,
+                                 w->rows, w->cols, block));
+        metrics_record(metrics_Encode, encodeStart);
+        sendBytes(to, caps, DISPLAY_CHANNEL, frame, length);
+        mem_free(frame);
+        if (block != map) {
+            mem_free(block);
+        }
+        return;
+    }
+
+    char first_part[DisplayHeadroom];
+    int used = (gold != NULL)
+        ? snprintf(first_part, sizeof(first_part), "STATE %d %d %d\n", gold[0], gold[1], gold[2])
+        : 0;
+    used += (window != NULL)
+        ? snprintf(first_part + used, sizeof(first_part) - used, "VIEW %d %d", w->top, w->left)
+        : snprintf(first_part + used, sizeof(first_part) - used, "DISPLAY");
+    if (sequenced) {
+        used += snprintf(first_part + used, sizeof(first_part) - used, " %u", seq);
+    }
+    snprintf(first_part + used, sizeof(first_part) - used, "\n");
+
+    // a player's whole display needs only the header in front of it
+    if (window == NULL && stride == game->mapWidth + 1) {
+        size_t length = strlen(first_part);
+        memcpy(map - length, first_part, length);
+        metrics_record(metrics_Encode, encodeStart);
+        sendText(to, caps, DISPLAY_CHANNEL, map - length);
+        return;
+    }
+
+    // the header, then each row of the window and a newline
+    size_t size = strlen(first_part) + cells + w->rows + 1;
+    char* message = mem_malloc(size);
+    char* p = message + strlen(first_part);
+    strcpy(message, first_part);
+    for (int row = 0; row < w->rows; row++) {
+        memcpy(p, map + (w->top + row) * stride + w->left, w->cols);
+        p += w->cols;
+        *p++ = '\n';
+    }
+    *p = '\0';
+    metrics_record(metrics_Encode, encodeStart);
+    sendText(to, caps, DISPLAY_CHANNEL, message);
+    mem_free(message);
+}
+
+
+// Send "OK L", "GRID r c" and "GOLD n p r", in the client's encoding
+static void sendOk(const addr_t to, int caps, char letter)
+{
+    if (caps & wire_CapBinary) {
+        unsigned char frame[wire_MaxHeader];
+        sendBytes(to, caps, RELIABLE, frame, wire_encodeOk(frame, letter));
+    } else {
+        char response[5];
+        snprintf(response, sizeof(response), "OK %c", letter);
+        sendText(to, caps, RELIABLE, response);
+    }
+}
+
+static void sendGrid(game_t* game, const addr_t to, int caps)
+{
+    if (caps & wire_CapBinary) {
+        unsigned char frame[wire_MaxHeader];
+        sendBytes(to, caps, RELIABLE, frame, wire_encodeGrid(frame, game->mapHeight, game->mapWidth));
+    } else {
+        char result[50];
+        snprintf(result, sizeof(result), "GRID %d %d", game->mapHeight, game->mapWidth);
+        sendText(to, caps, RELIABLE, result);
+    }
+}
+
+static void sendGold(const addr_t to, int caps, int n, int p, int r)
+{
+    if (caps & wire_CapBinary) {
+        unsigned char frame[wire_MaxHeader];
+        sendBytes(to, caps, GOLD_CHANNEL, frame, wire_encodeGold(frame, n, p, r));
+    } else {
+        char goldInfo[50];
+        snprintf(goldInfo, sizeof(goldInfo), "GOLD %d %d %d", n, p, r);
+        sendText(to, caps, GOLD_CHANNEL, goldInfo);
+    }
+}
+
+
+// Handle a binary frame from a client; only KEY is sent this way
+static bool handleBinary(game_t* game, const addr_t from, const char* buf)
+{
+    wire_frame_t frame;
+    if (!wire_decode(buf, message_length(), &frame) || frame.type != wire_Key) {
+        sendMessage(from, "ERROR Unrecognized command");
+        return false;
+    }
+    return handleKey(game, from, frame.letter, frame.hasSeq, frame.seq);
+}
+
+
+// The protocol options agreed with whoever is at this address: a player,
+// the spectator, or a client that has offered some but not yet joined
+static int capsOf(game_t* game, const addr_t addr)
+{
+    if (game->hasSpectator && message_eqAddr(addr, game->spectatorAddress)) {
+        return spectatorCaps;
+    }
+    player_t* player = hashtable_find(game->players, message_stringAddr(addr));
+    if (player != NULL) {
+        return player->caps;
+    }
+    int* saved = (pendingCaps == NULL) ? NULL : hashtable_find(pendingCaps, message_stringAddr(addr));
+    return (saved == NULL) ? 0 : *saved;
+}
+
+
+// The protocol options a joining client offered with CAPS, or none
+static int takeCaps(const addr_t from)
+{
+    if (pendingCaps == NULL) {
+        return 0;
+    }
+    int* saved = hashtable_find(pendingCaps, message_stringAddr(from));
+    if (saved == NULL) {
+        return 0;
+    }
+    int caps = *saved;
+    *saved = 0;   // a later join from this address must offer them again
+    return caps;
+}
+
+
+// Send one message, counting it and timing the send
+static void sendMessage(const addr_t to, const char* message)
+{
+    uint64_t sendStart = metrics_now();
+    message_send(to, message);
+    metrics_record(metrics_Send, sendStart);
+    metrics_sent(strlen(message));
+}
+
+
+// Send one text message, reliably or as the latest on a channel if the
+// client accepted "reliable", otherwise as usual
+static void sendText(const addr_t to, int caps, int channel, const char* message)
+{
+    if (caps & wire_CapReliable) {
+        sendBytes(to, caps, channel, message, strlen(message));
+    } else if (strlen(message) > message_MaxBytes) {
+        fprintf(stderr, "Warning: %zu-byte message too large for %s\n",
+                strlen(message), message_stringAddr(to));
+    } else {
+        sendMessage(to, message);
+    }
+}
+
+
+// Send one message (a binary frame, or text from sendText), counting it
+// and timing the send
+static void sendBytes(const addr_t to, int caps, int channel, const void* bytes, size_t length)
+{
+    size_t limit = (caps & wire_CapReliable) ? message_MaxReliableBytes : message_MaxBytes;
+    if (length > limit) {
+        fprintf(stderr, "Warning: %zu-byte message too large for %s\n",
+                length, message_stringAddr(to));
+        return;
+    }
+    uint64_t sendStart = metrics_now();
+    if (!(caps & wire_CapReliable)) {
+        message_sendBytes(to, bytes, length);
+    } else if (channel == RELIABLE) {
+        message_sendReliable(to, bytes, length);
+    } else {
+        message_sendLatest(to, channel, bytes, length);
+    }
+    metrics_record(metrics_Send, sendStart);
+    metrics_sent(length);
+}
+
+
+// Write the metrics file if one was requested and it is due (or forced)
+static void dumpMetrics(game_t* game, bool force)
+{
+    if (metricsPath == NULL) {
+        return;
+    }
+    uint64_t now = metrics_now();
+    if (force || now - lastMetricsDump >= METRICS_SECONDS * 1000000000ull) {
+        if (!metrics_dump(metricsPath, game)) {
+            fprintf(stderr, "Warning: cannot write metrics to %s\n", metricsPath);
+        }
+        lastMetricsDump = now;
+    }
+}
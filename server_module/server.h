@@ -20,9 +20,13 @@
  * @param argc the argument count from main
  * @param argv the argument vector from main
  * @param seed pointer to an integer where the seed will be stored
+ * @param maxPlayers pointer set to the -p cap on players, or MaxPlayers
+ * @param replayPath pointer set to the -r replay file name, if given
+ * @param metricsPath pointer set to the -m metrics file name, if given
  * @return FILE pointer to the opened map file, or NULL if failed
  */
-FILE* parseArgs(int argc, char* argv[], int* seed);
+FILE* parseArgs(int argc, char* argv[], int* seed, int* maxPlayers,
+                const char** replayPath, const char** metricsPath);
 
 /**
  * Prints the details of the initialized game for verification purposes.
@@ -30,4 +34,37 @@ FILE* parseArgs(int argc, char* argv[], int* seed);
  */
 void printGame(const game_t* game);
 
+/**
+ * Handles one line typed on the server's stdin ("quit" or "status").
+ * @param arg the game, passed through message_loop
+ * @return true to stop the message loop
+ */
+bool handleInput(void* arg);
+
+/**
+ * Handles one message from a client (PLAY, SPECTATE or KEY).
+ * @param arg the game, passed through message_loop
+ * @param from the address of the client
+ * @param buf the message
+ * @return true to stop the message loop, i.e., when the game is over
+ */
+bool handleMessage(void* arg, const addr_t from, const char* buf);
+
+/**
+ * Called by message_loop when no message has arrived for a while;
+ * does deferred work such as flushing the replay recorder.
+ * @param arg the game, passed through message_loop
+ * @return true to stop the message loop
+ */
+bool handleTimeout(void* arg);
+
+/**
+ * Refreshes the map of every player flagged as changed (one who might see
+ * what changed) and sends each of them, and the spectator, a DISPLAY and
+ * GOLD (as one STATE to a client that accepted "state"); players in
+ * distant rooms are sent nothing.
+ * @param game pointer to the game structure
+ */
+void updateAllPlayers(game_t* game);
+
 #endif // SERVER_H
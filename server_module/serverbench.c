@@ -0,0 +1,220 @@
+/*
+ * serverbench.c - end-to-end benchmark of the Nuggets server (Team 10)
+ *
+ * Usage:
+ *   ./serverbench [-s seed] [-p players] [-w walkMoves] [-r runMoves] [-m maxMoves] map.txt
+ *
+ * Links server.c's handlers against the in-memory 'loopback' version of
+ * the message module, so there are no sockets: each scripted client
+ * message is passed straight to handleMessage and everything the server
+ * "sends" is counted rather than transmitted.  That isolates the cost of
+ * the game logic, visibility and encoding from kernel and network noise.
+ *
+ * The script runs four phases on one game:
+ *   join     'players' clients (default 26) send PLAY; the game's cap is
+ *            set to match, or to as many as the map has room for
+ *   walk     'walkMoves' single-step KEYs (default 2000) from random players
+ *   run      'runMoves' capital-letter run KEYs (default 500)
+ *   exhaust  random KEYs until the gold runs out (at most 'maxMoves', default 200000)
+ * For each phase it reports the latency histogram of handleMessage calls
+ * in nanoseconds, and the number of messages and bytes the server sent.
+ * At the end it prints the server's own metrics report, which breaks the
+ * handler time down into move, visibility, encode and send stages.
+ * The moves are chosen by a private random generator seeded with 'seed',
+ * so a given map and seed always produce the same sequence of messages.
+ *
+ * Team 10
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "server.h"
+#include "metrics.h"
+#include "../game_module/game.h"
+#include "../libcs50/mem.h"
+#include "../support/message.h"
+#include "../support/loopback.h"
+#include "../support/histogram.h"
+
+/**************** local types ****************/
+typedef struct phase {
+    const char* name;
+    histogram_t* latency;   // ns per handleMessage call
+    uint64_t messagesSent;  // by the server, during this phase
+    uint64_t bytesSent;
+} phase_t;
+
+/**************** local functions ****************/
+static uint32_t nextRandom(void);
+static addr_t clientAddress(int client);
+static bool deliver(game_t* game, phase_t* phase, addr_t from, const char* message);
+static void endPhase(phase_t* phase, FILE* out);
+
+static uint64_t randomState = 88172645463325252ull;
+
+/***************** main *******************************/
+int main(int argc, char* argv[])
+{
+    int seed = 1, players = MaxPlayers;
+    long walkMoves = 2000, runMoves = 500, maxMoves = 200000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:w:r:m:")) != -1) {
+        switch (opt) {
+            case 's': seed = atoi(optarg); break;
+            case 'p': players = atoi(optarg); break;
+            case 'w': walkMoves = atol(optarg); break;
+            case 'r': runMoves = atol(optarg); break;
+            case 'm': maxMoves = atol(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-s seed] [-p players] [-w walkMoves] [-r runMoves] [-m maxMoves] map.txt\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1 || seed <= 0 || players < 1 || players > MaxPlayersLimit) {
+        fprintf(stderr, "Usage: %s [-s seed] [-p players] [-w walkMoves] [-r runMoves] [-m maxMoves] map.txt\n", argv[0]);
+        return 1;
+    }
+    randomState ^= (uint64_t)seed * 2654435761u;
+
+    FILE* mapFile = fopen(argv[optind], "r");
+    if (mapFile == NULL) {
+        fprintf(stderr, "Failed to open %s\n", argv[optind]);
+        return 1;
+    }
+
+    // The server narrates every message on stdout; keep the report separate
+    FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+    if (out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "Error: cannot redirect stdout\n");
+        return 1;
+    }
+
+    game_t* game = game_init(mapFile, seed, players);
+    if (game == NULL || game->map == NULL) {
+        fprintf(stderr, "Error: Failed to initialize game\n");
+        return 1;
+    }
+    players = game->maxPlayers;
+    game->port = message_init(NULL);
+    if (!metrics_init()) {
+        fprintf(stderr, "Error: Failed to initialize metrics\n");
+        return 1;
+    }
+
+    fprintf(out, "map %s (%dx%d), seed %d, %d players, %d gold\n",
+            argv[optind], game->mapHeight, game->mapWidth, seed, players, game->goldRemaining);
+    fprintf(out, "latencies in ns per handleMessage call\n");
+
+    phase_t phase;
+    bool over = false;
+
+    // join
+    phase = (phase_t){"join", histogram_new(), 0, 0};
+    for (int p = 0; p < players && !over; p++) {
+        char play[32];
+        snprintf(play, sizeof(play), "PLAY player%02d", p);
+        over = deliver(game, &phase, clientAddress(p), play);
+    }
+    endPhase(&phase, out);
+
+    // walk
+    const char* stepKeys = "hjklyubn";
+    phase = (phase_t){"walk", histogram_new(), 0, 0};
+    for (long m = 0; m < walkMoves && !over; m++) {
+        char key[8];
+        snprintf(key, sizeof(key), "KEY %c", stepKeys[nextRandom() % 8]);
+        over = deliver(game, &phase, clientAddress(nextRandom() % players), key);
+    }
+    endPhase(&phase, out);
+
+    // run
+    const char* runKeys = "HJKLYUBN";
+    phase = (phase_t){"run", histogram_new(), 0, 0};
+    for (long m = 0; m < runMoves && !over; m++) {
+        char key[8];
+        snprintf(key, sizeof(key), "KEY %c", runKeys[nextRandom() % 8]);
+        over = deliver(game, &phase, clientAddress(nextRandom() % players), key);
+    }
+    endPhase(&phase, out);
+
+    // exhaust
+    const char* anyKeys = "hjklyubnHJKLYUBN";
+    phase = (phase_t){"exhaust", histogram_new(), 0, 0};
+    long moves = 0;
+    for (; moves < maxMoves && !over; moves++) {
+        char key[8];
+        snprintf(key, sizeof(key), "KEY %c", anyKeys[nextRandom() % 16]);
+        over = deliver(game, &phase, clientAddress(nextRandom() % players), key);
+    }
+    endPhase(&phase, out);
+
+    if (over) {
+        fprintf(out, "game over after %ld exhaust moves\n", moves);
+    } else {
+        fprintf(out, "gold not exhausted after %ld moves; %d nuggets left\n", moves, game->goldRemaining);
+    }
+
+    fprintf(out, "\nserver metrics:\n");
+    metrics_print(out, game);
+
+    metrics_delete();
+    message_done();
+    game_delete(game);
+    fclose(out);
+    return 0;
+}
+
+/**************** nextRandom ****************/
+/* xorshift64*; private so it is not disturbed by the game's use of rand(). */
+static uint32_t nextRandom(void)
+{
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return (uint32_t)((randomState * 2685821657736338717ull) >> 32);
+}
+
+/**************** clientAddress ****************/
+/* A distinct made-up address for each scripted client. */
+static addr_t clientAddress(int client)
+{
+    addr_t address = message_noAddr();
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(20000 + client);
+    return address;
+}
+
+/**************** deliver ****************/
+/* Time one message through handleMessage; return true if the game ended. */
+static bool deliver(game_t* game, phase_t* phase, addr_t from, const char* message)
+{
+    uint64_t sentBefore = loopback_messagesSent();
+    uint64_t bytesBefore = loopback_bytesSent();
+
+    uint64_t start = histogram_nowNanos();
+    bool over = handleMessage(game, from, message);
+    histogram_record(phase->latency, histogram_nowNanos() - start);
+
+    phase->messagesSent += loopback_messagesSent() - sentBefore;
+    phase->bytesSent += loopback_bytesSent() - bytesBefore;
+    return over;
+}
+
+/**************** endPhase ****************/
+/* Report on one phase and free its histogram. */
+static void endPhase(phase_t* phase, FILE* out)
+{
+    histogram_print(phase->latency, out, phase->name);
+    fprintf(out, "%-16s sent %llu messages, %llu bytes\n", "",
+            (unsigned long long)phase->messagesSent, (unsigned long long)phase->bytesSent);
+    histogram_delete(phase->latency);
+    phase->latency = NULL;
+}
@@ -0,0 +1,216 @@
+/*
+ * histogram - a fixed-size latency histogram
+ *
+ * See histogram.h for detailed interface description for each function.
+ *
+ * CS50 Nuggets, Team 10
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "histogram.h"
+
+/**************** file-local constants ****************/
+/* Values below SubBuckets get a bucket each; above that, each power of two
+ * is split into SubBuckets equal slices.  64-bit values need at most
+ * SubBuckets + (64 - SubBits) * SubBuckets buckets.
+ */
+#define SubBits 4
+#define SubBuckets (1 << SubBits)
+#define NumBuckets (SubBuckets + (64 - SubBits) * SubBuckets)
+
+/**************** global types ****************/
+struct histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[NumBuckets];
+};
+
+/**************** file-local functions ****************/
+static int bucketOf(const uint64_t value);
+static uint64_t bucketLow(const int bucket);
+static uint64_t bucketHigh(const int bucket);
+
+/**************** histogram_new ****************/
+histogram_t*
+histogram_new(void)
+{
+  histogram_t* h = malloc(sizeof(histogram_t));
+  if (h != NULL) {
+    histogram_reset(h);
+  }
+  return h;
+}
+
+/**************** histogram_record ****************/
+void
+histogram_record(histogram_t* h, const uint64_t value)
+{
+  if (h == NULL) {
+    return;
+  }
+  if (h->count == 0 || value < h->min) {
+    h->min = value;
+  }
+  if (value > h->max) {
+    h->max = value;
+  }
+  h->count++;
+  h->sum += value;
+  h->buckets[bucketOf(value)]++;
+}
+
+/**************** histogram_merge ****************/
+void
+histogram_merge(histogram_t* into, const histogram_t* from)
+{
+  if (into == NULL || from == NULL || from->count == 0) {
+    return;
+  }
+  if (into->count == 0 || from->min < into->min) {
+    into->min = from->min;
+  }
+  if (from->max > into->max) {
+    into->max = from->max;
+  }
+  into->count += from->count;
+  into->sum += from->sum;
+  for (int b = 0; b < NumBuckets; b++) {
+    into->buckets[b] += from->buckets[b];
+  }
+}
+
+/**************** histogram_reset ****************/
+void
+histogram_reset(histogram_t* h)
+{
+  if (h != NULL) {
+    memset(h, 0, sizeof(histogram_t));
+  }
+}
+
+/**************** histogram_count etc. ****************/
+uint64_t histogram_count(const histogram_t* h) { return h == NULL ? 0 : h->count; }
+uint64_t histogram_sum(const histogram_t* h)   { return h == NULL ? 0 : h->sum; }
+uint64_t histogram_min(const histogram_t* h)   { return h == NULL ? 0 : h->min; }
+uint64_t histogram_max(const histogram_t* h)   { return h == NULL ? 0 : h->max; }
+
+/**************** histogram_mean ****************/
+double
+histogram_mean(const histogram_t* h)
+{
+  if (h == NULL || h->count == 0) {
+    return 0;
+  }
+  return (double)h->sum / h->count;
+}
+
+/**************** histogram_percentile ****************/
+uint64_t
+histogram_percentile(const histogram_t* h, const double percentile)
+{
+  if (h == NULL || h->count == 0) {
+    return 0;
+  }
+
+  // rank of the sample we want, counting from 1
+  uint64_t rank = (uint64_t)(percentile / 100.0 * h->count + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  if (rank > h->count) {
+    rank = h->count;
+  }
+
+  uint64_t seen = 0;
+  for (int b = 0; b < NumBuckets; b++) {
+    seen += h->buckets[b];
+    if (seen >= rank) {
+      uint64_t mid = bucketLow(b) + (bucketHigh(b) - bucketLow(b)) / 2;
+      if (mid < h->min) {
+        mid = h->min;
+      }
+      if (mid > h->max) {
+        mid = h->max;
+      }
+      return mid;
+    }
+  }
+  return h->max; // not reached
+}
+
+/**************** histogram_print ****************/
+void
+histogram_print(const histogram_t* h, FILE* fp, const char* label)
+{
+  if (fp == NULL) {
+    return;
+  }
+  fprintf(fp, "%-16s count %10llu  mean %10.0f  p50 %10llu  p99 %10llu  p99.9 %10llu  max %10llu\n",
+          label == NULL ? "" : label,
+          (unsigned long long)histogram_count(h),
+          histogram_mean(h),
+          (unsigned long long)histogram_percentile(h, 50),
+          (unsigned long long)histogram_percentile(h, 99),
+          (unsigned long long)histogram_percentile(h, 99.9),
+          (unsigned long long)histogram_max(h));
+}
+
+/**************** histogram_delete ****************/
+void
+histogram_delete(histogram_t* h)
+{
+  free(h);
+}
+
+/**************** histogram_nowNanos ****************/
+uint64_t
+histogram_nowNanos(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**************** bucketOf ****************/
+/* Map a value to its bucket index. */
+static int
+bucketOf(const uint64_t value)
+{
+  if (value < SubBuckets) {
+    return (int)value;
+  }
+  int exponent = 63 - __builtin_clzll(value);          // >= SubBits
+  int slice = (int)(value >> (exponent - SubBits)) & (SubBuckets - 1);
+  return SubBuckets + (exponent - SubBits) * SubBuckets + slice;
+}
+
+/**************** bucketLow, bucketHigh ****************/
+/* Smallest and largest value that map to the given bucket. */
+static uint64_t
+bucketLow(const int bucket)
+{
+  if (bucket < SubBuckets) {
+    return bucket;
+  }
+  int exponent = (bucket - SubBuckets) / SubBuckets + SubBits;
+  int slice = (bucket - SubBuckets) % SubBuckets;
+  return ((uint64_t)(SubBuckets + slice)) << (exponent - SubBits);
+}
+
+static uint64_t
+bucketHigh(const int bucket)
+{
+  if (bucket < SubBuckets) {
+    return bucket;
+  }
+  int exponent = (bucket - SubBuckets) / SubBuckets + SubBits;
+  return bucketLow(bucket) + (((uint64_t)1) << (exponent - SubBits)) - 1;
+}
@@ -0,0 +1,108 @@
+/*
+ * histogram - a fixed-size latency histogram
+ *
+ * Records non-negative integer samples (typically nanoseconds) into
+ * log-linear buckets: sixteen linear sub-buckets per power of two, so any
+ * reported percentile is within about 6% of the true sample value.
+ * Recording is a few instructions and never allocates, which makes the
+ * histogram suitable for use on hot paths; memory use is fixed (~8KB)
+ * no matter how many samples are recorded.
+ *
+ * Typical use:
+ *   histogram_t* h = histogram_new();
+ *   uint64_t start = histogram_nowNanos();
+ *   ... work ...
+ *   histogram_record(h, histogram_nowNanos() - start);
+ *   histogram_print(h, stdout, "work");
+ *   histogram_delete(h);
+ *
+ * CS50 Nuggets, Team 10
+ */
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/****************** types *********************/
+typedef struct histogram histogram_t;  // opaque to users of the module
+
+/****************** global functions *********************/
+
+/******************************************/
+/* histogram_new: create an empty histogram.
+ * Function returns:
+ *   pointer to a new histogram, or NULL if out of memory.
+ * Caller expectations:
+ *   call histogram_delete() when done.
+ */
+histogram_t* histogram_new(void);
+
+/******************************************/
+/* histogram_record: add one sample to the histogram.
+ * Caller provides: a histogram (NULL is ignored) and a sample value.
+ */
+void histogram_record(histogram_t* h, const uint64_t value);
+
+/******************************************/
+/* histogram_merge: add every sample of 'from' into 'into'.
+ * Caller provides: two histograms (NULL is ignored).
+ */
+void histogram_merge(histogram_t* into, const histogram_t* from);
+
+/******************************************/
+/* histogram_reset: forget all samples.
+ * Caller provides: a histogram (NULL is ignored).
+ */
+void histogram_reset(histogram_t* h);
+
+/******************************************/
+/* histogram_count, histogram_sum, histogram_min, histogram_max:
+ * Caller provides: a histogram.
+ * Function returns:
+ *   the number of samples, their exact sum, smallest and largest sample;
+ *   zero for an empty or NULL histogram.
+ */
+uint64_t histogram_count(const histogram_t* h);
+uint64_t histogram_sum(const histogram_t* h);
+uint64_t histogram_min(const histogram_t* h);
+uint64_t histogram_max(const histogram_t* h);
+
+/******************************************/
+/* histogram_mean: return the mean sample value, or 0 if empty. */
+double histogram_mean(const histogram_t* h);
+
+/******************************************/
+/* histogram_percentile: estimate a percentile.
+ * Caller provides:
+ *   a histogram, and the percentile in [0, 100] (e.g., 99.9).
+ * Function returns:
+ *   the midpoint of the bucket holding that percentile, clamped to the
+ *   recorded min and max; zero if the histogram is empty.
+ */
+uint64_t histogram_percentile(const histogram_t* h, const double percentile);
+
+/******************************************/
+/* histogram_print: print a one-line summary.
+ * Caller provides:
+ *   a histogram, an open file, and a label for the line.
+ * We print:
+ *   label, count, mean, p50, p99, p99.9 and max, with values in the
+ *   units they were recorded in.
+ */
+void histogram_print(const histogram_t* h, FILE* fp, const char* label);
+
+/******************************************/
+/* histogram_delete: free the histogram (NULL is ignored). */
+void histogram_delete(histogram_t* h);
+
+/******************************************/
+/* histogram_nowNanos: read a monotonic clock.
+ * Function returns:
+ *   the current time in nanoseconds since an arbitrary fixed point;
+ *   differences between two calls measure elapsed time.
+ */
+uint64_t histogram_nowNanos(void);
+
+#endif // _HISTOGRAM_H_
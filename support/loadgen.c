@@ -0,0 +1,310 @@
+/*
+ * loadgen - a headless load generator for the Nuggets server
+ *
+ * Like miniclient, loadgen speaks the Nuggets protocol to a server, but
+ * instead of one interactive connection it runs many simulated clients
+ * from a single process: as many players as the server was started to
+ * allow (26 unless it was given -p) and any number of spectators.  Each
+ * bot has its own UDP socket, so the server sees each as a distinct
+ * client.  Players send KEY messages at a fixed rate, either randomly
+ * chosen moves or a scripted sequence of keys.
+ *
+ * For every KEY a player sends, loadgen measures the time until that
+ * player next receives a DISPLAY or GOLD message.  A KEY that gets no
+ * reply before the player sends its next KEY (e.g., a move into a wall)
+ * is counted as unanswered rather than inflating the next measurement.
+ * At the end, loadgen reports message throughput and the p50, p99 and
+ * p99.9 round-trip latencies.
+ *
+ * usage: loadgen [options] hostname port
+ *   -p players     number of players to simulate (default 1, at most 32767)
+ *   -s spectators  number of spectators to simulate (default 0)
+ *   -r rate        KEY messages per second, per player (default 10)
+ *   -d seconds     how long to run (default 10)
+ *   -k keys        cycle through this script of keys instead of random moves
+ *   -S seed        seed for the random moves (default: process id)
+ *
+ * Note the server supports only one spectator; each new spectator
+ * replaces the previous one, so -s > 1 exercises the replacement path.
+ *
+ * CS50 Nuggets, Team 10
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "message.h"
+#include "histogram.h"
+
+/**************** file-local constants ****************/
+static const int MaxPlayers = 32767;       // the most a server can allow
+static const char RandomKeys[] = "hjklyubn";
+
+/**************** file-local types ****************/
+typedef struct bot {
+  int socket;                // this bot's own UDP socket
+  bool isPlayer;             // player or spectator
+  bool done;                 // the server sent QUIT
+  uint64_t nextSend;         // when to send the next KEY (ns)
+  uint64_t pendingSince;     // when the unanswered KEY was sent; 0 if none
+  int scriptPos;             // next key in the script
+} bot_t;
+
+typedef struct load {
+  addr_t server;
+  bot_t* bots;
+  int numBots;
+  const char* script;        // NULL for random keys
+  uint64_t interval;         // ns between KEYs from one player
+  uint64_t keysSent;
+  uint64_t unanswered;
+  uint64_t messagesReceived;
+  uint64_t bytesReceived;
+  histogram_t* latency;      // ns from KEY to next DISPLAY/GOLD
+} load_t;
+
+/**************** file-local functions ****************/
+static int openSocket(void);
+static void sendTo(load_t* load, bot_t* bot, const char* message);
+static void sendKey(load_t* load, bot_t* bot, uint64_t now);
+static void receive(load_t* load, bot_t* bot, char* buf);
+static void report(const load_t* load, double seconds);
+
+/***************** main *******************************/
+int
+main(const int argc, char* argv[])
+{
+  const char* program = argv[0];
+  int players = 1, spectators = 0;
+  double rate = 10, duration = 10;
+  const char* script = NULL;
+  unsigned seed = getpid();
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:s:r:d:k:S:")) != -1) {
+    switch (opt) {
+    case 'p': players = atoi(optarg); break;
+    case 's': spectators = atoi(optarg); break;
+    case 'r': rate = atof(optarg); break;
+    case 'd': duration = atof(optarg); break;
+    case 'k': script = optarg; break;
+    case 'S': seed = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-p players] [-s spectators] [-r rate] "
+              "[-d seconds] [-k keys] [-S seed] hostname port\n", program);
+      return 3; // bad commandline
+    }
+  }
+  if (argc - optind != 2) {
+    fprintf(stderr, "usage: %s [-p players] [-s spectators] [-r rate] "
+            "[-d seconds] [-k keys] [-S seed] hostname port\n", program);
+    return 3; // bad commandline
+  }
+  if (players < 0 || players > MaxPlayers || spectators < 0
+      || players + spectators == 0 || rate <= 0 || duration <= 0
+      || (script != NULL && *script == '\0')) {
+    fprintf(stderr, "%s: need 0-%d players, at least one bot, "
+            "positive rate and duration, non-empty script\n", program, MaxPlayers);
+    return 3;
+  }
+  srand(seed);
+
+  load_t load;
+  memset(&load, 0, sizeof(load));
+  if (!message_setAddr(argv[optind], argv[optind + 1], &load.server)) {
+    fprintf(stderr, "can't form address from %s %s\n", argv[optind], argv[optind + 1]);
+    return 4; // bad hostname/port
+  }
+  load.script = script;
+  load.interval = (uint64_t)(1e9 / rate);
+  load.numBots = players + spectators;
+  load.bots = calloc(load.numBots, sizeof(bot_t));
+  load.latency = histogram_new();
+  struct pollfd* fds = calloc(load.numBots, sizeof(struct pollfd));
+  char* buf = malloc(message_MaxBytes);
+  if (load.bots == NULL || load.latency == NULL || fds == NULL || buf == NULL) {
+    fprintf(stderr, "%s: out of memory\n", program);
+    return 2;
+  }
+
+  // join every bot, spreading the players' first KEYs over one interval
+  uint64_t start = histogram_nowNanos();
+  for (int i = 0; i < load.numBots; i++) {
+    bot_t* bot = &load.bots[i];
+    bot->socket = openSocket();
+    if (bot->socket < 0) {
+      fprintf(stderr, "%s: cannot open socket for bot %d\n", program, i);
+      return 2;
+    }
+    bot->isPlayer = (i < players);
+    bot->nextSend = start + load.interval + load.interval * i / load.numBots;
+    fds[i].fd = bot->socket;
+    fds[i].events = POLLIN;
+
+    char join[32];
+    if (bot->isPlayer) {
+      snprintf(join, sizeof(join), "PLAY bot%02d", i);
+    } else {
+      snprintf(join, sizeof(join), "SPECTATE");
+    }
+    sendTo(&load, bot, join);
+  }
+
+  // send KEYs on schedule and collect replies until time runs out
+  uint64_t end = start + (uint64_t)(duration * 1e9);
+  uint64_t now = start;
+  while (now < end) {
+    uint64_t wake = end;
+    for (int i = 0; i < load.numBots; i++) {
+      bot_t* bot = &load.bots[i];
+      if (bot->isPlayer && !bot->done && bot->nextSend < wake) {
+        wake = bot->nextSend;
+      }
+    }
+    int waitMillis = (wake > now) ? (int)((wake - now + 999999) / 1000000) : 0;
+
+    if (poll(fds, load.numBots, waitMillis) > 0) {
+      for (int i = 0; i < load.numBots; i++) {
+        if (fds[i].revents & POLLIN) {
+          receive(&load, &load.bots[i], buf);
+        }
+      }
+    }
+
+    now = histogram_nowNanos();
+    for (int i = 0; i < load.numBots; i++) {
+      bot_t* bot = &load.bots[i];
+      if (bot->isPlayer && !bot->done && bot->nextSend <= now) {
+        sendKey(&load, bot, now);
+        bot->nextSend += load.interval;
+        if (bot->nextSend < now) {   // fell behind; don't burst to catch up
+          bot->nextSend = now + load.interval;
+        }
+      }
+    }
+  }
+
+  report(&load, (histogram_nowNanos() - start) / 1e9);
+
+  // leave the game politely
+  for (int i = 0; i < load.numBots; i++) {
+    if (!load.bots[i].done) {
+      sendTo(&load, &load.bots[i], "KEY Q");
+    }
+    close(load.bots[i].socket);
+  }
+  histogram_delete(load.latency);
+  free(load.bots);
+  free(fds);
+  free(buf);
+  return 0;
+}
+
+/**************** openSocket ****************/
+/* Open a UDP socket on an OS-assigned port; return it, or -1 on error. */
+static int
+openSocket(void)
+{
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    return -1;
+  }
+  struct sockaddr_in self;
+  memset(&self, 0, sizeof(self));
+  self.sin_family = AF_INET;
+  self.sin_addr.s_addr = INADDR_ANY;
+  self.sin_port = 0;
+  if (bind(sock, (struct sockaddr *) &self, sizeof(self)) != 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+/**************** sendTo ****************/
+/* Send a string message from this bot's socket to the server. */
+static void
+sendTo(load_t* load, bot_t* bot, const char* message)
+{
+  if (sendto(bot->socket, message, strlen(message), 0,
+             (struct sockaddr *) &load->server, sizeof(load->server)) < 0) {
+    perror("loadgen: sendto");
+  }
+}
+
+/**************** sendKey ****************/
+/* Send this player's next KEY and start timing it. */
+static void
+sendKey(load_t* load, bot_t* bot, uint64_t now)
+{
+  char key;
+  if (load->script != NULL) {
+    key = load->script[bot->scriptPos++];
+    if (load->script[bot->scriptPos] == '\0') {
+      bot->scriptPos = 0;
+    }
+  } else {
+    key = RandomKeys[rand() % (sizeof(RandomKeys) - 1)];
+  }
+
+  if (bot->pendingSince != 0) {
+    load->unanswered++;     // the previous KEY got no DISPLAY or GOLD
+  }
+
+  char message[8];
+  snprintf(message, sizeof(message), "KEY %c", key);
+  sendTo(load, bot, message);
+  load->keysSent++;
+  bot->pendingSince = now;
+}
+
+/**************** receive ****************/
+/* Read one datagram for this bot; time it if it answers a KEY. */
+static void
+receive(load_t* load, bot_t* bot, char* buf)
+{
+  ssize_t nbytes = recvfrom(bot->socket, buf, message_MaxBytes - 1, 0, NULL, NULL);
+  if (nbytes < 0) {
+    return;
+  }
+  uint64_t now = histogram_nowNanos();
+  buf[nbytes] = '\0';
+  load->messagesReceived++;
+  load->bytesReceived += nbytes;
+
+  if (strncmp(buf, "DISPLAY\n", 8) == 0 || strncmp(buf, "GOLD ", 5) == 0) {
+    if (bot->pendingSince != 0) {
+      histogram_record(load->latency, now - bot->pendingSince);
+      bot->pendingSince = 0;
+    }
+  } else if (strncmp(buf, "QUIT ", 5) == 0) {
+    bot->done = true;
+    bot->pendingSince = 0;
+  }
+}
+
+/**************** report ****************/
+/* Print throughput and latency results. */
+static void
+report(const load_t* load, double seconds)
+{
+  const histogram_t* h = load->latency;
+  printf("bots %d, duration %.2f s\n", load->numBots, seconds);
+  printf("sent     %10llu KEY messages  (%.1f/s)\n",
+         (unsigned long long)load->keysSent, load->keysSent / seconds);
+  printf("received %10llu messages      (%.1f/s, %.1f KB/s)\n",
+         (unsigned long long)load->messagesReceived,
+         load->messagesReceived / seconds, load->bytesReceived / seconds / 1024);
+  printf("answered %10llu KEYs, %llu unanswered\n",
+         (unsigned long long)histogram_count(h), (unsigned long long)load->unanswered);
+  printf("latency  p50 %.3f ms  p99 %.3f ms  p99.9 %.3f ms  max %.3f ms\n",
+         histogram_percentile(h, 50) / 1e6, histogram_percentile(h, 99) / 1e6,
+         histogram_percentile(h, 99.9) / 1e6, histogram_max(h) / 1e6);
+}
@@ -0,0 +1,330 @@
+/*
+ * loopback - an in-memory stand-in for the 'message' module
+ *
+ * See loopback.h for an overview, and message.h for the description of
+ * each message_* function; only the differences are noted here.
+ *
+ * CS50 Nuggets, Team 10
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "message.h"
+#include "loopback.h"
+#include "log.h"
+
+/**************** file-local types ****************/
+typedef struct queued {
+  addr_t from;
+  char* message;
+  struct queued* next;
+} queued_t;
+
+/**************** file-local global variables ****************/
+/* Like message.c, this module keeps its state in file-local globals,
+ * mirroring the single socket that message.c manages.
+ */
+static bool initialized = false;
+static uint64_t messagesSent = 0;
+static uint64_t bytesSent = 0;
+static loopback_sink_t sinkFunc = NULL;
+static void* sinkArg = NULL;
+static queued_t* queueHead = NULL;
+static queued_t* queueTail = NULL;
+static size_t lastLength = 0;
+
+/**************** message_init ****************/
+/* There is no socket; we always report port 1. */
+int
+message_init(FILE* logFP)
+{
+  log_init(logFP);
+  if (initialized) {
+    log_v("message_init: called again, when already initialized");
+    return 0;
+  }
+  initialized = true;
+  loopback_resetCounts();
+  return 1;
+}
+
+/**************** message_noAddr ****************/
+addr_t
+message_noAddr(void)
+{
+  addr_t none;
+  memset(&none, 0, sizeof(none));
+  return none;
+}
+
+/**************** message_isAddr ****************/
+bool
+message_isAddr(const addr_t addr)
+{
+  return (addr.sin_family == AF_INET);
+}
+
+/**************** message_eqAddr ****************/
+bool
+message_eqAddr(const addr_t a, const addr_t b)
+{
+  return
+    a.sin_family == b.sin_family
+    && a.sin_port == b.sin_port
+    && a.sin_addr.s_addr == b.sin_addr.s_addr;
+}
+
+/**************** message_setAddr ****************/
+/* Only numeric IPv4 addresses are accepted; there is no name lookup. */
+bool
+message_setAddr(const char* hostname, const char* portString, addr_t* addr)
+{
+  if (hostname == NULL || portString == NULL || addr == NULL) {
+    return false;
+  }
+  int port;
+  char nextchar;
+  struct in_addr ip;
+  if (sscanf(portString, "%d%c", &port, &nextchar) != 1
+      || port < 1 || port > 65535 || inet_pton(AF_INET, hostname, &ip) != 1) {
+    return false;
+  }
+  *addr = message_noAddr();
+  addr->sin_family = AF_INET;
+  addr->sin_addr = ip;
+  addr->sin_port = htons(port);
+  return true;
+}
+
+/**************** message_stringAddr ****************/
+const char*
+message_stringAddr(const addr_t addr)
+{
+  static char addrString[22];
+  snprintf(addrString, 22, "%s:%05d",
+	   inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+  return addrString;
+}
+
+/**************** message_send ****************/
+/* Count the message and hand it to the sink; nothing is transmitted. */
+void
+message_send(const addr_t to, const char* message)
+{
+  if (!initialized) {
+    log_v("message_send: called before message_init");
+    return;
+  }
+  if (message == NULL) {
+    log_v("message_send: called with null message");
+    return;
+  }
+  messagesSent++;
+  bytesSent += strlen(message);
+  if (sinkFunc != NULL) {
+    (*sinkFunc)(sinkArg, to, message);
+  }
+}
+
+/**************** message_sendBytes ****************/
+/* Count the message; the sink sees only text messages. */
+void
+message_sendBytes(const addr_t to, const void* bytes, const size_t length)
+{
+  if (!initialized) {
+    log_v("message_sendBytes: called before message_init");
+    return;
+  }
+  if (bytes == NULL || length > message_MaxBytes) {
+    log_v("message_sendBytes: called with null or oversized message");
+    return;
+  }
+  messagesSent++;
+  bytesSent += length;
+}
+
+/**************** message_sendReliable ****************/
+/* Nothing is ever lost, or split, so this just counts the message. */
+void
+message_sendReliable(const addr_t to, const void* bytes, const size_t length)
+{
+  if (!initialized) {
+    log_v("message_sendReliable: called before message_init");
+    return;
+  }
+  if (bytes == NULL || length > message_MaxReliableBytes) {
+    log_v("message_sendReliable: called with null or oversized message");
+    return;
+  }
+  messagesSent++;
+  bytesSent += length;
+}
+
+/**************** message_sendLatest ****************/
+/* As message_sendReliable. */
+void
+message_sendLatest(const addr_t to, const int channel,
+                   const void* bytes, const size_t length)
+{
+  message_sendReliable(to, bytes, length);
+}
+
+/**************** message_acceptReliable ****************/
+/* There is no reliable-delivery state, so there is always room. */
+bool
+message_acceptReliable(const addr_t peer)
+{
+  return true;
+}
+
+/**************** message_forget ****************/
+/* There is no reliable-delivery state. */
+void
+message_forget(const addr_t peer)
+{
+}
+
+/**************** message_release ****************/
+/* As message_forget. */
+void
+message_release(const addr_t peer)
+{
+}
+
+/**************** message_setMaxPeers ****************/
+/* As message_forget. */
+void
+message_setMaxPeers(const int count)
+{
+}
+
+/**************** message_attachLocal ****************/
+/* Everything is already in this process; there is nothing to attach. */
+bool
+message_attachLocal(const addr_t peer)
+{
+  return false;
+}
+
+/**************** message_flush ****************/
+/* Nothing is ever outstanding. */
+bool
+message_flush(const float timeout)
+{
+  return true;
+}
+
+/**************** message_length ****************/
+size_t
+message_length(void)
+{
+  return lastLength;
+}
+
+/**************** message_loop ****************/
+/* Deliver queued messages to handleMessage until the queue is empty or a
+ * handler asks to stop.  stdin and the timeout are never triggered.
+ */
+bool
+message_loop(void* arg, const float timeout,
+             bool (*handleTimeout)(void* arg),
+             bool (*handleInput)  (void* arg),
+             bool (*handleMessage)(void* arg,
+                                   const addr_t from, const char* buf))
+{
+  if (!initialized) {
+    log_v("message_loop called before message_init");
+    return false;
+  }
+  while (queueHead != NULL) {
+    queued_t* item = queueHead;
+    queueHead = item->next;
+    if (queueHead == NULL) {
+      queueTail = NULL;
+    }
+    lastLength = strlen(item->message);
+    bool stop = (handleMessage != NULL && (*handleMessage)(arg, item->from, item->message));
+    free(item->message);
+    free(item);
+    if (stop) {
+      break;
+    }
+  }
+  return true;
+}
+
+/**************** message_pending ****************/
+/* True if anything is waiting in the injected queue. */
+bool
+message_pending(void)
+{
+  return initialized && queueHead != NULL;
+}
+
+/**************** message_done ****************/
+/* Discard anything still queued. */
+void
+message_done(void)
+{
+  while (queueHead != NULL) {
+    queued_t* item = queueHead;
+    queueHead = item->next;
+    free(item->message);
+    free(item);
+  }
+  queueTail = NULL;
+  initialized = false;
+  log_v("message_done: loopback module closing down.");
+}
+
+/**************** loopback_setSink ****************/
+void
+loopback_setSink(loopback_sink_t sink, void* arg)
+{
+  sinkFunc = sink;
+  sinkArg = arg;
+}
+
+/**************** loopback_inject ****************/
+bool
+loopback_inject(const addr_t from, const char* message)
+{
+  if (message == NULL) {
+    return false;
+  }
+  queued_t* item = malloc(sizeof(queued_t));
+  char* copy = malloc(strlen(message) + 1);
+  if (item == NULL || copy == NULL) {
+    free(item);
+    free(copy);
+    return false;
+  }
+  strcpy(copy, message);
+  item->from = from;
+  item->message = copy;
+  item->next = NULL;
+  if (queueTail == NULL) {
+    queueHead = item;
+  } else {
+    queueTail->next = item;
+  }
+  queueTail = item;
+  return true;
+}
+
+/**************** loopback counters ****************/
+uint64_t loopback_messagesSent(void) { return messagesSent; }
+uint64_t loopback_bytesSent(void)    { return bytesSent; }
+
+void
+loopback_resetCounts(void)
+{
+  messagesSent = 0;
+  bytesSent = 0;
+}
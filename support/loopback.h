@@ -0,0 +1,56 @@
+/*
+ * loopback - an in-memory stand-in for the 'message' module
+ *
+ * loopback.o implements every function declared in message.h without
+ * any sockets, so a program linked with loopback.o instead of message.o
+ * can drive its message handlers directly and measure them without
+ * kernel or network noise.  message_send() never transmits anything: it
+ * counts the message and its bytes and passes it to an optional sink
+ * function.  message_loop() delivers messages queued with
+ * loopback_inject() to the handler, in order, until the queue is empty.
+ *
+ * Link loopback.o *before* support.a so that message.o is not pulled in:
+ *   prog: prog.o ../support/loopback.o ../support/support.a
+ *
+ * CS50 Nuggets, Team 10
+ */
+
+#ifndef _LOOPBACK_H_
+#define _LOOPBACK_H_
+
+#include <stdint.h>
+#include "message.h"
+
+/****************** types *********************/
+/* A sink is called for every message_send(), with the arg given to
+ * loopback_setSink.  The message memory belongs to the caller of
+ * message_send and must not be retained.
+ */
+typedef void (*loopback_sink_t)(void* arg, const addr_t to, const char* message);
+
+/****************** global functions *********************/
+
+/******************************************/
+/* loopback_setSink: route every sent message to 'sink' (NULL for none). */
+void loopback_setSink(loopback_sink_t sink, void* arg);
+
+/******************************************/
+/* loopback_inject: queue a message as if it arrived from 'from'.
+ * The message is copied; it will be delivered by the next message_loop().
+ * Returns false if the message could not be queued (out of memory).
+ */
+bool loopback_inject(const addr_t from, const char* message);
+
+/******************************************/
+/* loopback_messagesSent, loopback_bytesSent:
+ * number of messages, and their total length in bytes, passed to
+ * message_send() since message_init() or the last loopback_resetCounts().
+ */
+uint64_t loopback_messagesSent(void);
+uint64_t loopback_bytesSent(void);
+
+/******************************************/
+/* loopback_resetCounts: zero the sent-message counters. */
+void loopback_resetCounts(void);
+
+#endif // _LOOPBACK_H_
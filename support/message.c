@@ -23,9 +23,14 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <math.h>
+#include <stdint.h>
 #include "message.h"
 #include "log.h"
+#include "histogram.h"
+#include "shm.h"
+#include "uring.h"
 
 /**************** file-local constants ****************/
 /* See message.h for other constants (shared with users of this module).
@@ -35,6 +40,101 @@
 static const int MinPort = 1024;
 static const int MaxPort = 65535;
 
+/* Reliable delivery (message_sendReliable, message_sendLatest).  Such
+ * frames start with FrameMark, which starts no text message:
+ *   FrameMark 'R' seq first payload              a reliable message
+ *   FrameMark 'L' channel seq after first payload  the latest on a channel
+ *   FrameMark 'A' kind channel seq               an acknowledgement
+ * where seq, after and first are 32-bit big-endian, 'after' is how many
+ * reliable messages were sent to the peer before this one, and 'first'
+ * is the oldest reliable message the sender still has: everything before
+ * it was acknowledged or given up on, so the receiver need not wait for it.
+ */
+static const unsigned char FrameMark = 0xFE;
+#define ReliableHeader 10
+#define LatestHeader 15
+#define PeerBuckets 4096  // hash chains of peers we keep reliable-delivery state for
+#define Window 32         // reliable messages in flight, per peer
+#define Hold 16           // reliable messages held for in-order delivery
+static const uint64_t RetryNanos = 100000000ull;      // first resend: 100ms
+static const uint64_t MaxRetryNanos = 1600000000ull;  // longest interval
+static const int MaxTries = 10;
+static const uint64_t PeerIdleNanos = 30000000000ull;  // 30s, well past MaxTries
+static const uint64_t ReclaimNanos = 1000000000ull;    // look for idle peers
+
+/* Fragmentation.  A reliable-delivery frame longer than FragmentBytes is
+ * sent as a series of datagrams
+ *   FrameMark 'F' id count index total piece
+ * where id (32 bits) names the frame and stays the same when the frame is
+ * sent again, count and index (16 bits) number the pieces, and total (32
+ * bits) is the frame's length; every piece but the last is FragmentBytes
+ * - FragmentHeader long.  1200 bytes fits the smallest MTU of IPv6, and
+ * any Ethernet path, so the IP layer never splits a datagram -- where one
+ * lost IP fragment would lose all of it.  The receiver keeps pieces
+ * across retransmissions, within Reassemblies frames and ReassemblyLimit
+ * bytes, and drops a frame that has not grown for ReassemblyNanos.
+ */
+#define FragmentBytes 1200
+#define FragmentHeader 14
+#define Reassemblies 16   // frames being put back together at once
+static const size_t ReassemblyLimit = 16 << 20;          // bytes, all frames
+static const uint64_t ReassemblyNanos = 5000000000ull;  // 5s
+static const int ReceiveBuffer = 1 << 20;  // ask for this much socket buffer
+
+/* Peers on this host may be reached through shared memory instead of
+ * UDP (see message_attachLocal and shm.h).
+ */
+#define MaxLocal 32       // such peers at once
+
+/**************** file-local types ****************/
+typedef struct pending {
+  unsigned char* frame;   // NULL if the slot is free
+  size_t length;
+  uint32_t id;            // names its pieces, if it is fragmented
+  uint32_t seq;
+  uint64_t due;           // when to send it again
+  uint64_t wait;          // current interval between sends
+  int tries;
+} pending_t;
+
+typedef struct peer {
+  struct peer* next;      // in its hash chain
+  addr_t addr;
+  // sending to the peer
+  uint32_t nextSeq;                        // reliable messages sent so far
+  uint32_t firstSeq;                       // oldest not yet acknowledged
+  pending_t sent[Window];                  // unacknowledged, by seq % Window
+  uint32_t latestSeq[message_Channels];    // latest messages sent so far
+  pending_t latest[message_Channels];      // unacknowledged, per channel
+  // receiving from the peer
+  uint32_t expectSeq;                      // next reliable message to deliver
+  char* held[Hold];                        // arrived early, by seq % Hold
+  size_t heldLength[Hold];
+  uint32_t heldSeq[Hold];
+  uint32_t deliveredLatest[message_Channels];
+  // keeping the state
+  uint64_t lastHeard;                      // when a frame last came from it
+  uint64_t lastSent;                       // when we last sent it a message
+  bool accepted;                           // message_acceptReliable
+  bool released;                           // message_release
+} peer_t;
+
+typedef struct local {
+  addr_t addr;
+  shm_peer_t* shm;        // NULL if the slot is free
+} local_t;
+
+typedef struct reassembly {
+  unsigned char* frame;   // NULL if the slot is free
+  bool* have;             // which pieces have arrived
+  addr_t from;
+  uint32_t id;
+  uint32_t length;
+  int count;
+  int got;
+  uint64_t lastHeard;
+} reassembly_t;
+
 /**************** file-local global variables ****************/
 /* This is an example of a judicious use of a global variable.
  * This module provides init() and done() functions that allow it
@@ -47,6 +147,71 @@ static const int MaxPort = 65535;
  * but a more flexible approach would require a much more complex interface.
  */
 static int ourSocket = 0;     // socket on which to receive messages
+static uring_t* ourUring = NULL;  // io_uring on that socket; NULL if none
+static size_t lastLength = 0; // length of the message being handled
+static peer_t* peers[PeerBuckets];  // reliable-delivery state, by peerHash
+static int numPeers = 0;        // at most maxPeers
+static int maxPeers = message_MaxPeers;   // see message_setMaxPeers
+static uint64_t nextReclaim = 0;  // no look for idle peers before this
+static uint64_t nextRetry = 0;  // no resend is due before this; 0 if none
+static uint32_t nextFrameId = 0;  // for pending_t.id
+static reassembly_t reassemblies[Reassemblies];
+static size_t reassemblyBytes = 0;  // allocated for all of them
+static int localListener = -1;      // where local peers connect; -1 if none
+static local_t locals[MaxLocal];    // peers reached through shared memory
+static int numLocals = 0;
+
+/**************** file-local functions ****************/
+static peer_t* findPeer(const addr_t addr, const bool create);
+static void dropPeer(peer_t* peer);
+static void clearPeer(peer_t* peer);
+static bool hasPending(const peer_t* peer);
+static void reclaimPeers(const uint64_t now);
+static int peerHash(const addr_t addr);
+static uint32_t oldestPending(peer_t* peer);
+static void transmit(peer_t* peer, pending_t* p);
+static void transmitPieces(const addr_t to, const pending_t* p);
+static void retransmitDue(void);
+static void sendAck(const addr_t to, const char kind, const int channel,
+                    const uint32_t seq);
+static bool receiveFrame(void* arg, const addr_t from, char* buf, const int nbytes,
+                         bool (*handleMessage)(void* arg,
+                                               const addr_t from, const char* buf));
+static bool receivePiece(void* arg, const addr_t from,
+                         const unsigned char* piece, const int nbytes,
+                         bool (*handleMessage)(void* arg,
+                                               const addr_t from, const char* buf));
+static void clearReassembly(reassembly_t* r);
+static bool skipPast(void* arg, const addr_t from, peer_t* peer, const uint32_t first,
+                     bool (*handleMessage)(void* arg,
+                                           const addr_t from, const char* buf));
+static bool deliverHeld(void* arg, const addr_t from, peer_t* peer,
+                        bool (*handleMessage)(void* arg,
+                                              const addr_t from, const char* buf));
+static bool deliver(void* arg, const addr_t from, const char* message,
+                    const size_t length,
+                    bool (*handleMessage)(void* arg,
+                                          const addr_t from, const char* buf));
+static ssize_t sendDatagram(const addr_t to, const void* bytes, const size_t length);
+static bool receiveDatagram(void* arg, const addr_t from, char* buf, const int nbytes,
+                            bool (*handleMessage)(void* arg, const addr_t from,
+                                                  const char* message));
+static local_t* findLocal(const addr_t addr);
+static bool addLocal(const addr_t addr, shm_peer_t* shm);
+static void dropLocal(local_t* local);
+static int watchLocals(fd_set* rfds, int nfds);
+static bool localsPending(void);
+static bool receiveUring(void* arg, const bool acksOnly,
+                         bool (*handleMessage)(void* arg, const addr_t from,
+                                               const char* message));
+static int watchSocket(fd_set* rfds, int nfds);
+static bool receiveLocals(void* arg, fd_set* rfds, const bool acksOnly,
+                          bool (*handleMessage)(void* arg, const addr_t from,
+                                                const char* message));
+static void put32(unsigned char* p, const uint32_t value);
+static uint32_t get32(const unsigned char* p);
+static void put16(unsigned char* p, const uint16_t value);
+static uint16_t get16(const unsigned char* p);
 
 /***********************************************************************/
 /**************** message_init ****************/
@@ -95,10 +260,26 @@ message_init(FILE* logFP)
     ourSocket = 0;
     return 0;
   }
+  // room for a burst of fragments; the kernel may grant less, which is
+  // fine, as lost pieces are sent again
+  if (setsockopt(ourSocket, SOL_SOCKET, SO_RCVBUF,
+                 &ReceiveBuffer, sizeof(ReceiveBuffer)) != 0) {
+    log_e("message_init: setting the receive buffer size");
+  }
+
   // extract our port number
   int port = ntohs(self.sin_port);
   log_d("message_init: ready at port '%d'", port);
 
+  // let peers on this host attach through shared memory; without it,
+  // they just use UDP
+  localListener = shm_listen(port);
+
+  // receive and send through io_uring if the kernel has it; otherwise,
+  // or if it turns out not to work, with recvfrom and sendto
+  ourUring = uring_open(ourSocket);
+  log_s("message_init: %s", ourUring != NULL ? "using io_uring" : "using recvfrom/sendto");
+
   return port;
 }
 
@@ -253,8 +434,7 @@ message_send(const addr_t to, const char* message)
     log_v("message_send: called with null message");
     return; // error in usage of this function.
   }
-  if (sendto(ourSocket, message, strlen(message), 0,
-             (struct sockaddr *) &to, sizeof(to)) < 0) {
+  if (sendDatagram(to, message, strlen(message)) < 0) {
     log_e("message_send: error sending to datagram socket");
   } else {
     log_s("message_send: TO %s", message_stringAddr(to));
@@ -263,6 +443,265 @@ message_send(const addr_t to, const char* message)
   }
 }
 
+/**************** message_sendBytes ****************/
+/* 
+ * Send a binary message to the correspondent address.
+ * See message.h for detailed description.
+ */
+void
+message_sendBytes(const addr_t to, const void* bytes, const size_t length)
+{
+  if (ourSocket == 0) {
+    log_v("message_sendBytes: called before message_init");
+    return; // error in usage of this function.
+  }
+  if (bytes == NULL || length > message_MaxBytes) {
+    log_v("message_sendBytes: called with null or oversized message");
+    return; // error in usage of this function.
+  }
+  if (sendDatagram(to, bytes, length) < 0) {
+    log_e("message_sendBytes: error sending to datagram socket");
+  } else {
+    log_s("message_sendBytes: TO %s", message_stringAddr(to));
+    log_d("message_sendBytes: %d bytes", (int)length);
+  }
+}
+
+/**************** message_sendReliable ****************/
+/* 
+ * Send a message with a sequence number, and keep it to send again
+ * until it is acknowledged.
+ * See message.h for detailed description.
+ */
+void
+message_sendReliable(const addr_t to, const void* bytes, const size_t length)
+{
+  const size_t header = ReliableHeader;
+  if (ourSocket == 0 || bytes == NULL || length > message_MaxReliableBytes) {
+    log_v("message_sendReliable: called before message_init, or bad message");
+    return; // error in usage of this function.
+  }
+  peer_t* peer = findPeer(to, true);
+  if (peer == NULL) {
+    message_sendBytes(to, bytes, length);   // once, as it is; logged by findPeer
+    return;
+  }
+  pending_t* p = &peer->sent[peer->nextSeq % Window];
+  if (p->frame != NULL) {
+    // the frames that follow tell the peer not to wait for it
+    log_s("message_sendReliable: too many in flight to %s; abandoning the oldest",
+          message_stringAddr(to));
+    free(p->frame);
+    p->frame = NULL;
+  }
+  p->frame = malloc(length + header);
+  if (p->frame == NULL) {
+    log_v("message_sendReliable: out of memory");
+    return;
+  }
+  p->frame[0] = FrameMark;
+  p->frame[1] = 'R';
+  put32(p->frame + 2, peer->nextSeq);
+  memcpy(p->frame + header, bytes, length);
+  p->length = length + header;
+  p->id = nextFrameId++;
+  p->seq = peer->nextSeq++;
+  p->tries = 0;
+  p->wait = RetryNanos;
+  transmit(peer, p);
+}
+
+/**************** message_sendLatest ****************/
+/* 
+ * Send the newest message on a channel, replacing any earlier one
+ * still waiting for an acknowledgement.
+ * See message.h for detailed description.
+ */
+void
+message_sendLatest(const addr_t to, const int channel,
+                   const void* bytes, const size_t length)
+{
+  const size_t header = LatestHeader;
+  if (ourSocket == 0 || bytes == NULL || length > message_MaxReliableBytes
+      || channel < 0 || channel >= message_Channels) {
+    log_v("message_sendLatest: called before message_init, or bad message");
+    return; // error in usage of this function.
+  }
+  peer_t* peer = findPeer(to, true);
+  if (peer == NULL) {
+    message_sendBytes(to, bytes, length);   // once, as it is; logged by findPeer
+    return;
+  }
+  pending_t* p = &peer->latest[channel];
+  free(p->frame);   // superseded, whether or not it was acknowledged
+  p->frame = malloc(length + header);
+  if (p->frame == NULL) {
+    log_v("message_sendLatest: out of memory");
+    return;
+  }
+  p->seq = ++peer->latestSeq[channel];
+  p->frame[0] = FrameMark;
+  p->frame[1] = 'L';
+  p->frame[2] = channel;
+  put32(p->frame + 3, p->seq);
+  put32(p->frame + 7, peer->nextSeq);
+  memcpy(p->frame + header, bytes, length);
+  p->length = length + header;
+  p->id = nextFrameId++;
+  p->tries = 0;
+  p->wait = RetryNanos;
+  transmit(peer, p);
+}
+
+/**************** message_acceptReliable ****************/
+/* 
+ * See message.h for detailed description.
+ */
+bool
+message_acceptReliable(const addr_t addr)
+{
+  if (ourSocket == 0) {
+    log_v("message_acceptReliable: called before message_init");
+    return false;
+  }
+  peer_t* peer = findPeer(addr, true);
+  if (peer == NULL) {
+    return false; // logged by findPeer
+  }
+  peer->accepted = true;
+  return true;
+}
+
+/**************** message_forget ****************/
+/* 
+ * See message.h for detailed description.
+ */
+void
+message_forget(const addr_t addr)
+{
+  peer_t* peer = findPeer(addr, false);
+  if (peer != NULL) {
+    dropPeer(peer);
+  }
+}
+
+/**************** message_release ****************/
+/* 
+ * See message.h for detailed description.
+ */
+void
+message_release(const addr_t addr)
+{
+  peer_t* peer = findPeer(addr, false);
+  if (peer == NULL) {
+    return;
+  }
+  if (hasPending(peer)) {
+    peer->released = true;  // dropped by reclaimPeers once it has none
+  } else {
+    dropPeer(peer);
+  }
+}
+
+/**************** message_setMaxPeers ****************/
+/* 
+ * See message.h for detailed description.
+ */
+void
+message_setMaxPeers(const int count)
+{
+  maxPeers = (count > 0) ? count : 1;
+}
+
+/**************** message_attachLocal ****************/
+/* 
+ * Connect to a peer on this host through shared memory, if it offers it.
+ * See message.h for detailed description.
+ */
+bool
+message_attachLocal(const addr_t peer)
+{
+  if (ourSocket == 0 || !message_isAddr(peer)
+      || (ntohl(peer.sin_addr.s_addr) >> 24) != 127) {  // not a loopback address
+    return false;
+  }
+  if (findLocal(peer) != NULL) {
+    return true;
+  }
+  struct sockaddr_in self;
+  socklen_t selflen = sizeof(self);
+  if (getsockname(ourSocket, (struct sockaddr *) &self, &selflen)) {
+    log_e("message_attachLocal: getting socket name");
+    return false;
+  }
+  shm_peer_t* shm = shm_connect(ntohs(peer.sin_port), ntohs(self.sin_port));
+  if (shm == NULL) {
+    return false;
+  }
+  log_s("message_attachLocal: %s is reached through shared memory",
+        message_stringAddr(peer));
+  return addLocal(peer, shm);
+}
+
+/**************** message_flush ****************/
+/* 
+ * Receive only acknowledgements, and retransmit, until nothing is
+ * outstanding or the time runs out.
+ * See message.h for detailed description.
+ */
+bool
+message_flush(const float timeout)
+{
+  if (ourSocket == 0) {
+    return true;
+  }
+  uint64_t deadline = histogram_nowNanos() + (uint64_t)(timeout * 1e9);
+  while (true) {
+    retransmitDue();
+    uint64_t now = histogram_nowNanos();
+    if (nextRetry == 0 || now >= deadline) {
+      break;
+    }
+    uint64_t wake = nextRetry < deadline ? nextRetry : deadline;
+    uint64_t nanos = wake > now ? wake - now : 0;
+    struct timeval timer = { nanos / 1000000000, (nanos % 1000000000) / 1000 };
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    int nfds = watchLocals(&rfds, watchSocket(&rfds, 0));
+    if (localsPending()) {
+      timer.tv_sec = timer.tv_usec = 0;
+    }
+    int ready = select(nfds, &rfds, NULL, NULL, &timer);
+    if (ready >= 0) {
+      receiveLocals(NULL, &rfds, true, NULL);
+    }
+    if (ready > 0 && ourUring != NULL && FD_ISSET(uring_fd(ourUring), &rfds)) {
+      receiveUring(NULL, true, NULL);
+    } else if (ready > 0 && ourUring == NULL && FD_ISSET(ourSocket, &rfds)) {
+      struct sockaddr_in sender;
+      socklen_t senderlen = sizeof(sender);
+      char buf[message_MaxBytes];
+      int nbytes = recvfrom(ourSocket, buf, message_MaxBytes-1, 0,
+                            (struct sockaddr *) &sender, &senderlen);
+      if (nbytes >= 2 && (unsigned char)buf[0] == FrameMark && buf[1] == 'A') {
+        buf[nbytes] = '\0';
+        receiveFrame(NULL, sender, buf, nbytes, NULL);
+      }
+    }
+  }
+  return nextRetry == 0;
+}
+
+/**************** message_length ****************/
+/* 
+ * See message.h for detailed description.
+ */
+size_t
+message_length(void)
+{
+  return lastLength;
+}
+
 /**************** message_loop ****************/
 /* 
  * Loop forever, calling handler functions for stdin or socket,
@@ -297,14 +736,12 @@ message_loop(void* arg, const float timeout,
     return false; // error in usage of this function.
   }
 
-  // set up for timeouts, if desired
-  struct timeval* timerp = NULL; // stays null if no timeout desired
-  struct timeval  timer;          // timerp = &timer if timeout desired
-  struct timeval  timeoutval;     // timeval equivalent of parameter 'timeout'
-  if (timeout > 0.0) {
-    timeoutval.tv_sec  = (int)timeout;
-    timeoutval.tv_usec = timeout - (int)timeout;
-  }
+  // set up for timeouts, if desired; select() also wakes up whenever a
+  // reliable message is due to be sent again
+  struct timeval* timerp = NULL; // stays null if no wakeup is needed
+  struct timeval  timer;          // timerp = &timer otherwise
+  uint64_t timeoutNanos = (uint64_t)(timeout * 1e9);
+  uint64_t lastActivity = histogram_nowNanos(); // last input or message
 
   // loop until error or some handler indicates time to quit looping
   while (true) {
@@ -319,16 +756,35 @@ message_loop(void* arg, const float timeout,
       nfds = 1;
     }
     if (handleMessage != NULL && ourSocket != 0) {
-      FD_SET(ourSocket, &rfds); // monitor the socket
-      nfds = ourSocket+1;       // highest-numbered fd in rfds
+      nfds = watchSocket(&rfds, nfds);  // monitor the socket (or io_uring)
+      nfds = watchLocals(&rfds, nfds);  // and the shared-memory peers
     }
+    uint64_t wake = 0;        // when select must return; 0 for never
     if (timeout > 0.0) {      // is timeout desired?
-      timer = timeoutval;     // set the timer to the timeout value
+      wake = lastActivity + timeoutNanos;
+    }
+    if (nextRetry != 0 && (wake == 0 || nextRetry < wake)) {
+      wake = nextRetry;
+    }
+    bool localWaiting = (handleMessage != NULL && localsPending());
+    if (localWaiting) {
+      wake = histogram_nowNanos();  // a ring already holds something
+    }
+    if (wake != 0) {
+      uint64_t now = histogram_nowNanos();
+      uint64_t nanos = wake > now ? wake - now : 0;
+      timer.tv_sec = nanos / 1000000000;
+      timer.tv_usec = (nanos % 1000000000) / 1000;
       timerp = &timer;        // pass that timer to select
     } else {
       timerp = NULL;          // no timeout is desired
     }
 
+    // hand what was sent since the last time around to io_uring, at once
+    if (ourUring != NULL) {
+      uring_submit(ourUring);
+    }
+
     // Wait for input on either source
     int select_response = select(nfds, &rfds, NULL, NULL, timerp);
     // note: 'rfds' updated
@@ -343,14 +799,20 @@ message_loop(void* arg, const float timeout,
 	log_e("message_loop: select()");
 	return false; // error
       }
-    } else if (select_response == 0) {
-      // timeout occurred
-      log_v("message_loop: select() timed out");
-      if (handleTimeout != NULL && (*handleTimeout)(arg)) {
-        break; // handler says to exit loop 
+    } else if (select_response == 0 && !localWaiting) {
+      // timeout occurred: a resend is due, or we have been idle long enough
+      retransmitDue();
+      if (timeout > 0.0 && histogram_nowNanos() - lastActivity >= timeoutNanos) {
+        log_v("message_loop: select() timed out");
+        lastActivity = histogram_nowNanos();
+        if (handleTimeout != NULL && (*handleTimeout)(arg)) {
+          break; // handler says to exit loop 
+        }
       }
     } else if (select_response > 0) {
       // some data is ready on either source, or both
+      lastActivity = histogram_nowNanos();
+      retransmitDue();
 
       if (FD_ISSET(0, &rfds)) {
         // stdin has input ready
@@ -359,7 +821,13 @@ message_loop(void* arg, const float timeout,
           break; // handler says to exit loop 
         }
       }
-      if (FD_ISSET(ourSocket, &rfds)) {
+      if (ourUring != NULL && FD_ISSET(uring_fd(ourUring), &rfds)) {
+        // datagrams have arrived through io_uring
+        if (receiveUring(arg, false, handleMessage)) {
+          break; // handler says to exit loop
+        }
+      }
+      else if (ourUring == NULL && FD_ISSET(ourSocket, &rfds)) {
         // socket has input ready
         log_v("message_loop: message ready on socket");
         struct sockaddr_in sender;     // sender of this message
@@ -371,30 +839,43 @@ message_loop(void* arg, const float timeout,
         if (nbytes < 0) {
           // error, ignore it
           log_e("message_loop: receiving from socket");
-        } else {
-          buf[nbytes] = '\0';     // null terminate message string
-          // where was it from?
-          if (sender.sin_family != AF_INET) {
-            // ignore it
-            log_d("message_loop: non-Internet family %d\n", sender.sin_family);
-          } else {
-	    // record it
-	    log_s("message_loop: FROM %s", message_stringAddr(sender));
-	    log_d("message_loop: %d lines:", numLines(buf));
-	    log_s("%s", buf);
-
-            // handle it
-            if (handleMessage != NULL && (*handleMessage)(arg, sender, buf)) {
-              break; // handler says to exit loop 
-            }
-          }
+        } else if (sender.sin_family != AF_INET) {
+          // ignore it
+          log_d("message_loop: non-Internet family %d\n", sender.sin_family);
+        } else if (receiveDatagram(arg, sender, buf, nbytes, handleMessage)) {
+          break; // handler says to exit loop
         }
       }
+      if (handleMessage != NULL
+          && receiveLocals(arg, &rfds, false, handleMessage)) {
+        break; // handler says to exit loop
+      }
     }
   }
   return true;
 }
 
+/**************** message_pending ****************/
+/* 
+ * Poll the socket, without waiting, for a message not yet received.
+ * See message.h for detailed description.
+ */
+bool
+message_pending(void)
+{
+  if (ourSocket == 0) {
+    return false;
+  }
+  fd_set rfds;
+  FD_ZERO(&rfds);
+  FD_SET(ourSocket, &rfds);
+  struct timeval now = {0, 0};   // poll: do not wait
+  if (ourUring != NULL) {
+    return localsPending() || uring_pending(ourUring);
+  }
+  return localsPending() || select(ourSocket+1, &rfds, NULL, NULL, &now) > 0;
+}
+
 /**************** message_done ****************/
 /* 
  * Clean up the message module, prior to exit.
@@ -403,13 +884,899 @@ message_loop(void* arg, const float timeout,
 void
 message_done(void)
 {
+  uring_close(ourUring);  // sends what is queued
+  ourUring = NULL;
   if (ourSocket != 0) {
     close(ourSocket);
     ourSocket = 0;
   }
+  if (localListener >= 0) {
+    close(localListener);
+    localListener = -1;
+  }
+  for (int i = 0; i < MaxLocal; i++) {
+    dropLocal(&locals[i]);
+  }
+  for (int i = 0; i < PeerBuckets; i++) {
+    while (peers[i] != NULL) {
+      dropPeer(peers[i]);
+    }
+  }
+  for (int i = 0; i < Reassemblies; i++) {
+    clearReassembly(&reassemblies[i]);
+  }
+  nextRetry = 0;
+  nextReclaim = 0;
   log_v("message_done: message module closing down.");
 }
 
+/**************** findPeer ****************/
+/* 
+ * Return the reliable-delivery state for an address.  If there is none,
+ * and 'create', start it, unless maxPeers already have some even after
+ * reclaiming those done with; otherwise return NULL.  A peer still in use
+ * is never dropped to make room: its sequence numbers would start again
+ * from 0 while the other side still expected later ones.
+ */
+static peer_t*
+findPeer(const addr_t addr, const bool create)
+{
+  const int bucket = peerHash(addr);
+  for (peer_t* peer = peers[bucket]; peer != NULL; peer = peer->next) {
+    if (message_eqAddr(peer->addr, addr)) {
+      return peer;
+    }
+  }
+  if (!create) {
+    return NULL;
+  }
+  const uint64_t now = histogram_nowNanos();
+  if (numPeers >= maxPeers) {
+    reclaimPeers(now);
+  }
+  if (numPeers >= maxPeers) {
+    log_s("message_loop: too many peers; nothing kept for resending to %s",
+          message_stringAddr(addr));
+    return NULL;
+  }
+  peer_t* peer = calloc(1, sizeof(peer_t));
+  if (peer == NULL) {
+    log_v("message_loop: out of memory for a new peer");
+    return NULL;
+  }
+  peer->addr = addr;
+  peer->lastHeard = now;
+  peer->lastSent = now;
+  peer->next = peers[bucket];
+  peers[bucket] = peer;
+  numPeers++;
+  return peer;
+}
+
+/**************** dropPeer ****************/
+/* 
+ * Take a peer out of the table and free it.
+ */
+static void
+dropPeer(peer_t* peer)
+{
+  peer_t** link = &peers[peerHash(peer->addr)];
+  while (*link != peer) {
+    link = &(*link)->next;
+  }
+  *link = peer->next;
+  clearPeer(peer);
+  free(peer);
+  numPeers--;
+}
+
+/**************** peerHash ****************/
+/* 
+ * Pick the hash chain for an address.
+ */
+static int
+peerHash(const addr_t addr)
+{
+  uint32_t h = ntohl(addr.sin_addr.s_addr) * 2654435761u ^ ntohs(addr.sin_port);
+  return (h ^ (h >> 16)) % PeerBuckets;
+}
+
+/**************** clearPeer ****************/
+/* 
+ * Free the frames and messages a peer entry holds.
+ */
+static void
+clearPeer(peer_t* peer)
+{
+  for (int i = 0; i < Window; i++) {
+    free(peer->sent[i].frame);
+  }
+  for (int i = 0; i < message_Channels; i++) {
+    free(peer->latest[i].frame);
+  }
+  for (int i = 0; i < Hold; i++) {
+    free(peer->held[i]);
+  }
+}
+
+/**************** hasPending ****************/
+/* 
+ * True if any message to the peer still waits for its acknowledgement.
+ */
+static bool
+hasPending(const peer_t* peer)
+{
+  for (int i = 0; i < Window; i++) {
+    if (peer->sent[i].frame != NULL) {
+      return true;
+    }
+  }
+  for (int i = 0; i < message_Channels; i++) {
+    if (peer->latest[i].frame != NULL) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**************** reclaimPeers ****************/
+/* 
+ * Drop every peer with nothing pending that was released, or has gone
+ * idle: nothing heard from it for PeerIdleNanos, and nothing sent to it
+ * for twice that.  The other side, hearing nothing from us, has then
+ * forgotten us first, so our sequence numbers can start again from 0.  An
+ * accepted peer is not dropped but started afresh, so its frames are
+ * still taken.
+ */
+static void
+reclaimPeers(const uint64_t now)
+{
+  nextReclaim = now + ReclaimNanos;
+  for (int i = 0; i < PeerBuckets; i++) {
+    peer_t* peer = peers[i];
+    while (peer != NULL) {
+      peer_t* next = peer->next;
+      bool idle = now - peer->lastHeard >= PeerIdleNanos
+                  && now - peer->lastSent >= 2 * PeerIdleNanos;
+      if ((peer->released || idle) && !hasPending(peer)) {
+        if (peer->accepted && !peer->released) {
+          const addr_t addr = peer->addr;
+          clearPeer(peer);
+          memset(peer, 0, sizeof(peer_t));
+          peer->next = next;
+          peer->addr = addr;
+          peer->lastHeard = now;
+          peer->lastSent = now;
+          peer->accepted = true;
+        } else {
+          dropPeer(peer);
+        }
+      }
+      peer = next;
+    }
+  }
+}
+
+/**************** oldestPending ****************/
+/* 
+ * Return the sequence number of the oldest reliable message still waiting
+ * for the peer's acknowledgement, or nextSeq if there is none.
+ */
+static uint32_t
+oldestPending(peer_t* peer)
+{
+  while (peer->firstSeq != peer->nextSeq) {
+    const pending_t* p = &peer->sent[peer->firstSeq % Window];
+    if (p->frame != NULL && p->seq == peer->firstSeq) {
+      break;
+    }
+    peer->firstSeq++;   // acknowledged, or given up on
+  }
+  return peer->firstSeq;
+}
+
+/**************** transmit ****************/
+/* 
+ * Send (or send again) a pending frame, and schedule the next send.
+ * The frame's 'first' is brought up to date each time, so a peer left
+ * waiting for a message we gave up on learns to skip it.
+ */
+static void
+transmit(peer_t* peer, pending_t* p)
+{
+  const addr_t to = peer->addr;
+  put32(p->frame + (p->frame[1] == 'R' ? 6 : 11), oldestPending(peer));
+  if (p->tries > 0) {
+    log_s("message_loop: resending to %s", message_stringAddr(to));
+  }
+  if (p->length > FragmentBytes) {
+    transmitPieces(to, p);
+  } else if (sendDatagram(to, p->frame, p->length) < 0) {
+    log_e("message_send: error sending to datagram socket");
+  }
+  p->tries++;
+  peer->lastSent = histogram_nowNanos();
+  p->due = peer->lastSent + p->wait;
+  p->wait = (p->wait * 2 < MaxRetryNanos) ? p->wait * 2 : MaxRetryNanos;
+  if (nextRetry == 0 || p->due < nextRetry) {
+    nextRetry = p->due;
+  }
+}
+
+/**************** transmitPieces ****************/
+/* 
+ * Send a pending frame too long for one datagram as a series of pieces.
+ */
+static void
+transmitPieces(const addr_t to, const pending_t* p)
+{
+  const size_t size = FragmentBytes - FragmentHeader;
+  const int count = (p->length + size - 1) / size;
+  unsigned char datagram[FragmentBytes];
+  datagram[0] = FrameMark;
+  datagram[1] = 'F';
+  put32(datagram + 2, p->id);
+  put16(datagram + 6, count);
+  put32(datagram + 10, p->length);
+  for (int index = 0; index < count; index++) {
+    size_t offset = index * size;
+    size_t length = (p->length - offset < size) ? p->length - offset : size;
+    put16(datagram + 8, index);
+    memcpy(datagram + FragmentHeader, p->frame + offset, length);
+    if (sendDatagram(to, datagram, FragmentHeader + length) < 0) {
+      log_e("message_send: error sending to datagram socket");
+    }
+  }
+}
+
+/**************** retransmitDue ****************/
+/* 
+ * Send again every unacknowledged frame whose time has come, giving up on
+ * those tried MaxTries times, and work out when the next one is due.
+ * Every ReclaimNanos or so, drop the peers done with, too.
+ */
+static void
+retransmitDue(void)
+{
+  uint64_t now = histogram_nowNanos();
+  if (now >= nextReclaim) {
+    reclaimPeers(now);
+  }
+  if (nextRetry == 0 || now < nextRetry) {
+    return;
+  }
+  nextRetry = 0;
+  for (int i = 0; i < PeerBuckets; i++) {
+    for (peer_t* peer = peers[i]; peer != NULL; peer = peer->next) {
+      for (int k = 0; k < Window + message_Channels; k++) {
+        pending_t* p = (k < Window) ? &peer->sent[k] : &peer->latest[k - Window];
+        if (p->frame == NULL) {
+          continue;
+        }
+        if (p->due <= now) {
+          if (p->tries >= MaxTries) {
+            log_s("message_loop: giving up on a message to %s",
+                  message_stringAddr(peer->addr));
+            free(p->frame);
+            p->frame = NULL;
+            continue;
+          }
+          transmit(peer, p);
+        }
+        else if (nextRetry == 0 || p->due < nextRetry) {
+          nextRetry = p->due;
+        }
+      }
+    }
+  }
+}
+
+/**************** sendAck ****************/
+/* 
+ * Acknowledge a reliable ('R') or latest ('L') frame.
+ */
+static void
+sendAck(const addr_t to, const char kind, const int channel, const uint32_t seq)
+{
+  unsigned char ack[8] = { FrameMark, 'A', kind, channel };
+  put32(ack + 4, seq);
+  if (sendDatagram(to, ack, sizeof(ack)) < 0) {
+    log_e("message_loop: error sending acknowledgement");
+  }
+}
+
+/**************** receiveFrame ****************/
+/* 
+ * Handle a reliable-delivery frame of nbytes in buf (NUL-terminated):
+ * note an acknowledgement, or acknowledge a message and deliver, in order,
+ * whatever is now due.  Returns true if handleMessage said to stop.
+ */
+static bool
+receiveFrame(void* arg, const addr_t from, char* buf, const int nbytes,
+             bool (*handleMessage)(void* arg, const addr_t from, const char* buf))
+{
+  const unsigned char* frame = (const unsigned char*) buf;
+  if (frame[1] == 'F') {
+    return receivePiece(arg, from, frame, nbytes, handleMessage);
+  }
+  // only peers we send to, or have accepted, are kept track of: a frame
+  // from anyone else must not take up room in the table
+  peer_t* peer = findPeer(from, false);
+  if (peer == NULL) {
+    log_s("message_loop: reliable-delivery frame from unknown peer %s",
+          message_stringAddr(from));
+    return false;
+  }
+  peer->lastHeard = histogram_nowNanos();
+
+  if (frame[1] == 'A' && nbytes >= 8) {
+    uint32_t seq = get32(frame + 4);
+    pending_t* p = NULL;
+    if (frame[2] == 'R') {
+      p = &peer->sent[seq % Window];
+    } else if (frame[2] == 'L' && frame[3] < message_Channels) {
+      p = &peer->latest[frame[3]];
+    }
+    if (p != NULL && p->frame != NULL && p->seq == seq) {
+      free(p->frame);
+      p->frame = NULL;
+    }
+    return false;
+  }
+
+  if (frame[1] == 'R' && nbytes >= ReliableHeader) {
+    uint32_t seq = get32(frame + 2);
+    if (skipPast(arg, from, peer, get32(frame + 6), handleMessage)) {
+      return true;
+    }
+    int32_t ahead = (int32_t)(seq - peer->expectSeq);
+    if (ahead >= Hold) {
+      return false; // too far ahead to hold; it will be sent again
+    }
+    sendAck(from, 'R', 0, seq);
+    if (ahead < 0) {
+      return false; // a duplicate
+    }
+    if (ahead > 0) {
+      int slot = seq % Hold;
+      if (peer->held[slot] == NULL
+          || (int32_t)(peer->heldSeq[slot] - peer->expectSeq) < 0) {
+        free(peer->held[slot]);   // empty, or left from an earlier round
+        peer->held[slot] = malloc(nbytes - ReliableHeader + 1);
+        if (peer->held[slot] != NULL) {
+          memcpy(peer->held[slot], buf + ReliableHeader, nbytes - ReliableHeader + 1);
+          peer->heldLength[slot] = nbytes - ReliableHeader;
+          peer->heldSeq[slot] = seq;
+        }
+      }
+      return false;
+    }
+
+    // the one we were waiting for, then any held ones that follow it
+    peer->expectSeq++;
+    if (deliver(arg, from, buf + ReliableHeader, nbytes - ReliableHeader,
+                handleMessage)) {
+      return true;
+    }
+    return deliverHeld(arg, from, peer, handleMessage);
+  }
+
+  if (frame[1] == 'L' && nbytes >= LatestHeader && frame[2] < message_Channels) {
+    int channel = frame[2];
+    uint32_t seq = get32(frame + 3);
+    uint32_t after = get32(frame + 7);
+    if (skipPast(arg, from, peer, get32(frame + 11), handleMessage)) {
+      return true;
+    }
+    if ((int32_t)(peer->expectSeq - after) < 0) {
+      return false; // a reliable message it depends on is missing
+    }
+    sendAck(from, 'L', channel, seq);
+    if ((int32_t)(seq - peer->deliveredLatest[channel]) <= 0) {
+      return false; // superseded by one already delivered
+    }
+    peer->deliveredLatest[channel] = seq;
+    return deliver(arg, from, buf + LatestHeader, nbytes - LatestHeader,
+                   handleMessage);
+  }
+
+  log_v("message_loop: malformed reliable-delivery frame");
+  return false;
+}
+
+/**************** receivePiece ****************/
+/* 
+ * Handle one piece of a fragmented frame: store it, and once every piece
+ * is in, handle the frame as receiveFrame would if it had come whole.
+ * Incomplete frames are dropped when they go quiet for ReassemblyNanos,
+ * or, oldest first, to make room within Reassemblies and ReassemblyLimit.
+ * Returns true if handleMessage said to stop.
+ */
+static bool
+receivePiece(void* arg, const addr_t from, const unsigned char* piece,
+             const int nbytes,
+             bool (*handleMessage)(void* arg, const addr_t from, const char* buf))
+{
+  const size_t size = FragmentBytes - FragmentHeader;
+  if (nbytes <= FragmentHeader) {
+    log_v("message_loop: malformed fragment");
+    return false;
+  }
+  uint32_t id = get32(piece + 2);
+  int count = get16(piece + 6);
+  int index = get16(piece + 8);
+  uint32_t length = get32(piece + 10);
+  size_t offset = (size_t)index * size;
+  if (length <= FragmentBytes || length > message_MaxReliableBytes + LatestHeader
+      || count != (length + size - 1) / size || index >= count
+      || nbytes - FragmentHeader != ((length - offset < size) ? length - offset : size)) {
+    log_v("message_loop: malformed fragment");
+    return false;
+  }
+  if (findPeer(from, false) == NULL) {
+    return false;   // receiveFrame would not take the whole frame either
+  }
+
+  // find the frame it belongs to, dropping any that have gone quiet
+  uint64_t now = histogram_nowNanos();
+  reassembly_t* r = NULL;
+  reassembly_t* unused = NULL;
+  reassembly_t* oldest = NULL;
+  for (int i = 0; i < Reassemblies; i++) {
+    reassembly_t* slot = &reassemblies[i];
+    if (slot->frame != NULL && now - slot->lastHeard > ReassemblyNanos) {
+      log_s("message_loop: dropping an incomplete message from %s",
+            message_stringAddr(slot->from));
+      clearReassembly(slot);
+    }
+    if (slot->frame == NULL) {
+      if (unused == NULL) {
+        unused = slot;
+      }
+    } else if (slot->id == id && message_eqAddr(slot->from, from)) {
+      r = slot;
+    } else if (oldest == NULL || slot->lastHeard < oldest->lastHeard) {
+      oldest = slot;
+    }
+  }
+  if (r != NULL && (r->length != length || r->count != count)) {
+    return false; // a stale id, reused
+  }
+
+  if (r == NULL) {
+    // start a new frame, making room for it if need be
+    r = (unused != NULL) ? unused : oldest;
+    clearReassembly(r);
+    while (reassemblyBytes + length > ReassemblyLimit) {
+      oldest = NULL;
+      for (int i = 0; i < Reassemblies; i++) {
+        reassembly_t* slot = &reassemblies[i];
+        if (slot->frame != NULL
+            && (oldest == NULL || slot->lastHeard < oldest->lastHeard)) {
+          oldest = slot;
+        }
+      }
+      clearReassembly(oldest);
+    }
+    r->frame = malloc(length + 1);
+    r->have = calloc(count, sizeof(bool));
+    if (r->frame == NULL || r->have == NULL) {
+      log_v("message_loop: out of memory for a fragmented message");
+      clearReassembly(r);
+      return false;
+    }
+    reassemblyBytes += length;
+    r->from = from;
+    r->id = id;
+    r->length = length;
+    r->count = count;
+  }
+  r->lastHeard = now;
+  if (!r->have[index]) {
+    r->have[index] = true;
+    r->got++;
+    memcpy(r->frame + offset, piece + FragmentHeader, nbytes - FragmentHeader);
+  }
+  if (r->got < r->count) {
+    return false;
+  }
+
+  // complete: handle it, unless it is another piece or not a frame at all
+  unsigned char* frame = r->frame;
+  r->frame = NULL;
+  clearReassembly(r);
+  reassemblyBytes -= length;
+  frame[length] = '\0';
+  bool stop = false;
+  if (frame[0] == FrameMark && (frame[1] == 'R' || frame[1] == 'L')) {
+    stop = receiveFrame(arg, from, (char*)frame, length, handleMessage);
+  } else {
+    log_v("message_loop: malformed fragmented message");
+  }
+  free(frame);
+  return stop;
+}
+
+/**************** skipPast ****************/
+/* 
+ * The peer says it no longer has any reliable message before 'first':
+ * each was acknowledged, and so delivered or held here, or given up on.
+ * Deliver the held ones, in order, and stop waiting for the rest.
+ * Returns true if handleMessage said to stop.
+ */
+static bool
+skipPast(void* arg, const addr_t from, peer_t* peer, const uint32_t first,
+         bool (*handleMessage)(void* arg, const addr_t from, const char* buf))
+{
+  int32_t gap = (int32_t)(first - peer->expectSeq);
+  if (gap <= 0) {
+    return false;
+  }
+  log_s("message_loop: %s gave up on a message; skipping it",
+        message_stringAddr(from));
+  for (int32_t k = 0; k < gap && k < Hold; k++) {
+    uint32_t seq = peer->expectSeq + k;
+    int slot = seq % Hold;
+    if (peer->held[slot] != NULL && peer->heldSeq[slot] == seq) {
+      char* message = peer->held[slot];
+      peer->held[slot] = NULL;
+      bool stop = deliver(arg, from, message, peer->heldLength[slot], handleMessage);
+      free(message);
+      if (stop) {
+        peer->expectSeq = seq + 1;  // the rest are skipped next time
+        return true;
+      }
+    }
+  }
+  peer->expectSeq = first;
+  return deliverHeld(arg, from, peer, handleMessage);
+}
+
+/**************** deliverHeld ****************/
+/* 
+ * Deliver, in order, the held reliable messages that are now due.
+ * Returns true if handleMessage said to stop.
+ */
+static bool
+deliverHeld(void* arg, const addr_t from, peer_t* peer,
+            bool (*handleMessage)(void* arg, const addr_t from, const char* buf))
+{
+  int slot = peer->expectSeq % Hold;
+  while (peer->held[slot] != NULL && peer->heldSeq[slot] == peer->expectSeq) {
+    char* message = peer->held[slot];
+    peer->held[slot] = NULL;
+    peer->expectSeq++;
+    bool stop = deliver(arg, from, message, peer->heldLength[slot], handleMessage);
+    free(message);
+    if (stop) {
+      return true;
+    }
+    slot = peer->expectSeq % Hold;
+  }
+  return false;
+}
+
+/**************** clearReassembly ****************/
+/* 
+ * Free a reassembly slot, and mark it unused.
+ */
+static void
+clearReassembly(reassembly_t* r)
+{
+  if (r->frame != NULL) {
+    reassemblyBytes -= r->length;
+  }
+  free(r->frame);
+  free(r->have);
+  memset(r, 0, sizeof(*r));
+}
+
+/**************** deliver ****************/
+/* 
+ * Pass one message to the handler, as message_loop does.
+ */
+static bool
+deliver(void* arg, const addr_t from, const char* message, const size_t length,
+        bool (*handleMessage)(void* arg, const addr_t from, const char* buf))
+{
+  lastLength = length;
+  log_s("message_loop: FROM %s", message_stringAddr(from));
+  log_d("message_loop: %d lines:", numLines(message));
+  log_s("%s", message);
+  return handleMessage != NULL && (*handleMessage)(arg, from, message);
+}
+
+/**************** sendDatagram ****************/
+/* 
+ * Send one datagram, through shared memory if the peer is attached that
+ * way, else on the socket; returns as sendto does.
+ */
+static ssize_t
+sendDatagram(const addr_t to, const void* bytes, const size_t length)
+{
+  local_t* local = findLocal(to);
+  if (local == NULL && ourUring != NULL) {
+    return uring_send(ourUring, &to, bytes, length) ? length : -1;
+  }
+  if (local == NULL) {
+    return sendto(ourSocket, bytes, length, 0,
+                  (struct sockaddr *) &to, sizeof(to));
+  }
+  if (length > message_MaxBytes || !shm_send(local->shm, bytes, length)) {
+    log_v("sendDatagram: no room in the shared-memory ring");
+    return -1;
+  }
+  return length;
+}
+
+/**************** receiveDatagram ****************/
+/* 
+ * Handle one datagram of nbytes in buf, which has room for a '\0' after
+ * it, whichever way it came; returns true if a handler says to stop.
+ */
+static bool
+receiveDatagram(void* arg, const addr_t from, char* buf, const int nbytes,
+                bool (*handleMessage)(void* arg, const addr_t from,
+                                      const char* message))
+{
+  buf[nbytes] = '\0';     // null terminate message string
+  lastLength = nbytes;
+  if (nbytes >= 2 && (unsigned char)buf[0] == FrameMark) {
+    // reliable delivery: acknowledge, and deliver what is due
+    return receiveFrame(arg, from, buf, nbytes, handleMessage);
+  }
+
+  // record it
+  log_s("message_loop: FROM %s", message_stringAddr(from));
+  log_d("message_loop: %d lines:", numLines(buf));
+  log_s("%s", buf);
+
+  // handle it
+  return handleMessage != NULL && (*handleMessage)(arg, from, buf);
+}
+
+/**************** findLocal ****************/
+/* 
+ * Return the shared-memory peer at an address, or NULL if there is none.
+ */
+static local_t*
+findLocal(const addr_t addr)
+{
+  for (int i = 0, seen = 0; seen < numLocals && i < MaxLocal; i++) {
+    if (locals[i].shm != NULL) {
+      seen++;
+      if (message_eqAddr(locals[i].addr, addr)) {
+        return &locals[i];
+      }
+    }
+  }
+  return NULL;
+}
+
+/**************** addLocal ****************/
+/* 
+ * Reach an address through shared memory from now on, replacing any
+ * earlier peer there; false (and the peer closed) if the table is full.
+ */
+static bool
+addLocal(const addr_t addr, shm_peer_t* shm)
+{
+  dropLocal(findLocal(addr));
+  for (int i = 0; i < MaxLocal; i++) {
+    if (locals[i].shm == NULL) {
+      locals[i].addr = addr;
+      locals[i].shm = shm;
+      numLocals++;
+      return true;
+    }
+  }
+  log_v("addLocal: too many shared-memory peers");
+  shm_close(shm);
+  return false;
+}
+
+/**************** dropLocal ****************/
+/* 
+ * Close a shared-memory peer; its address goes back to UDP.
+ */
+static void
+dropLocal(local_t* local)
+{
+  if (local != NULL && local->shm != NULL) {
+    log_s("message_loop: %s detached from shared memory",
+          message_stringAddr(local->addr));
+    shm_close(local->shm);
+    local->shm = NULL;
+    numLocals--;
+  }
+}
+
+/**************** watchLocals ****************/
+/* 
+ * Add the listener and the descriptors of every shared-memory peer to
+ * rfds; returns the new nfds for select().
+ */
+static int
+watchLocals(fd_set* rfds, int nfds)
+{
+  if (localListener >= 0) {
+    FD_SET(localListener, rfds);
+    nfds = (localListener >= nfds) ? localListener + 1 : nfds;
+  }
+  for (int i = 0; i < MaxLocal; i++) {
+    if (locals[i].shm != NULL) {
+      int wake = shm_wakeFd(locals[i].shm);
+      int hangup = shm_hangupFd(locals[i].shm);
+      FD_SET(wake, rfds);
+      FD_SET(hangup, rfds);
+      nfds = (wake >= nfds) ? wake + 1 : nfds;
+      nfds = (hangup >= nfds) ? hangup + 1 : nfds;
+    }
+  }
+  return nfds;
+}
+
+/**************** localsPending ****************/
+/* 
+ * Does any shared-memory peer's ring hold a datagram?
+ */
+static bool
+localsPending(void)
+{
+  for (int i = 0, seen = 0; seen < numLocals && i < MaxLocal; i++) {
+    if (locals[i].shm != NULL) {
+      seen++;
+      if (shm_pending(locals[i].shm)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/**************** receiveLocals ****************/
+/* 
+ * After select() filled in rfds (from watchLocals): accept new peers,
+ * drop those that hung up, and handle every datagram waiting in their
+ * rings -- only acknowledgements, if 'acksOnly'.  Returns true if a
+ * handler says to stop.
+ */
+static bool
+receiveLocals(void* arg, fd_set* rfds, const bool acksOnly,
+              bool (*handleMessage)(void* arg, const addr_t from,
+                                    const char* message))
+{
+  if (localListener >= 0 && FD_ISSET(localListener, rfds)) {
+    int port;
+    shm_peer_t* shm = shm_accept(localListener, &port);
+    if (shm != NULL) {
+      addr_t addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      addr.sin_port = htons(port);
+      log_s("message_loop: %s attached through shared memory",
+            message_stringAddr(addr));
+      addLocal(addr, shm);
+    }
+  }
+  for (int i = 0; i < MaxLocal; i++) {
+    local_t* local = &locals[i];
+    if (local->shm == NULL) {
+      continue;
+    }
+    if (FD_ISSET(shm_wakeFd(local->shm), rfds)) {
+      shm_clearWake(local->shm);
+    }
+    char buf[message_MaxBytes];
+    int nbytes;
+    while (local->shm != NULL
+           && (nbytes = shm_receive(local->shm, buf, message_MaxBytes-1)) >= 0) {
+      if (acksOnly) {
+        if (nbytes >= 2 && (unsigned char)buf[0] == FrameMark && buf[1] == 'A') {
+          buf[nbytes] = '\0';
+          receiveFrame(NULL, local->addr, buf, nbytes, NULL);
+        }
+      } else if (receiveDatagram(arg, local->addr, buf, nbytes, handleMessage)) {
+        return true;
+      }
+    }
+    // the peer has gone once its socket reads as closed
+    if (local->shm != NULL && FD_ISSET(shm_hangupFd(local->shm), rfds)) {
+      dropLocal(local);
+    }
+  }
+  return false;
+}
+
+/**************** watchSocket ****************/
+/* 
+ * Add to rfds what shows that datagrams have arrived: the io_uring, or
+ * else the socket; returns the new nfds for select().
+ */
+static int
+watchSocket(fd_set* rfds, int nfds)
+{
+  int fd = (ourUring != NULL) ? uring_fd(ourUring) : ourSocket;
+  FD_SET(fd, rfds);
+  return (fd >= nfds) ? fd + 1 : nfds;
+}
+
+/**************** receiveUring ****************/
+/* 
+ * Handle every datagram io_uring has received -- only acknowledgements,
+ * if 'acksOnly'.  If receiving that way turns out not to work, go back
+ * to recvfrom and sendto.  Returns true if a handler says to stop.
+ */
+static bool
+receiveUring(void* arg, const bool acksOnly,
+             bool (*handleMessage)(void* arg, const addr_t from,
+                                   const char* message))
+{
+  struct sockaddr_in sender;
+  char* buf;
+  int nbytes;
+  while ((nbytes = uring_receive(ourUring, &sender, &buf)) >= 0) {
+    if (sender.sin_family != AF_INET) {
+      log_d("message_loop: non-Internet family %d\n", sender.sin_family);
+    } else if (acksOnly) {
+      if (nbytes >= 2 && (unsigned char)buf[0] == FrameMark && buf[1] == 'A') {
+        buf[nbytes] = '\0';
+        receiveFrame(NULL, sender, buf, nbytes, NULL);
+      }
+    } else {
+      bool stop = receiveDatagram(arg, sender, buf, nbytes, handleMessage);
+      // send what handling it produced now, not after the whole batch
+      uring_submit(ourUring);
+      if (stop) {
+        return true;
+      }
+    }
+  }
+  if (nbytes == -2) {
+    log_v("message_loop: io_uring cannot receive; using recvfrom/sendto");
+    uring_close(ourUring);
+    ourUring = NULL;
+  }
+  return false;
+}
+
+/**************** put32, get32 ****************/
+/* 
+ * Write and read 32-bit big-endian integers.
+ */
+static void
+put32(unsigned char* p, const uint32_t value)
+{
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+static uint32_t
+get32(const unsigned char* p)
+{
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/**************** put16, get16 ****************/
+/* 
+ * Write and read 16-bit big-endian integers.
+ */
+static void
+put16(unsigned char* p, const uint16_t value)
+{
+  p[0] = value >> 8;
+  p[1] = value;
+}
+
+static uint16_t
+get16(const unsigned char* p)
+{
+  return (uint16_t)p[0] << 8 | p[1];
+}
+
 
 /* ****************************************************************** */
 /* ************************* UNIT_TEST ****************************** */
@@ -437,6 +1804,12 @@ message_done(void)
  *   ./messagetest 2>second.log hostName portNumber
  * 
  * ^D (EOF) to exit either side.
+ *
+ * Run as
+ *   ./messagetest -t
+ * instead, it checks the reliable-delivery layer on its own: it feeds
+ * made-up frames and fragments to the receiving side, and fills and
+ * times out the sending side, then prints how many checks failed.
  */
 
 #ifdef UNIT_TEST
@@ -444,6 +1817,7 @@ message_done(void)
 static bool handleTimeout(void* arg);
 static bool handleInput  (void* arg);
 static bool handleMessage(void* arg, const addr_t from, const char* message);
+static int selfTest(const int ourPort);
 
 int
 main(const int argc, char* argv[])
@@ -461,7 +1835,12 @@ main(const int argc, char* argv[])
 
   // check arguments
   const char* program = argv[0];
-  if (argc == 1) {
+  if (argc == 2 && strcmp(argv[1], "-t") == 0) {
+    int failures = selfTest(ourPort);
+    message_done();
+    log_done();
+    return failures;
+  } else if (argc == 1) {
     // in this case (no arguments) we don't yet know our correspondent
     printf("waiting on port %d for contact....\n", ourPort);
     other = message_noAddr(); // no correspondent yet
@@ -579,4 +1958,267 @@ handleMessage(void* arg, const addr_t from, const char* message)
   return false;
 }
 
+/**************** selfTest and its helpers ****************/
+/* Messages the handler has been given, in order.
+ */
+#define MaxRecorded 16
+static char* recorded[MaxRecorded];
+static size_t recordedLength[MaxRecorded];
+static int numRecorded = 0;
+static int failures = 0;
+
+#define CHECK(cond) \
+  do { if (!(cond)) { printf("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+static bool
+recordMessage(void* arg, const addr_t from, const char* message)
+{
+  if (numRecorded < MaxRecorded) {
+    recordedLength[numRecorded] = message_length();
+    recorded[numRecorded] = malloc(message_length() + 1);
+    memcpy(recorded[numRecorded], message, message_length() + 1);
+  }
+  numRecorded++;
+  return false;
+}
+
+/* Build an 'R' (channel ignored) or 'L' frame around a payload of
+ * 'length' bytes; return the frame's length.
+ */
+static size_t
+makeFrame(unsigned char* frame, const char kind, const int channel,
+          const uint32_t seq, const uint32_t after, const uint32_t first,
+          const char* payload, const size_t length)
+{
+  frame[0] = FrameMark;
+  frame[1] = kind;
+  if (kind == 'R') {
+    put32(frame + 2, seq);
+    put32(frame + 6, first);
+    memcpy(frame + ReliableHeader, payload, length);
+    return ReliableHeader + length;
+  }
+  frame[2] = channel;
+  put32(frame + 3, seq);
+  put32(frame + 7, after);
+  put32(frame + 11, first);
+  memcpy(frame + LatestHeader, payload, length);
+  return LatestHeader + length;
+}
+
+/* Hand a whole frame to the receiving side, as message_loop would.
+ */
+static void
+feed(const addr_t from, const unsigned char* frame, const size_t length)
+{
+  char* buf = malloc(length + 1);
+  memcpy(buf, frame, length);
+  buf[length] = '\0';
+  receiveFrame(NULL, from, buf, length, recordMessage);
+  free(buf);
+}
+
+/* Hand the receiving side one piece of a fragmented frame, as
+ * transmitPieces would send it, but with 'total' and 'count' as given.
+ */
+static void
+feedPiece(const addr_t from, const unsigned char* frame, const uint32_t total,
+          const uint32_t id, const int count, const int index, const size_t length)
+{
+  const size_t size = FragmentBytes - FragmentHeader;
+  unsigned char datagram[FragmentBytes + 1];
+  datagram[0] = FrameMark;
+  datagram[1] = 'F';
+  put32(datagram + 2, id);
+  put16(datagram + 6, count);
+  put16(datagram + 8, index);
+  put32(datagram + 10, total);
+  memcpy(datagram + FragmentHeader, frame + index * size, length);
+  receivePiece(NULL, from, datagram, FragmentHeader + length, recordMessage);
+}
+
+static bool
+recordedIs(const int i, const char* message)
+{
+  return i < numRecorded && strcmp(recorded[i], message) == 0;
+}
+
+/* Hand the sending side an acknowledgement of reliable message 'seq'.
+ */
+static void
+feedAck(const addr_t from, const uint32_t seq)
+{
+  unsigned char ack[8] = { FrameMark, 'A', 'R', 0 };
+  put32(ack + 4, seq);
+  feed(from, ack, sizeof(ack));
+}
+
+/**************** selfTest ****************/
+/* Check ordering, skipping past gaps, and reassembly on the receiving
+ * side, abandoning messages on the sending side, and keeping state for
+ * many peers, but only those accepted or sent to, and reclaiming it.
+ * The made-up peer is ourselves, so acknowledgements pile up unread on
+ * our own socket.  Returns the number of failures.
+ */
+static int
+selfTest(const int ourPort)
+{
+  addr_t from;
+  char portString[8];
+  snprintf(portString, sizeof(portString), "%d", ourPort);
+  if (!message_setAddr("127.0.0.1", portString, &from)) {
+    printf("FAIL: cannot form a test address\n");
+    return 1;
+  }
+  unsigned char frame[4 * FragmentBytes];   // room to copy a bad 4th piece from
+  memset(frame, 0, sizeof(frame));
+  size_t length;
+
+  // nothing from a peer not accepted, nor any state kept for it
+  length = makeFrame(frame, 'R', 0, 0, 0, 0, "stray", 5);
+  feed(from, frame, length);
+  CHECK(numRecorded == 0 && numPeers == 0);
+  CHECK(message_acceptReliable(from) && numPeers == 1);
+
+  // in order, out of order, and past a gap the sender gave up on
+  length = makeFrame(frame, 'R', 0, 1, 0, 0, "one", 3);
+  feed(from, frame, length);
+  CHECK(numRecorded == 0);                 // held until 0 arrives
+  length = makeFrame(frame, 'R', 0, 3, 0, 2, "three", 5);
+  feed(from, frame, length);
+  CHECK(numRecorded == 1 && recordedIs(0, "one"));  // 0 was given up on
+  length = makeFrame(frame, 'L', 0, 1, 4, 2, "view1", 5);
+  feed(from, frame, length);
+  CHECK(numRecorded == 1);                 // waits for 2 and 3
+  length = makeFrame(frame, 'R', 0, 2, 0, 2, "two", 3);
+  feed(from, frame, length);
+  CHECK(numRecorded == 3 && recordedIs(1, "two") && recordedIs(2, "three"));
+  length = makeFrame(frame, 'L', 0, 2, 5, 5, "view2", 5);
+  feed(from, frame, length);
+  CHECK(numRecorded == 4 && recordedIs(3, "view2"));  // 4 was given up on
+  length = makeFrame(frame, 'L', 0, 1, 4, 2, "view1", 5);
+  feed(from, frame, length);
+  CHECK(numRecorded == 4);                 // superseded
+  length = makeFrame(frame, 'R', 0, 5, 0, 0, "five", 4);
+  feed(from, frame, length);
+  length = makeFrame(frame, 'R', 0, 5, 0, 0, "five", 4);
+  feed(from, frame, length);
+  CHECK(numRecorded == 5 && recordedIs(4, "five"));   // once, old 'first'
+
+  // a frame in three pieces, out of order, repeated, and mixed with bad ones
+  const size_t size = FragmentBytes - FragmentHeader;
+  char payload[3000];
+  for (int i = 0; i < sizeof(payload); i++) {
+    payload[i] = 'a' + i % 26;
+  }
+  length = makeFrame(frame, 'R', 0, 6, 0, 6, payload, sizeof(payload));
+  const int count = (length + size - 1) / size;
+  const size_t last = length - (count - 1) * size;
+  CHECK(count == 3);
+  feedPiece(from, frame, length, 7, count, 2, last);
+  feedPiece(from, frame, length, 7, count, 0, size);
+  feedPiece(from, frame, length, 7, count, 2, last);
+  feedPiece(from, frame, length, 7, count, 3, last);         // no such piece
+  feedPiece(from, frame, length, 7, count, 1, size - 1);     // too short
+  feedPiece(from, frame, length, 7, count + 1, 1, size);     // wrong count
+  feedPiece(from, frame, length + 1, 7, count, 1, size);     // reused id
+  feedPiece(from, frame, message_MaxReliableBytes + LatestHeader + 1,
+            8, count, 0, size);                              // too long
+  CHECK(numRecorded == 5);
+  feedPiece(from, frame, length, 7, count, 1, size);
+  CHECK(numRecorded == 6 && recordedLength[5] == sizeof(payload)
+        && memcmp(recorded[5], payload, sizeof(payload)) == 0);
+  for (int index = count - 1; index >= 0; index--) {
+    feedPiece(from, frame, length, 7, count, index, index == count - 1 ? last : size);
+  }
+  CHECK(numRecorded == 6);                 // a retransmission, already delivered
+
+  // sending: one more than the window abandons the oldest, and so does
+  // giving up; either way 'first' moves past it
+  peer_t* peer = findPeer(from, true);
+  CHECK(peer != NULL && oldestPending(peer) == 0);
+  for (int i = 0; i <= Window; i++) {
+    message_sendReliable(from, "x", 1);
+  }
+  CHECK(oldestPending(peer) == 1);
+  CHECK(get32(peer->sent[Window % Window].frame + 6) == 1);  // the newest
+  pending_t* p = &peer->sent[1 % Window];
+  CHECK(p->frame != NULL && p->seq == 1);
+  p->tries = MaxTries;
+  p->due = 0;
+  nextRetry = 1;
+  retransmitDue();
+  CHECK(p->frame == NULL && oldestPending(peer) == 2);
+  message_sendLatest(from, 0, "y", 1);
+  CHECK(get32(peer->latest[0].frame + 7) == Window + 1
+        && get32(peer->latest[0].frame + 11) == 2);
+
+  // far more peers than fit one hash chain each keep their own state,
+  // until forgotten, and no more than the most allowed
+  const int before = numPeers;
+  message_setMaxPeers(before + 300);
+  addr_t others[300];
+  for (int i = 0; i < 300; i++) {
+    snprintf(portString, sizeof(portString), "%d", 20000 + i);
+    CHECK(message_setAddr("127.0.0.1", portString, &others[i]));
+    message_sendReliable(others[i], "z", 1);
+    message_sendReliable(others[i], "z", 1);
+  }
+  CHECK(numPeers == before + 300);
+  bool kept = true;
+  for (int i = 0; i < 300; i++) {
+    peer_t* other = findPeer(others[i], false);
+    kept = kept && other != NULL && other->nextSeq == 2
+           && message_eqAddr(other->addr, others[i]);
+  }
+  CHECK(kept);
+  for (int i = 0; i < 300; i += 2) {
+    message_forget(others[i]);
+  }
+  CHECK(numPeers == before + 150);
+  CHECK(findPeer(others[0], false) == NULL && findPeer(others[1], false) != NULL);
+  message_setMaxPeers(numPeers);
+  addr_t extra;
+  CHECK(message_setAddr("127.0.0.1", "20300", &extra));
+  message_sendReliable(extra, "z", 1);   // sent plainly: all are in use
+  CHECK(numPeers == before + 150 && findPeer(extra, false) == NULL);
+
+  // released, a peer goes once its messages are acknowledged; idle, once
+  // it has none pending, unless it was accepted
+  uint64_t now = histogram_nowNanos();
+  message_release(others[1]);
+  reclaimPeers(now);
+  CHECK(findPeer(others[1], false) != NULL);
+  feedAck(others[1], 0);
+  feedAck(others[1], 1);
+  reclaimPeers(now);
+  CHECK(findPeer(others[1], false) == NULL);
+  for (int i = 3; i <= 5; i += 2) {
+    peer_t* other = findPeer(others[i], false);
+    if (i == 5) {
+      feedAck(others[i], 0);
+      feedAck(others[i], 1);
+    }
+    other->lastHeard = now - PeerIdleNanos;
+    other->lastSent = now - 2 * PeerIdleNanos;
+  }
+  reclaimPeers(now);
+  CHECK(findPeer(others[3], false) != NULL && findPeer(others[5], false) == NULL);
+  message_setMaxPeers(numPeers + 1);
+  CHECK(message_acceptReliable(extra));
+  peer_t* accepted = findPeer(extra, false);
+  accepted->expectSeq = 7;
+  accepted->lastHeard = now - PeerIdleNanos;
+  accepted->lastSent = now - 2 * PeerIdleNanos;
+  reclaimPeers(now);
+  CHECK(findPeer(extra, false) == accepted && accepted->accepted
+        && accepted->expectSeq == 0);
+
+  for (int i = 0; i < numRecorded && i < MaxRecorded; i++) {
+    free(recorded[i]);
+  }
+  printf("messagetest: %d failures\n", failures);
+  return failures;
+}
+
 #endif // UNIT_TEST
@@ -12,6 +12,7 @@
  * Typical client sequence looks like this:
  *   message_init(stderr);
  *   message_setAddr(serverHost, serverPort, &serverAddress);
+ *   message_attachLocal(serverAddress);   // optional: shared memory
  *   message_send(serverAddress, message); // client speaks first
  *   message_loop(arg, timeout, handleTimeout, handleStdin, handleMessage);
  *   message_done();
@@ -50,6 +51,17 @@ typedef struct sockaddr_in addr_t;
 // https://en.wikipedia.org/wiki/User_Datagram_Protocol
 static const int message_MaxBytes = 65507;
 
+// Maximum size for message_sendReliable and message_sendLatest, which split
+// a long message into datagrams small enough to cross any network path
+static const int message_MaxReliableBytes = 4 << 20;
+
+// Number of channels for message_sendLatest, numbered from 0
+enum { message_Channels = 4 };
+
+// Most peers message_sendReliable and message_sendLatest keep state for at
+// once, unless message_setMaxPeers says otherwise
+static const int message_MaxPeers = 64;
+
 /****************** global functions *********************/
 
 /******************************************/
@@ -133,6 +145,159 @@ const char* message_stringAddr(const addr_t addr);
  */
 void message_send(const addr_t to, const char* message);
 
+/******************************************/
+/* message_sendBytes: send a binary message to the given address.
+ * Caller provides:
+ *   a valid address to which to send the message,
+ *   a pointer to the message bytes, which may include '\0',
+ *   the number of bytes (at most message_MaxBytes).
+ * Function returns: none
+ * Assumptions: message_init() has already been called.
+ * Logs:
+ *   errors in arguments,
+ *   errors in sending the message,
+ *   the length (not the content) of the message.
+ */
+void message_sendBytes(const addr_t to, const void* bytes, const size_t length);
+
+/******************************************/
+/* message_sendReliable: send a message that must not be lost.
+ * Caller provides:
+ *   a valid address to which to send the message,
+ *   a pointer to the message bytes (text or binary), and their number
+ *   (at most message_MaxReliableBytes).
+ * Function returns: none
+ * Assumptions:
+ *   message_init() has already been called;
+ *   the receiver also uses this module, so its message_loop() understands
+ *   reliable frames -- an older peer would see them as garbage.
+ * Notes:
+ *   The message goes out with a per-peer sequence number, and is sent
+ *   again, at growing intervals, until the peer acknowledges it (or gives
+ *   up after about 10 seconds).  The receiving message_loop() acknowledges
+ *   it and passes it to handleMessage exactly once, and in the order sent
+ *   among the reliable messages to that peer.  Retransmissions happen
+ *   inside message_loop() and message_flush().
+ *   The state for a peer is kept until message_forget() or
+ *   message_release(), or until nothing has passed either way for a
+ *   minute or so; it is kept for at most message_MaxPeers peers at once
+ *   (see message_setMaxPeers).  Past that, the message is sent once as
+ *   message_sendBytes would, if it fits one datagram.
+ *   The receiver takes the frames only from a peer it has accepted (see
+ *   message_acceptReliable) or sends reliable messages to itself.
+ *   A message given up on, or abandoned because 32 more are in flight,
+ *   is lost, but leaves no gap: every frame tells the receiver the oldest
+ *   message the sender still has, and it stops waiting for earlier ones.
+ *   A message longer than about 1200 bytes goes out as several datagrams,
+ *   which the receiver puts back together; sending it again sends them
+ *   all, but the receiver keeps the pieces it already has, so each
+ *   retransmission only needs to fill in the gaps.
+ * Logs:
+ *   errors in arguments, and every retransmission.
+ */
+void message_sendReliable(const addr_t to, const void* bytes, const size_t length);
+
+/******************************************/
+/* message_sendLatest: send the newest version of some state, such as the
+ * screen contents, that supersedes every earlier version.
+ * Caller provides:
+ *   a valid address to which to send the message,
+ *   a channel, 0 to message_Channels-1; each channel supersedes separately,
+ *   a pointer to the message bytes (text or binary), and their number
+ *   (at most message_MaxReliableBytes).
+ * Function returns: none
+ * Assumptions: as for message_sendReliable.
+ * Notes:
+ *   Like message_sendReliable, but only the newest message on a channel is
+ *   sent again until acknowledged: sending a new one abandons the old.
+ *   The receiver drops a message older than one it has already delivered
+ *   on that channel, and holds back (unacknowledged) a message until every
+ *   reliable message sent before it has been delivered.  Long messages
+ *   are split as for message_sendReliable.
+ */
+void message_sendLatest(const addr_t to, const int channel,
+                        const void* bytes, const size_t length);
+
+/******************************************/
+/* message_acceptReliable: take reliable messages from a peer.
+ * Caller provides: the peer's address.
+ * Function returns:
+ *   true if that peer's message_sendReliable and message_sendLatest
+ *   messages will now be delivered; false if message_MaxPeers peers
+ *   already have state.
+ * Notes:
+ *   Call it once the peer is known to send them, e.g. on agreeing to
+ *   "reliable" (wire.h) with it.  Frames from a peer not accepted, and
+ *   not sent reliable messages to, are ignored, so that anyone sending
+ *   them cannot fill the table.  An accepted peer stays accepted until
+ *   message_forget() or message_release().
+ */
+bool message_acceptReliable(const addr_t peer);
+
+/******************************************/
+/* message_forget: drop all reliable-delivery state for a peer.
+ * Caller provides: the peer's address.
+ * Notes:
+ *   Messages not yet acknowledged are no longer retransmitted, and the next
+ *   exchange with that address starts afresh.  Call it when a new
+ *   correspondent appears at an address, which may reuse an old one's port.
+ */
+void message_forget(const addr_t peer);
+
+/******************************************/
+/* message_release: drop the reliable-delivery state for a peer once
+ * nothing sent to it is left unacknowledged.
+ * Caller provides: the peer's address.
+ * Notes:
+ *   Call it after the last message to a peer that is going away, such as
+ *   a QUIT: the message is still sent again until acknowledged (or given
+ *   up on), and then the room it took is free for another peer.
+ */
+void message_release(const addr_t peer);
+
+/******************************************/
+/* message_setMaxPeers: set how many peers reliable-delivery state is kept
+ * for at once (message_MaxPeers unless set).
+ * Caller provides: the number, at least 1.
+ * Notes:
+ *   A server can bound it by the correspondents it expects, so that
+ *   addresses it does not know cannot hold state for long; peers released,
+ *   or idle, make room for new ones when the table is full.
+ */
+void message_setMaxPeers(const int count);
+
+/******************************************/
+/* message_attachLocal: reach a peer on this host through shared memory.
+ * Caller provides: the peer's address, as given to message_setAddr.
+ * Function returns:
+ *   true if messages to and from that peer now travel through a pair of
+ *   shared-memory rings (see shm.h) instead of the UDP stack;
+ *   false if the address is not a loopback address (127.x.x.x), or
+ *   nothing on this host listens for it, in which case UDP is used.
+ * Notes:
+ *   Call it before the first message to the peer.  Every process that
+ *   calls message_init listens for such peers, and message_loop() waits
+ *   on their rings as well as on the socket; they appear to handlers
+ *   under the address they receive UDP on, so nothing else changes.  The
+ *   rings are dropped, and the peer is back on UDP, when either side
+ *   exits.  A message that finds its ring full is lost, as on UDP.
+ * Logs: the switch to shared memory, and errors setting it up.
+ */
+bool message_attachLocal(const addr_t peer);
+
+/******************************************/
+/* message_flush: wait for reliable messages to be acknowledged.
+ * Caller provides: the longest time to wait, in seconds.
+ * Function returns:
+ *   true if every reliable message has been acknowledged (or abandoned),
+ *   false if some were still outstanding when the time ran out.
+ * Notes:
+ *   Call it before message_done(), after the last messages (say, a QUIT)
+ *   were sent with message_sendReliable.  Other messages that arrive
+ *   meanwhile are discarded.
+ */
+bool message_flush(const float timeout);
+
 /******************************************/
 /* message_loop: loop, handling input and incoming messages.
  * Caller provides:
@@ -154,6 +319,9 @@ void message_send(const addr_t to, const char* message);
  *   Handlers should return true to terminate looping, false to keep looping.
  * Notes:
  *   The timeout feature is optional; use timeout=0 and handleTimeout=NULL.
+ *   The loop also retransmits unacknowledged reliable messages, and
+ *   acknowledges and orders those it receives (see message_sendReliable);
+ *   only their contents reach handleMessage.
  * Logs:
  *   errors in arguments,
  *   errors in monitoring stdin and/or network,
@@ -166,6 +334,31 @@ bool message_loop(void* arg, const float timeout,
                                         const addr_t from, 
                                         const char* message));
 
+/******************************************/
+/* message_length: the length of the message being handled.
+ * Caller provides: nothing.
+ * Function returns:
+ *   the number of bytes in the message most recently passed to
+ *   handleMessage by message_loop, not counting the '\0' that
+ *   message_loop appends.  A handler needs this only for binary messages
+ *   (see message_sendBytes), which may contain '\0' bytes.
+ */
+size_t message_length(void);
+
+/******************************************/
+/* message_pending: is another message waiting to be received?
+ * Caller provides: nothing.
+ * Function returns:
+ *   true if a message has arrived on the socket and not yet been read,
+ *   false otherwise (or if message_init() has not been called).
+ * Notes:
+ *   This never blocks.  A handler can call it to learn whether
+ *   message_loop() is about to call it again right away, and so
+ *   postpone expensive work (such as redrawing a screen) until the
+ *   backlog of messages has been drained.
+ */
+bool message_pending(void);
+
 /******************************************/
 /* message_done: shut down the module.
  * Caller provides: nothing.
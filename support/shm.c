@@ -0,0 +1,410 @@
+/*
+ * shm - shared-memory rings between processes on the same host
+ *
+ * See shm.h for an overview.  Linux only: memfd_create, eventfd, and the
+ * abstract namespace for local socket names.
+ *
+ * CS50 Nuggets, Team 10
+ */
+
+#define _GNU_SOURCE       // memfd_create, accept4, SCM_RIGHTS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include "shm.h"
+#include "log.h"
+
+/**************** file-local constants ****************/
+#define RingBytes (1 << 20)     // per direction; a power of two
+static const uint32_t Magic = 0x4e554753;  // "NUGS"
+static const int Backlog = 16;             // peers waiting to be accepted
+static const struct timeval HelloWait = { 0, 100000 };  // 100ms
+
+/**************** file-local types ****************/
+/* One direction.  head and tail count bytes ever written and read, so
+ * head - tail is the number in use; each is stored by one side only, and
+ * they are kept on separate cache lines.
+ */
+typedef struct ring {
+  _Atomic uint32_t head;
+  unsigned char pad1[60];
+  _Atomic uint32_t tail;
+  unsigned char pad2[60];
+  unsigned char data[RingBytes];
+} ring_t;
+
+/* The shared memory: rings[0] carries datagrams to the listening side,
+ * rings[1] from it.
+ */
+typedef struct shared {
+  uint32_t magic;
+  uint32_t ringBytes;
+  unsigned char pad[56];
+  ring_t rings[2];
+} shared_t;
+
+/* What the connecting side sends, along with the memfd and two eventfds. */
+typedef struct hello {
+  uint32_t magic;
+  uint32_t port;          // its UDP port
+} hello_t;
+
+struct shm_peer {
+  shared_t* shared;
+  ring_t* in;             // the ring we read
+  ring_t* out;            // the ring we write
+  int wakeIn;             // eventfd the other side signals
+  int wakeOut;            // eventfd we signal
+  int conn;               // the local socket, watched for hangup
+};
+
+/**************** file-local functions ****************/
+static socklen_t nameListener(const int port, struct sockaddr_un* addr);
+static shm_peer_t* newPeer(shared_t* shared, const bool listening,
+                           const int wakeListener, const int wakeConnector,
+                           const int conn);
+static void copyIn(ring_t* ring, const uint32_t at, const void* from, size_t n);
+static void copyOut(const ring_t* ring, const uint32_t at, void* to, size_t n);
+
+/**************** shm_listen ****************/
+int
+shm_listen(const int port)
+{
+  struct sockaddr_un addr;
+  socklen_t length = nameListener(port, &addr);
+  int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (listener < 0) {
+    log_e("shm_listen: opening local socket");
+    return -1;
+  }
+  if (bind(listener, (struct sockaddr*)&addr, length) != 0
+      || listen(listener, Backlog) != 0) {
+    log_e("shm_listen: binding local socket");
+    close(listener);
+    return -1;
+  }
+  return listener;
+}
+
+/**************** shm_accept ****************/
+shm_peer_t*
+shm_accept(const int listener, int* peerPort)
+{
+  int conn = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+  if (conn < 0) {
+    log_e("shm_accept: accepting local peer");
+    return NULL;
+  }
+  // the hello follows the connect at once; do not wait long for it
+  setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &HelloWait, sizeof(HelloWait));
+
+  hello_t hello;
+  struct iovec iov = { &hello, sizeof(hello) };
+  union {                 // aligned room for three descriptors
+    struct cmsghdr header;
+    char space[CMSG_SPACE(3 * sizeof(int))];
+  } control;
+  struct msghdr msg = { 0 };
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.space;
+  msg.msg_controllen = sizeof(control.space);
+
+  ssize_t got = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (got != sizeof(hello) || hello.magic != Magic || cmsg == NULL
+      || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+      || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+    log_v("shm_accept: bad hello from local peer");
+    if (cmsg != NULL && cmsg->cmsg_type == SCM_RIGHTS) {
+      int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (int i = 0; i < count; i++) {
+        int fd;
+        memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+        close(fd);
+      }
+    }
+    close(conn);
+    return NULL;
+  }
+  int fds[3];             // memfd, the listener's eventfd, the connector's
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  // the memory must be exactly ours, and sealed so it cannot shrink
+  // under us (a shrunk mapping would fault on access)
+  struct stat info;
+  shared_t* shared = MAP_FAILED;
+  if (fstat(fds[0], &info) == 0 && info.st_size == sizeof(shared_t)
+      && (fcntl(fds[0], F_GET_SEALS) & F_SEAL_SHRINK)) {
+    shared = mmap(NULL, sizeof(shared_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fds[0], 0);
+  }
+  close(fds[0]);
+  if (shared == MAP_FAILED || shared->magic != Magic
+      || shared->ringBytes != RingBytes) {
+    log_v("shm_accept: bad shared memory from local peer");
+    if (shared != MAP_FAILED) {
+      munmap(shared, sizeof(shared_t));
+    }
+    close(fds[1]);
+    close(fds[2]);
+    close(conn);
+    return NULL;
+  }
+  *peerPort = hello.port;
+  return newPeer(shared, true, fds[1], fds[2], conn);
+}
+
+/**************** shm_connect ****************/
+shm_peer_t*
+shm_connect(const int port, const int ourPort)
+{
+  struct sockaddr_un addr;
+  socklen_t length = nameListener(port, &addr);
+  int conn = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (conn < 0) {
+    log_e("shm_connect: opening local socket");
+    return NULL;
+  }
+  if (connect(conn, (struct sockaddr*)&addr, length) != 0) {
+    // nobody listens there: not local, or an older server
+    log_d("shm_connect: no local listener for port %d", port);
+    close(conn);
+    return NULL;
+  }
+
+  int memfd = memfd_create("nuggets-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  shared_t* shared = MAP_FAILED;
+  if (memfd >= 0 && ftruncate(memfd, sizeof(shared_t)) == 0
+      && fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0) {
+    shared = mmap(NULL, sizeof(shared_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+                  memfd, 0);
+  }
+  int wakeListener = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  int wakeConnector = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (shared == MAP_FAILED || wakeListener < 0 || wakeConnector < 0) {
+    log_e("shm_connect: creating shared memory");
+    if (shared != MAP_FAILED) {
+      munmap(shared, sizeof(shared_t));
+    }
+    if (memfd >= 0) {
+      close(memfd);
+    }
+    if (wakeListener >= 0) {
+      close(wakeListener);
+    }
+    if (wakeConnector >= 0) {
+      close(wakeConnector);
+    }
+    close(conn);
+    return NULL;
+  }
+  shared->magic = Magic;
+  shared->ringBytes = RingBytes;   // the memfd starts zeroed: rings empty
+
+  hello_t hello = { Magic, ourPort };
+  struct iovec iov = { &hello, sizeof(hello) };
+  union {
+    struct cmsghdr header;
+    char space[CMSG_SPACE(3 * sizeof(int))];
+  } control;
+  memset(&control, 0, sizeof(control));
+  struct msghdr msg = { 0 };
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.space;
+  msg.msg_controllen = sizeof(control.space);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+  int fds[3] = { memfd, wakeListener, wakeConnector };
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  bool sent = (sendmsg(conn, &msg, 0) == sizeof(hello));
+  close(memfd);           // the mapping, and the listener's copy, keep it
+  if (!sent) {
+    log_e("shm_connect: sending to local listener");
+    munmap(shared, sizeof(shared_t));
+    close(wakeListener);
+    close(wakeConnector);
+    close(conn);
+    return NULL;
+  }
+  return newPeer(shared, false, wakeListener, wakeConnector, conn);
+}
+
+/**************** shm_send ****************/
+bool
+shm_send(shm_peer_t* peer, const void* bytes, const size_t length)
+{
+  ring_t* ring = peer->out;
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  uint32_t header = length;
+  if (length > RingBytes - sizeof(header)
+      || head - tail > RingBytes - sizeof(header) - length) {
+    return false;
+  }
+  copyIn(ring, head, &header, sizeof(header));
+  copyIn(ring, head + sizeof(header), bytes, length);
+  atomic_store_explicit(&ring->head, head + sizeof(header) + length,
+                        memory_order_seq_cst);
+
+  // the reader only sleeps once the ring is empty; if it had read all
+  // that came before this datagram, it may be asleep
+  if (atomic_load_explicit(&ring->tail, memory_order_seq_cst) == head) {
+    uint64_t one = 1;
+    if (write(peer->wakeOut, &one, sizeof(one)) < 0) {
+      log_v("shm_send: cannot wake the peer");
+    }
+  }
+  return true;
+}
+
+/**************** shm_receive ****************/
+int
+shm_receive(shm_peer_t* peer, void* buf, const size_t size)
+{
+  ring_t* ring = peer->in;
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  while (true) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t used = head - tail;
+    uint32_t length = 0;
+    if (used == 0) {
+      return -1;
+    }
+    if (used >= sizeof(length) && used <= RingBytes) {
+      copyOut(ring, tail, &length, sizeof(length));
+    }
+    if (used < sizeof(length) || used > RingBytes || length > used - sizeof(length)) {
+      // the writer broke the ring; drop what is there
+      log_v("shm_receive: corrupt ring");
+      atomic_store_explicit(&ring->tail, head, memory_order_seq_cst);
+      return -1;
+    }
+    if (length <= size) {
+      copyOut(ring, tail + sizeof(length), buf, length);
+    }
+    tail += sizeof(length) + length;
+    atomic_store_explicit(&ring->tail, tail, memory_order_seq_cst);
+    if (length <= size) {
+      return length;
+    }
+    log_v("shm_receive: datagram too large; dropped");
+  }
+}
+
+/**************** shm_pending ****************/
+bool
+shm_pending(shm_peer_t* peer)
+{
+  return atomic_load_explicit(&peer->in->head, memory_order_seq_cst)
+         != atomic_load_explicit(&peer->in->tail, memory_order_relaxed);
+}
+
+/**************** shm_wakeFd, shm_hangupFd, shm_clearWake ****************/
+int
+shm_wakeFd(shm_peer_t* peer)
+{
+  return peer->wakeIn;
+}
+
+int
+shm_hangupFd(shm_peer_t* peer)
+{
+  return peer->conn;
+}
+
+void
+shm_clearWake(shm_peer_t* peer)
+{
+  uint64_t count;
+  if (read(peer->wakeIn, &count, sizeof(count)) < 0) {
+    // nothing to clear
+  }
+}
+
+/**************** shm_close ****************/
+void
+shm_close(shm_peer_t* peer)
+{
+  if (peer != NULL) {
+    munmap(peer->shared, sizeof(shared_t));
+    close(peer->wakeIn);
+    close(peer->wakeOut);
+    close(peer->conn);
+    free(peer);
+  }
+}
+
+/**************** nameListener ****************/
+/* The local socket name for a port, in the abstract namespace (a leading
+ * NUL), so there is no file to clean up; returns the address length.
+ */
+static socklen_t
+nameListener(const int port, struct sockaddr_un* addr)
+{
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  int length = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+                        "nuggets-%d", port);
+  return offsetof(struct sockaddr_un, sun_path) + 1 + length;
+}
+
+/**************** newPeer ****************/
+/* A peer on mapped shared memory; the listening side reads rings[0]. */
+static shm_peer_t*
+newPeer(shared_t* shared, const bool listening,
+        const int wakeListener, const int wakeConnector, const int conn)
+{
+  shm_peer_t* peer = malloc(sizeof(shm_peer_t));
+  if (peer == NULL) {
+    munmap(shared, sizeof(shared_t));
+    close(wakeListener);
+    close(wakeConnector);
+    close(conn);
+    return NULL;
+  }
+  peer->shared = shared;
+  peer->in = &shared->rings[listening ? 0 : 1];
+  peer->out = &shared->rings[listening ? 1 : 0];
+  peer->wakeIn = listening ? wakeListener : wakeConnector;
+  peer->wakeOut = listening ? wakeConnector : wakeListener;
+  peer->conn = conn;
+  return peer;
+}
+
+/**************** copyIn, copyOut ****************/
+/* Copy n bytes to or from the ring at byte count 'at', wrapping around. */
+static void
+copyIn(ring_t* ring, const uint32_t at, const void* from, size_t n)
+{
+  size_t offset = at & (RingBytes - 1);
+  size_t first = (n < RingBytes - offset) ? n : RingBytes - offset;
+  memcpy(ring->data + offset, from, first);
+  memcpy(ring->data, (const unsigned char*)from + first, n - first);
+}
+
+static void
+copyOut(const ring_t* ring, const uint32_t at, void* to, size_t n)
+{
+  size_t offset = at & (RingBytes - 1);
+  size_t first = (n < RingBytes - offset) ? n : RingBytes - offset;
+  memcpy(to, ring->data + offset, first);
+  memcpy((unsigned char*)to + first, ring->data, n - first);
+}
@@ -0,0 +1,99 @@
+/*
+ * shm - shared-memory rings between processes on the same host
+ *
+ * A transport for the 'message' module (see message_attachLocal): two
+ * processes on one host exchange datagrams through a pair of ring buffers
+ * in shared memory instead of through the UDP stack.
+ *
+ * The process that serves (the Nuggets server) listens on a local socket
+ * named after its UDP port.  A process that wants to talk to it creates
+ * the shared memory (a memfd holding one ring in each direction) and two
+ * eventfds, one to wake each side, and passes all three over that socket
+ * along with its own UDP port, which names it to the server.  From then on
+ * the local socket is only watched for the other side hanging up.
+ *
+ * A ring carries whole datagrams, each a 32-bit length and then the bytes.
+ * The writer copies a datagram in, and signals the reader's eventfd only
+ * if the reader had emptied the ring (and so may be asleep); the reader
+ * drains the ring whenever its eventfd fires.  A datagram that does not
+ * fit is dropped, as UDP might drop it; the reliable messages of the
+ * 'message' module are resent as usual.
+ *
+ * CS50 Nuggets, Team 10
+ */
+
+#ifndef _SHM_H_
+#define _SHM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/****************** types *********************/
+typedef struct shm_peer shm_peer_t;  // opaque to users of this module
+
+/****************** global functions *********************/
+
+/******************************************/
+/* shm_listen: accept peers on this host.
+ * Caller provides: the UDP port it receives on, which names the listener.
+ * Function returns: the listening socket, or -1 on error.
+ */
+int shm_listen(const int port);
+
+/******************************************/
+/* shm_accept: accept a peer that connected to a listener.
+ * Caller provides:
+ *   the listening socket, once it is readable,
+ *   where to store the peer's UDP port.
+ * Function returns: the new peer, or NULL on error.
+ * Caller is responsible for: later calling shm_close.
+ */
+shm_peer_t* shm_accept(const int listener, int* peerPort);
+
+/******************************************/
+/* shm_connect: connect to the process listening as 'port' on this host.
+ * Caller provides: that port, and our own UDP port.
+ * Function returns: the new peer, or NULL if there is no such listener.
+ * Caller is responsible for: later calling shm_close.
+ */
+shm_peer_t* shm_connect(const int port, const int ourPort);
+
+/******************************************/
+/* shm_send: copy a datagram into the peer's ring, and wake it if needed.
+ * Caller provides: a peer, and the bytes and their length.
+ * Function returns: false if the ring has no room (the datagram is lost).
+ */
+bool shm_send(shm_peer_t* peer, const void* bytes, const size_t length);
+
+/******************************************/
+/* shm_receive: take the next datagram from the ring the peer writes to.
+ * Caller provides: a peer, and a buffer and its size.
+ * Function returns:
+ *   the datagram's length, or -1 if the ring is empty.  A datagram larger
+ *   than the buffer, or a ring that makes no sense, is discarded.
+ */
+int shm_receive(shm_peer_t* peer, void* buf, const size_t size);
+
+/******************************************/
+/* shm_pending: is a datagram waiting in the ring the peer writes to?
+ * Caller provides: a peer.
+ */
+bool shm_pending(shm_peer_t* peer);
+
+/******************************************/
+/* shm_wakeFd, shm_hangupFd: the descriptors to watch with select().
+ * shm_wakeFd is readable when the peer may have written to an empty ring;
+ * call shm_clearWake and then drain the ring with shm_receive.
+ * shm_hangupFd is readable when the peer has gone; call shm_close.
+ */
+int shm_wakeFd(shm_peer_t* peer);
+int shm_hangupFd(shm_peer_t* peer);
+void shm_clearWake(shm_peer_t* peer);
+
+/******************************************/
+/* shm_close: unmap the rings and close the descriptors of a peer.
+ * Caller provides: a peer (NULL is ignored).
+ */
+void shm_close(shm_peer_t* peer);
+
+#endif // _SHM_H_
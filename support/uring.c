@@ -0,0 +1,454 @@
+/*
+ * uring - datagram sends and receives on one UDP socket through io_uring
+ *
+ * See uring.h for an overview.  The rings are set up by hand, with the
+ * io_uring_setup, io_uring_enter and io_uring_register system calls.
+ * Multishot recvmsg needs Linux 6.0 or later; older kernels fail either
+ * uring_open (no buffer rings) or the first receive (no multishot).
+ *
+ * CS50 Nuggets, Team 10
+ */
+
+#define _GNU_SOURCE       // syscall, MAP_ANONYMOUS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+#include "log.h"
+
+/**************** file-local constants ****************/
+#define Entries 256       // submission queue; the kernel makes the CQ twice as big
+#define SendSlots 128     // sends in flight at once
+#define Buffers 32        // receive buffers; a power of two
+#define BufferBytes (64 * 1024 + 64)  // header, sender, a whole datagram, '\0'
+static const uint16_t Group = 1;             // our receive buffer group
+static const uint64_t ReceiveTag = UINT64_MAX;  // user_data of the receive
+static const int CloseTries = 100;          // completions to wait for at close
+
+/**************** file-local types ****************/
+typedef struct slot {
+  struct msghdr msg;
+  struct iovec iov;
+  struct sockaddr_in to;
+  unsigned char* data;    // grown as needed, kept for reuse
+  size_t capacity;
+} slot_t;
+
+struct uring {
+  int fd;
+  int socket;
+  void* rings;            // the SQ and CQ rings, mapped together
+  size_t ringsBytes;
+  // submission queue
+  unsigned* sqHead;
+  unsigned* sqTail;
+  unsigned sqMask;
+  unsigned sqEntries;
+  unsigned* sqArray;
+  struct io_uring_sqe* sqes;
+  size_t sqesBytes;
+  unsigned queued;        // filled in but not yet submitted
+  // completion queue
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned cqMask;
+  struct io_uring_cqe* cqes;
+  // receiving
+  struct io_uring_buf_ring* bufRing;
+  size_t bufRingBytes;
+  unsigned char* buffers; // Buffers of BufferBytes
+  uint16_t bufTail;
+  int lent;               // buffer given out by uring_receive; -1 if none
+  struct msghdr recvMsg;  // what the multishot recvmsg fills in
+  bool receiving;         // is it posted?
+  bool broken;            // it failed; receive with recvfrom instead
+  // sending
+  slot_t slots[SendSlots];
+  int freeSlots[SendSlots];
+  int numFree;
+};
+
+/**************** file-local functions ****************/
+static bool mapRings(uring_t* uring, const struct io_uring_params* params);
+static bool setupBuffers(uring_t* uring);
+static struct io_uring_sqe* nextSqe(uring_t* uring);
+static void postReceive(uring_t* uring);
+static struct io_uring_cqe* nextReceived(uring_t* uring);
+static void advanceCq(uring_t* uring);
+static void giveBack(uring_t* uring, const int buffer);
+static int enter(uring_t* uring, const unsigned submit, const unsigned wait);
+
+/**************** uring_open ****************/
+uring_t*
+uring_open(const int socket)
+{
+  uring_t* uring = calloc(1, sizeof(uring_t));
+  if (uring == NULL) {
+    return NULL;
+  }
+  uring->socket = socket;
+  uring->lent = -1;
+  for (int i = 0; i < SendSlots; i++) {
+    uring->freeSlots[uring->numFree++] = i;
+  }
+  uring->bufRing = MAP_FAILED;
+  uring->rings = MAP_FAILED;
+  uring->sqes = MAP_FAILED;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  uring->fd = syscall(__NR_io_uring_setup, Entries, &params);
+  if (uring->fd < 0) {
+    log_v("uring_open: io_uring is not available");
+    free(uring);
+    return NULL;
+  }
+  if (!mapRings(uring, &params) || !setupBuffers(uring)) {
+    log_v("uring_open: cannot set up io_uring");
+    uring_close(uring);
+    return NULL;
+  }
+
+  // one receive, posted once, for every datagram; we read only the
+  // sender's address, and take the datagram from the buffer the kernel
+  // picks for it
+  uring->recvMsg.msg_namelen = sizeof(struct sockaddr_in);
+  postReceive(uring);
+  uring_submit(uring);
+  nextReceived(uring);    // a kernel without multishot recvmsg fails it now
+  if (uring->broken) {
+    log_v("uring_open: no multishot receives on this kernel");
+    uring_close(uring);
+    return NULL;
+  }
+  return uring;
+}
+
+/**************** uring_fd ****************/
+int
+uring_fd(uring_t* uring)
+{
+  return uring->fd;
+}
+
+/**************** uring_send ****************/
+bool
+uring_send(uring_t* uring, const struct sockaddr_in* to,
+           const void* bytes, const size_t length)
+{
+  if (uring->numFree == 0) {
+    return sendto(uring->socket, bytes, length, 0,
+                  (const struct sockaddr *) to, sizeof(*to)) >= 0;
+  }
+  int index = uring->freeSlots[uring->numFree - 1];
+  slot_t* slot = &uring->slots[index];
+  if (slot->capacity < length) {
+    unsigned char* data = realloc(slot->data, length);
+    if (data == NULL) {
+      return false;
+    }
+    slot->data = data;
+    slot->capacity = length;
+  }
+  uring->numFree--;
+  memcpy(slot->data, bytes, length);
+  slot->to = *to;
+  slot->iov.iov_base = slot->data;
+  slot->iov.iov_len = length;
+  memset(&slot->msg, 0, sizeof(slot->msg));
+  slot->msg.msg_name = &slot->to;
+  slot->msg.msg_namelen = sizeof(slot->to);
+  slot->msg.msg_iov = &slot->iov;
+  slot->msg.msg_iovlen = 1;
+
+  struct io_uring_sqe* sqe = nextSqe(uring);
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = uring->socket;
+  sqe->addr = (uintptr_t)&slot->msg;
+  sqe->len = 1;
+  sqe->user_data = index;
+  return true;
+}
+
+/**************** uring_submit ****************/
+void
+uring_submit(uring_t* uring)
+{
+  if (uring->queued == 0) {
+    return;
+  }
+  int submitted = enter(uring, uring->queued, 0);
+  if (submitted < 0) {
+    log_e("uring_submit: io_uring_enter");
+  } else {
+    uring->queued -= submitted;
+  }
+}
+
+/**************** uring_receive ****************/
+int
+uring_receive(uring_t* uring, struct sockaddr_in* from, char** datagram)
+{
+  // the caller is done with the datagram we gave it last time
+  if (uring->lent >= 0) {
+    giveBack(uring, uring->lent);
+    uring->lent = -1;
+  }
+  while (true) {
+    struct io_uring_cqe* cqe = nextReceived(uring);
+    if (!uring->receiving && !uring->broken) {
+      postReceive(uring);
+      uring_submit(uring);
+    }
+    if (uring->broken) {
+      return -2;
+    }
+    if (cqe == NULL) {
+      return -1;
+    }
+
+    // the buffer holds a header, the sender's address, then the datagram
+    int buffer = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    unsigned char* start = uring->buffers + (size_t)buffer * BufferBytes;
+    struct io_uring_recvmsg_out out;
+    memcpy(&out, start, sizeof(out));
+    size_t offset = sizeof(out) + uring->recvMsg.msg_namelen;
+    int length = cqe->res - (int)offset;
+    advanceCq(uring);
+    if (length < 0 || (out.flags & MSG_TRUNC)
+        || out.namelen != sizeof(struct sockaddr_in)) {
+      log_v("uring_receive: dropped a malformed or truncated datagram");
+      giveBack(uring, buffer);
+      continue;
+    }
+    memcpy(from, start + sizeof(out), sizeof(*from));
+    *datagram = (char*)start + offset;
+    uring->lent = buffer;
+    return length;
+  }
+}
+
+/**************** uring_pending ****************/
+bool
+uring_pending(uring_t* uring)
+{
+  if (nextReceived(uring) != NULL) {
+    return true;
+  }
+  // completions may not have been posted yet; entering the kernel posts them
+  enter(uring, 0, 0);
+  return nextReceived(uring) != NULL;
+}
+
+/**************** uring_close ****************/
+void
+uring_close(uring_t* uring)
+{
+  if (uring == NULL) {
+    return;
+  }
+  if (uring->sqes != MAP_FAILED) {
+    // let queued sends, such as a last QUIT, get out
+    uring_submit(uring);
+    for (int i = 0; i < CloseTries && uring->numFree < SendSlots; i++) {
+      if (nextReceived(uring) != NULL) {
+        advanceCq(uring);   // a datagram nobody will read
+      } else if (enter(uring, 0, 1) < 0) {
+        break;
+      }
+    }
+  }
+  if (uring->rings != MAP_FAILED) {
+    munmap(uring->rings, uring->ringsBytes);
+  }
+  if (uring->sqes != MAP_FAILED) {
+    munmap(uring->sqes, uring->sqesBytes);
+  }
+  close(uring->fd);       // also ends the receive, and unregisters buffers
+  if (uring->bufRing != MAP_FAILED) {
+    munmap(uring->bufRing, uring->bufRingBytes);
+  }
+  free(uring->buffers);
+  for (int i = 0; i < SendSlots; i++) {
+    free(uring->slots[i].data);
+  }
+  free(uring);
+}
+
+/**************** mapRings ****************/
+/* Map the submission and completion rings and the SQE array. */
+static bool
+mapRings(uring_t* uring, const struct io_uring_params* params)
+{
+  if (!(params->features & IORING_FEAT_SINGLE_MMAP)) {
+    return false;         // before Linux 5.4; not worth a second mapping
+  }
+  size_t sqBytes = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+  size_t cqBytes = params->cq_off.cqes
+                   + params->cq_entries * sizeof(struct io_uring_cqe);
+  uring->ringsBytes = (sqBytes > cqBytes) ? sqBytes : cqBytes;
+  uring->rings = mmap(NULL, uring->ringsBytes, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, uring->fd, IORING_OFF_SQ_RING);
+  uring->sqesBytes = params->sq_entries * sizeof(struct io_uring_sqe);
+  uring->sqes = mmap(NULL, uring->sqesBytes, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, uring->fd, IORING_OFF_SQES);
+  if (uring->rings == MAP_FAILED || uring->sqes == MAP_FAILED) {
+    return false;
+  }
+  unsigned char* rings = uring->rings;
+  uring->sqHead = (unsigned*)(rings + params->sq_off.head);
+  uring->sqTail = (unsigned*)(rings + params->sq_off.tail);
+  uring->sqMask = *(unsigned*)(rings + params->sq_off.ring_mask);
+  uring->sqEntries = params->sq_entries;
+  uring->sqArray = (unsigned*)(rings + params->sq_off.array);
+  uring->cqHead = (unsigned*)(rings + params->cq_off.head);
+  uring->cqTail = (unsigned*)(rings + params->cq_off.tail);
+  uring->cqMask = *(unsigned*)(rings + params->cq_off.ring_mask);
+  uring->cqes = (struct io_uring_cqe*)(rings + params->cq_off.cqes);
+  return true;
+}
+
+/**************** setupBuffers ****************/
+/* Register the ring of receive buffers (Linux 5.19), and fill it. */
+static bool
+setupBuffers(uring_t* uring)
+{
+  uring->bufRingBytes = Buffers * sizeof(struct io_uring_buf);
+  uring->bufRing = mmap(NULL, uring->bufRingBytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  uring->buffers = malloc((size_t)Buffers * BufferBytes);
+  if (uring->bufRing == MAP_FAILED || uring->buffers == NULL) {
+    return false;
+  }
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uintptr_t)uring->bufRing;
+  reg.ring_entries = Buffers;
+  reg.bgid = Group;
+  if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING,
+              &reg, 1) != 0) {
+    return false;
+  }
+  for (int i = 0; i < Buffers; i++) {
+    giveBack(uring, i);
+  }
+  return true;
+}
+
+/**************** nextSqe ****************/
+/* A cleared submission entry, queued for the next uring_submit. */
+static struct io_uring_sqe*
+nextSqe(uring_t* uring)
+{
+  unsigned tail = *uring->sqTail;
+  if (tail - __atomic_load_n(uring->sqHead, __ATOMIC_ACQUIRE) >= uring->sqEntries) {
+    uring_submit(uring);  // full; cannot happen with SendSlots < Entries
+  }
+  unsigned index = tail & uring->sqMask;
+  struct io_uring_sqe* sqe = &uring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  uring->sqArray[index] = index;
+  // the kernel reads the entry only once we enter it, after filling it in
+  __atomic_store_n(uring->sqTail, tail + 1, __ATOMIC_RELEASE);
+  uring->queued++;
+  return sqe;
+}
+
+/**************** postReceive ****************/
+/* Queue the multishot recvmsg, which takes its buffers from our group. */
+static void
+postReceive(uring_t* uring)
+{
+  struct io_uring_sqe* sqe = nextSqe(uring);
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = uring->socket;
+  sqe->addr = (uintptr_t)&uring->recvMsg;
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = Group;
+  sqe->user_data = ReceiveTag;
+  uring->receiving = true;
+}
+
+/**************** nextReceived ****************/
+/* Collect the completions ahead of the next datagram received: free the
+ * slots of finished sends, and note a receive that has stopped.  Returns
+ * the datagram's completion, left in place, or NULL if there is none yet.
+ */
+static struct io_uring_cqe*
+nextReceived(uring_t* uring)
+{
+  while (true) {
+    unsigned head = *uring->cqHead;
+    if (head == __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE)) {
+      return NULL;
+    }
+    struct io_uring_cqe* cqe = &uring->cqes[head & uring->cqMask];
+    if (cqe->user_data != ReceiveTag) {
+      if (cqe->res < 0) {
+        log_d("uring: a send failed, error %d", -cqe->res);
+      }
+      uring->freeSlots[uring->numFree++] = cqe->user_data;
+      advanceCq(uring);
+      continue;
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      uring->receiving = false;   // to be posted again
+    }
+    if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+      return cqe;
+    }
+    if (cqe->res != -ENOBUFS) {
+      // most likely a kernel without multishot recvmsg
+      log_d("uring: receiving failed, error %d; using recvfrom", -cqe->res);
+      uring->broken = true;
+    }
+    advanceCq(uring);
+  }
+}
+
+/**************** advanceCq ****************/
+/* Consume the completion at the head of the CQ. */
+static void
+advanceCq(uring_t* uring)
+{
+  __atomic_store_n(uring->cqHead, *uring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+/**************** giveBack ****************/
+/* Return a receive buffer to the kernel; one byte is held back, so that
+ * the datagram in it can always be NUL-terminated.
+ */
+static void
+giveBack(uring_t* uring, const int buffer)
+{
+  struct io_uring_buf* entry = &uring->bufRing->bufs[uring->bufTail & (Buffers - 1)];
+  entry->addr = (uintptr_t)(uring->buffers + (size_t)buffer * BufferBytes);
+  entry->len = BufferBytes - 1;
+  entry->bid = buffer;
+  uring->bufTail++;
+  __atomic_store_n(&uring->bufRing->tail, uring->bufTail, __ATOMIC_RELEASE);
+}
+
+/**************** enter ****************/
+/* Submit 'submit' entries, and wait for at least 'wait' completions. */
+static int
+enter(uring_t* uring, const unsigned submit, const unsigned wait)
+{
+  int result;
+  do {
+    result = syscall(__NR_io_uring_enter, uring->fd, submit, wait,
+                     IORING_ENTER_GETEVENTS, NULL, 0);
+  } while (result < 0 && errno == EINTR);
+  return result;
+}
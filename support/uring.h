@@ -0,0 +1,96 @@
+/*
+ * uring - datagram sends and receives on one UDP socket through io_uring
+ *
+ * A back end for the 'message' module, used in place of recvfrom and
+ * sendto when the kernel offers io_uring.  Receiving, one multishot
+ * recvmsg stays posted on the socket, taking buffers as it needs them
+ * from a ring of buffers it was given up front, so datagrams arrive
+ * without a system call each.  Sending, datagrams are copied into send
+ * slots and queued, and uring_submit hands the whole queue to the kernel
+ * in one system call; the 'message' module calls it after handling each
+ * message, and once per trip around its loop, so the fan-out of one update
+ * goes out in a single submission.
+ *
+ * Nothing here is required: uring_open returns NULL when io_uring is
+ * missing or forbidden, and uring_receive reports when the kernel turns
+ * out not to support multishot receives, so the caller can go back to
+ * recvfrom and sendto.
+ *
+ * Uses the raw system calls, so needs only the kernel headers.
+ *
+ * CS50 Nuggets, Team 10
+ */
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+
+/****************** types *********************/
+typedef struct uring uring_t;  // opaque to users of this module
+
+/****************** global functions *********************/
+
+/******************************************/
+/* uring_open: set up an io_uring for a UDP socket, and post the receive.
+ * Caller provides: the socket, already bound.
+ * Function returns: the new uring, or NULL if io_uring is not available.
+ * Caller is responsible for: later calling uring_close.
+ */
+uring_t* uring_open(const int socket);
+
+/******************************************/
+/* uring_fd: the descriptor to watch with select(); it is readable when
+ * completions wait, and then uring_receive should be called.
+ */
+int uring_fd(uring_t* uring);
+
+/******************************************/
+/* uring_send: queue a datagram for the next uring_submit.
+ * Caller provides: the uring, the destination, and the bytes and their
+ *   length, which are copied, so the caller may reuse them at once.
+ * Function returns: false if it could not be sent.
+ * Notes: if every send slot is still in flight, the datagram is sent
+ *   right away with sendto instead.
+ */
+bool uring_send(uring_t* uring, const struct sockaddr_in* to,
+                const void* bytes, const size_t length);
+
+/******************************************/
+/* uring_submit: hand every queued send (and a re-posted receive) to the
+ * kernel, in one system call.
+ * Caller provides: the uring.
+ */
+void uring_submit(uring_t* uring);
+
+/******************************************/
+/* uring_receive: take the next datagram that has arrived.
+ * Caller provides: the uring, where to store the sender, and where to
+ *   store a pointer to the datagram.
+ * Function returns:
+ *   the length of the datagram, which stays valid, and has room for a
+ *   '\0' after it, until the next call; or
+ *   -1 if no datagram is waiting; or
+ *   -2 if receiving through io_uring does not work on this kernel; the
+ *   caller should uring_close and use recvfrom from now on.
+ * Notes: also collects the completions of earlier sends.
+ */
+int uring_receive(uring_t* uring, struct sockaddr_in* from, char** datagram);
+
+/******************************************/
+/* uring_pending: is a datagram waiting for uring_receive?
+ * Caller provides: the uring.
+ * Notes: never blocks.
+ */
+bool uring_pending(uring_t* uring);
+
+/******************************************/
+/* uring_close: submit what is queued, wait (briefly) for the sends in
+ * flight, and release everything.
+ * Caller provides: the uring (NULL is ignored); the socket stays open.
+ */
+void uring_close(uring_t* uring);
+
+#endif // _URING_H_
@@ -0,0 +1,607 @@
+/*
+ * wire - protocol options and the compact binary encoding of messages
+ *
+ * See wire.h for the description of the options and the frame layouts.
+ *
+ * CS50 Nuggets, Team 10
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "wire.h"
+
+/**************** file-local types ****************/
+typedef struct capName {
+  int cap;
+  const char* name;
+} capName_t;
+
+/**************** file-local global variables ****************/
+static const capName_t capNames[] = {
+  { wire_CapBinary, "binary" },
+  { wire_CapRle, "rle" },
+  { wire_CapReliable, "reliable" },
+  { wire_CapView, "view" },
+  { wire_CapState, "state" },
+  { wire_CapSeq, "seq" },
+};
+static const int numCapNames = sizeof(capNames) / sizeof(capNames[0]);
+
+/**************** file-local functions ****************/
+static bool getVarint(const unsigned char** in, const unsigned char* end,
+                      uint32_t* value);
+static size_t encodeDisplay(unsigned char* out, const size_t size, const bool rle,
+                            const bool hasSeq, const uint32_t seq,
+                            const bool hasView, const int top, const int left,
+                            const int rows, const int cols, const char* cells);
+
+/**************** wire_parseCaps ****************/
+int
+wire_parseCaps(const char* names)
+{
+  int caps = 0;
+  if (names == NULL) {
+    return caps;
+  }
+  const char* p = names;
+  while (*p != '\0') {
+    while (*p == ' ') {
+      p++;
+    }
+    size_t length = strcspn(p, " ");
+    for (int i = 0; i < numCapNames; i++) {
+      if (length == strlen(capNames[i].name)
+          && strncmp(p, capNames[i].name, length) == 0) {
+        caps |= capNames[i].cap;
+      }
+    }
+    p += length;
+  }
+  return caps;
+}
+
+/**************** wire_formatCaps ****************/
+char*
+wire_formatCaps(const int caps, char* buf, const size_t size)
+{
+  size_t used = snprintf(buf, size, "CAPS");
+  for (int i = 0; i < numCapNames && used < size; i++) {
+    if (caps & capNames[i].cap) {
+      used += snprintf(buf + used, size - used, " %s", capNames[i].name);
+    }
+  }
+  return buf;
+}
+
+/**************** wire_isBinary ****************/
+bool
+wire_isBinary(const void* message)
+{
+  return (*(const unsigned char*)message & 0x80) != 0;
+}
+
+/**************** wire_putVarint ****************/
+size_t
+wire_putVarint(unsigned char* out, uint32_t value)
+{
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  out[n++] = value;
+  return n;
+}
+
+/**************** wire_encodeOk ****************/
+size_t
+wire_encodeOk(unsigned char* out, const char letter)
+{
+  out[0] = wire_Ok;
+  out[1] = letter;
+  return 2;
+}
+
+/**************** wire_encodeGrid ****************/
+size_t
+wire_encodeGrid(unsigned char* out, const int rows, const int cols)
+{
+  size_t n = 0;
+  out[n++] = wire_Grid;
+  n += wire_putVarint(out + n, rows);
+  n += wire_putVarint(out + n, cols);
+  return n;
+}
+
+/**************** wire_encodeGold ****************/
+size_t
+wire_encodeGold(unsigned char* out, const int n, const int p, const int r)
+{
+  size_t length = 0;
+  out[length++] = wire_Gold;
+  length += wire_putVarint(out + length, n);
+  length += wire_putVarint(out + length, p);
+  length += wire_putVarint(out + length, r);
+  return length;
+}
+
+/**************** wire_encodeState ****************/
+size_t
+wire_encodeState(unsigned char* out, const int n, const int p, const int r)
+{
+  size_t length = 0;
+  out[length++] = wire_State;
+  length += wire_putVarint(out + length, n);
+  length += wire_putVarint(out + length, p);
+  length += wire_putVarint(out + length, r);
+  return length;
+}
+
+/**************** wire_encodeKey ****************/
+size_t
+wire_encodeKey(unsigned char* out, const char key,
+               const bool hasSeq, const uint32_t seq)
+{
+  size_t n = 0;
+  out[n++] = wire_Key;
+  n += wire_putVarint(out + n, hasSeq ? wire_FlagSeq : 0);
+  if (hasSeq) {
+    n += wire_putVarint(out + n, seq);
+  }
+  out[n++] = key;
+  return n;
+}
+
+/**************** wire_encodeDisplay ****************/
+size_t
+wire_encodeDisplay(unsigned char* out, const size_t size, const bool rle,
+                   const bool hasSeq, const uint32_t seq,
+                   const int rows, const int cols, const char* cells)
+{
+  return encodeDisplay(out, size, rle, hasSeq, seq, false, 0, 0, rows, cols, cells);
+}
+
+/**************** wire_encodeView ****************/
+size_t
+wire_encodeView(unsigned char* out, const size_t size, const bool rle,
+                const bool hasSeq, const uint32_t seq,
+                const int top, const int left,
+                const int rows, const int cols, const char* cells)
+{
+  return encodeDisplay(out, size, rle, hasSeq, seq, true, top, left, rows, cols, cells);
+}
+
+/**************** encodeDisplay ****************/
+/* The DISPLAY frame, of the whole map or of a window on it. */
+static size_t
+encodeDisplay(unsigned char* out, const size_t size, const bool rle,
+              const bool hasSeq, const uint32_t seq,
+              const bool hasView, const int top, const int left,
+              const int rows, const int cols, const char* cells)
+{
+  size_t count = (size_t)rows * cols;
+  if (size < wire_MaxHeader) {
+    return 0;
+  }
+
+  // the header, leaving the flags byte to fill in once we know them
+  size_t n = 0;
+  out[n++] = wire_Display;
+  size_t flagsAt = n++;
+  if (hasSeq) {
+    n += wire_putVarint(out + n, seq);
+  }
+  if (hasView) {
+    n += wire_putVarint(out + n, top);
+    n += wire_putVarint(out + n, left);
+  }
+  n += wire_putVarint(out + n, rows);
+  n += wire_putVarint(out + n, cols);
+
+  // compress if asked and it helps; the limit keeps only smaller encodings
+  size_t limit = (size - n < count) ? size - n : count - 1;
+  size_t packed = (rle && count > 1) ? wire_rleEncode(cells, count, out + n, limit) : 0;
+  out[flagsAt] = (hasSeq ? wire_FlagSeq : 0) | (packed > 0 ? wire_FlagRle : 0)
+                 | (hasView ? wire_FlagView : 0);
+  if (packed > 0) {
+    return n + packed;
+  }
+  if (n + count > size) {
+    return 0;
+  }
+  memcpy(out + n, cells, count);
+  return n + count;
+}
+
+/**************** wire_decodeCells ****************/
+bool
+wire_decodeCells(const wire_frame_t* frame, char* cells)
+{
+  size_t count = (size_t)frame->a * frame->b;
+  if (frame->rle) {
+    return wire_rleDecode((const unsigned char*)frame->cells, frame->length,
+                          cells, count);
+  }
+  if (frame->length != count) {
+    return false;
+  }
+  memcpy(cells, frame->cells, count);
+  return true;
+}
+
+/**************** wire_rleEncode ****************/
+size_t
+wire_rleEncode(const char* cells, const size_t count,
+               unsigned char* out, const size_t size)
+{
+  const unsigned char* in = (const unsigned char*)cells;
+  size_t n = 0;
+  for (size_t i = 0; i < count; ) {
+    unsigned char c = in[i];
+    size_t run = 1;
+    while (i + run < count && run < 128 && in[i + run] == c) {
+      run++;
+    }
+    if (run >= 3 || c >= 0x80) {
+      // a run, or a cell that cannot be sent as it is
+      if (n + 2 > size) {
+        return 0;
+      }
+      out[n++] = 0x80 | (run - 1);
+      out[n++] = c;
+      i += run;
+    } else {
+      if (n + run > size) {
+        return 0;
+      }
+      for (size_t k = 0; k < run; k++) {
+        out[n++] = c;
+      }
+      i += run;
+    }
+  }
+  return n;
+}
+
+/**************** wire_rleDecode ****************/
+bool
+wire_rleDecode(const unsigned char* in, const size_t length,
+               char* cells, const size_t count)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < length; ) {
+    unsigned char b = in[i++];
+    if (b < 0x80) {
+      if (n >= count) {
+        return false;
+      }
+      cells[n++] = b;
+    } else {
+      size_t run = (b & 0x7F) + 1;
+      if (i >= length || n + run > count) {
+        return false;
+      }
+      memset(cells + n, in[i++], run);
+      n += run;
+    }
+  }
+  return n == count;
+}
+
+/**************** wire_decode ****************/
+bool
+wire_decode(const void* message, const size_t length, wire_frame_t* frame)
+{
+  if (message == NULL || length < 1 || frame == NULL) {
+    return false;
+  }
+  const unsigned char* p = message;
+  const unsigned char* end = p + length;
+  memset(frame, 0, sizeof(*frame));
+  frame->type = *p++;
+
+  uint32_t flags;
+  uint32_t gold[3];
+  switch (frame->type) {
+  case wire_Ok:
+    if (p >= end) {
+      return false;
+    }
+    frame->letter = *p++;
+    break;
+  case wire_Grid:
+    if (!getVarint(&p, end, &frame->a) || !getVarint(&p, end, &frame->b)) {
+      return false;
+    }
+    break;
+  case wire_Gold:
+    if (!getVarint(&p, end, &frame->a) || !getVarint(&p, end, &frame->b)
+        || !getVarint(&p, end, &frame->c)) {
+      return false;
+    }
+    break;
+  case wire_Display:
+    if (!getVarint(&p, end, &flags)) {
+      return false;
+    }
+    frame->hasSeq = (flags & wire_FlagSeq) != 0;
+    frame->rle = (flags & wire_FlagRle) != 0;
+    frame->hasView = (flags & wire_FlagView) != 0;
+    if ((frame->hasSeq && !getVarint(&p, end, &frame->seq))
+        || (frame->hasView && (!getVarint(&p, end, &frame->top)
+                               || !getVarint(&p, end, &frame->left)))
+        || !getVarint(&p, end, &frame->a) || !getVarint(&p, end, &frame->b)
+        || (!frame->rle && (uint64_t)frame->a * frame->b != (uint64_t)(end - p))) {
+      return false;
+    }
+    frame->cells = (const char*)p;
+    frame->length = end - p;
+    p = end;
+    break;
+  case wire_State:
+    // the gold, then a whole DISPLAY frame
+    if (!getVarint(&p, end, &gold[0]) || !getVarint(&p, end, &gold[1])
+        || !getVarint(&p, end, &gold[2]) || p >= end || *p != wire_Display
+        || !wire_decode(p, end - p, frame)) {
+      return false;
+    }
+    frame->type = wire_State;
+    memcpy(frame->gold, gold, sizeof(gold));
+    return true;
+  case wire_Key:
+    if (!getVarint(&p, end, &flags)) {
+      return false;
+    }
+    frame->hasSeq = (flags & wire_FlagSeq) != 0;
+    if ((frame->hasSeq && !getVarint(&p, end, &frame->seq)) || p >= end) {
+      return false;
+    }
+    frame->letter = *p++;
+    break;
+  default:
+    return false;
+  }
+  return p == end;
+}
+
+/**************** getVarint ****************/
+/* Read one varint at *in, advancing *in; false if it runs past 'end'
+ * or does not fit in 32 bits.
+ */
+static bool
+getVarint(const unsigned char** in, const unsigned char* end, uint32_t* value)
+{
+  uint32_t result = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (*in >= end) {
+      return false;
+    }
+    unsigned char byte = *(*in)++;
+    result |= (uint32_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* ************************* UNIT_TEST ****************************** */
+/* 
+ * This unit test checks the encoders and decoders against each other,
+ * and feeds the decoders the malformed input a peer could send.
+ * Compile with -DUNIT_TEST (see the Makefile) and run ./wiretest; it
+ * prints each failed check and exits with the number of failures.
+ */
+
+#ifdef UNIT_TEST
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  do { if (!(cond)) { printf("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+static void testRle(void);
+static void testVarints(void);
+static void testDisplay(void);
+static void testState(void);
+
+int
+main(void)
+{
+  testRle();
+  testVarints();
+  testDisplay();
+  testState();
+  printf("wiretest: %d failures\n", failures);
+  return failures;
+}
+
+/**************** rleRoundTrip ****************/
+/* Encode 'count' cells, check the encoding is no longer than the worst
+ * case, and that it decodes to the same cells.
+ */
+static void
+rleRoundTrip(const char* cells, const size_t count)
+{
+  unsigned char packed[2 * 600];
+  char back[600];
+  size_t n = wire_rleEncode(cells, count, packed, sizeof(packed));
+  CHECK(n > 0 && n <= 2 * count);
+  CHECK(wire_rleDecode(packed, n, back, count));
+  CHECK(memcmp(cells, back, count) == 0);
+  // one cell short or over is refused
+  CHECK(!wire_rleDecode(packed, n, back, count - 1));
+  CHECK(!wire_rleDecode(packed, n, back, count + 1));
+}
+
+/**************** testRle ****************/
+static void
+testRle(void)
+{
+  char cells[600];
+
+  // runs of exactly 128 (one run byte) and 129 (a run, then a literal)
+  memset(cells, '.', 128);
+  rleRoundTrip(cells, 128);
+  unsigned char packed[16];
+  CHECK(wire_rleEncode(cells, 128, packed, sizeof(packed)) == 2);
+  CHECK(packed[0] == 0xFF && packed[1] == '.');
+  memset(cells, '.', 129);
+  rleRoundTrip(cells, 129);
+  CHECK(wire_rleEncode(cells, 129, packed, sizeof(packed)) == 3);
+
+  // cells of 0x80 and above are always sent as runs, even alone
+  for (int i = 0; i < 256; i++) {
+    cells[i] = (char)(255 - i);
+  }
+  rleRoundTrip(cells, 256);
+  cells[0] = (char)0x80;
+  cells[1] = 'a';
+  cells[2] = (char)0xFF;
+  cells[3] = (char)0xFF;
+  rleRoundTrip(cells, 4);
+
+  // a mix of short and long runs
+  for (int i = 0; i < 600; i++) {
+    cells[i] = "..#|-+ *"[(i / (1 + i % 7)) % 8];
+  }
+  rleRoundTrip(cells, 600);
+
+  // too small a buffer is refused, not overrun
+  memset(cells, 'x', 10);
+  CHECK(wire_rleEncode(cells, 10, packed, 1) == 0);
+  CHECK(wire_rleEncode("abc", 3, packed, 2) == 0);
+
+  // a run byte with no cell after it, and a run past the end
+  char back[8];
+  unsigned char cut[] = { 'a', 0x83 };
+  CHECK(!wire_rleDecode(cut, sizeof(cut), back, 5));
+  unsigned char over[] = { 0x87, 'a' };
+  CHECK(!wire_rleDecode(over, sizeof(over), back, 4));
+}
+
+/**************** testVarints ****************/
+static void
+testVarints(void)
+{
+  wire_frame_t frame;
+  unsigned char buf[32];
+  const uint32_t values[] = { 0, 1, 127, 128, 16383, 16384, UINT32_MAX };
+  for (int i = 0; i < (int)(sizeof(values) / sizeof(values[0])); i++) {
+    size_t n = wire_encodeGold(buf, values[i], 2, values[i]);
+    CHECK(wire_decode(buf, n, &frame) && frame.type == wire_Gold);
+    CHECK(frame.a == values[i] && frame.b == 2 && frame.c == values[i]);
+    // every shorter prefix is truncated somewhere
+    for (size_t k = 1; k < n; k++) {
+      CHECK(!wire_decode(buf, k, &frame));
+    }
+  }
+
+  // a varint that never ends, and one too long for 32 bits
+  unsigned char endless[] = { wire_Grid, 0x80, 0x80, 0x80 };
+  CHECK(!wire_decode(endless, sizeof(endless), &frame));
+  unsigned char huge[] = { wire_Grid, 0x80, 0x80, 0x80, 0x80, 0x80, 0x01, 0x01 };
+  CHECK(!wire_decode(huge, sizeof(huge), &frame));
+
+  // KEY: the flags, the number, then the key; trailing bytes are refused
+  size_t n = wire_encodeKey(buf, 'h', true, 300);
+  CHECK(wire_decode(buf, n, &frame) && frame.letter == 'h' && frame.hasSeq && frame.seq == 300);
+  for (size_t k = 1; k < n; k++) {
+    CHECK(!wire_decode(buf, k, &frame));
+  }
+  buf[n] = 'x';
+  CHECK(!wire_decode(buf, n + 1, &frame));
+
+  // unknown types, and text
+  unsigned char unknown[] = { 0x9F, 0 };
+  CHECK(!wire_decode(unknown, sizeof(unknown), &frame));
+  CHECK(!wire_decode("GOLD 1 2 3", 10, &frame));
+}
+
+/**************** testDisplay ****************/
+static void
+testDisplay(void)
+{
+  wire_frame_t frame;
+  unsigned char buf[256];
+  char cells[6 * 20];
+  char back[6 * 20];
+  for (int i = 0; i < 6 * 20; i++) {
+    cells[i] = (i % 20 < 10) ? ' ' : ".#*A"[i % 4];
+  }
+
+  // compressed and plain frames decode to the same cells
+  for (int rle = 0; rle <= 1; rle++) {
+    size_t n = wire_encodeView(buf, sizeof(buf), rle, true, 9, 3, 4, 6, 20, cells);
+    CHECK(n > 0 && wire_decode(buf, n, &frame) && frame.type == wire_Display);
+    CHECK(frame.rle == rle && frame.seq == 9 && frame.hasView);
+    CHECK(frame.top == 3 && frame.left == 4 && frame.a == 6 && frame.b == 20);
+    CHECK(wire_decodeCells(&frame, back) && memcmp(cells, back, sizeof(cells)) == 0);
+  }
+
+  // sent as they are, the cells must be exactly rows*cols
+  size_t n = wire_encodeDisplay(buf, sizeof(buf), false, false, 0, 6, 20, cells);
+  CHECK(wire_decode(buf, n, &frame));
+  CHECK(!wire_decode(buf, n - 1, &frame));
+  buf[n] = ' ';
+  CHECK(!wire_decode(buf, n + 1, &frame));
+  unsigned char lies[] = { wire_Display, 0, 2, 2, 'a', 'b', 'c' };
+  CHECK(!wire_decode(lies, sizeof(lies), &frame));
+  unsigned char overflow[] = { wire_Display, 0, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F,
+                               0xFF, 0xFF, 0xFF, 0xFF, 0x0F, 'a' };
+  CHECK(!wire_decode(overflow, sizeof(overflow), &frame));
+
+  // compressed cells that do not make rows*cols are caught by
+  // wire_decodeCells, which the caller needs anyway
+  unsigned char shortRle[] = { wire_Display, wire_FlagRle, 2, 2, 0x82, 'a' };
+  CHECK(wire_decode(shortRle, sizeof(shortRle), &frame));
+  CHECK(!wire_decodeCells(&frame, back));
+
+  // too small a buffer to encode into
+  CHECK(wire_encodeDisplay(buf, 16, false, false, 0, 6, 20, cells) == 0);
+  CHECK(wire_encodeDisplay(buf, 40, false, false, 0, 6, 20, cells) == 0);
+}
+
+/**************** testState ****************/
+static void
+testState(void)
+{
+  wire_frame_t frame;
+  unsigned char buf[256];
+  char cells[4 * 5];
+  char back[4 * 5];
+  memset(cells, '.', sizeof(cells));
+  cells[7] = '@';
+
+  size_t head = wire_encodeState(buf, 5, 10, 200);
+  size_t n = head + wire_encodeDisplay(buf + head, sizeof(buf) - head,
+                                       true, true, 42, 4, 5, cells);
+  CHECK(wire_decode(buf, n, &frame) && frame.type == wire_State);
+  CHECK(frame.gold[0] == 5 && frame.gold[1] == 10 && frame.gold[2] == 200);
+  CHECK(frame.seq == 42 && frame.a == 4 && frame.b == 5);
+  CHECK(wire_decodeCells(&frame, back) && memcmp(cells, back, sizeof(cells)) == 0);
+  // a cut in the compressed cells gets past wire_decode, not the cells
+  for (size_t k = 1; k < n; k++) {
+    CHECK(!wire_decode(buf, k, &frame) || !wire_decodeCells(&frame, back));
+  }
+
+  // the gold, then something other than a DISPLAY
+  unsigned char notDisplay[] = { wire_State, 1, 2, 3, wire_Gold, 1, 2, 3 };
+  CHECK(!wire_decode(notDisplay, sizeof(notDisplay), &frame));
+  unsigned char nested[] = { wire_State, 1, 2, 3, wire_State, 1, 2, 3,
+                             wire_Display, 0, 1, 1, 'a' };
+  CHECK(!wire_decode(nested, sizeof(nested), &frame));
+
+  // a malformed DISPLAY inside: too few cells, a cut varint, nothing
+  unsigned char fewCells[] = { wire_State, 1, 2, 3, wire_Display, 0, 2, 2, 'a' };
+  CHECK(!wire_decode(fewCells, sizeof(fewCells), &frame));
+  unsigned char cutVarint[] = { wire_State, 1, 2, 3, wire_Display, wire_FlagSeq, 0x80 };
+  CHECK(!wire_decode(cutVarint, sizeof(cutVarint), &frame));
+  unsigned char empty[] = { wire_State, 1, 2, 3 };
+  CHECK(!wire_decode(empty, sizeof(empty), &frame));
+}
+
+#endif // UNIT_TEST
@@ -0,0 +1,234 @@
+/*
+ * wire - protocol options and the compact binary encoding of messages
+ *
+ * The Nuggets protocol is plain text.  A client may offer protocol options
+ * by sending, before PLAY or SPECTATE,
+ *   CAPS opt1 opt2 ...
+ * and a server that knows the CAPS message answers
+ *   CAPS opt1 ...
+ * listing the options it accepts; it then uses those options for that
+ * client, and only those.  A server that does not know CAPS answers with
+ * an ERROR, and both sides carry on with the plain text protocol.  Names
+ * the receiver does not recognize are ignored, so options can be added
+ * without breaking older peers.
+ *
+ * Option "binary" replaces the frequent small messages (OK, GRID, GOLD,
+ * DISPLAY, and KEY from the client) with binary frames, sent with
+ * message_sendBytes.  A frame starts with a type byte that has the high
+ * bit set -- never the case for a text message -- followed by unsigned
+ * integers in LEB128 varint form (7 bits per byte, low bits first, high
+ * bit set on all but the last byte):
+ *   OK       0x81 letter
+ *   GRID     0x82 rows cols
+ *   GOLD     0x83 n p r
+ *   DISPLAY  0x84 flags [seq] rows cols cells...
+ *   KEY      0x85 flags [seq] key
+ * where 'flags' bit 0 says a sequence number follows, and the DISPLAY
+ * cells are rows*cols bytes, row by row with no newlines.  Every other
+ * message stays text, and a peer that accepted "binary" must still accept
+ * text.
+ *
+ * Option "rle", accepted only together with "binary", lets the server
+ * run-length encode the cells of a binary DISPLAY, marked by 'flags' bit 1.
+ * Map cells are ASCII, so a byte below 0x80 is one cell, and a byte b of
+ * 0x80 or more is a run of (b & 0x7F) + 1 copies of the byte after it.
+ * Player maps are mostly long runs of blanks, walls and floor, so this
+ * shrinks a DISPLAY several times over for about the cost of a memcpy.
+ *
+ * Option "view" lets a client that cannot show the whole map report the
+ * size of its map area with
+ *   SIZE rows cols
+ * (again whenever it changes).  The server then sends, instead of DISPLAY,
+ * a window of at most that size around the player,
+ *   VIEW top left [seq]\n followed by the window's rows
+ * or, in binary, a DISPLAY frame with 'flags' bit 2 set and 'top left'
+ * after the sequence number; rows and cols are then the window's.  top and
+ * left place the window on the map.  A window as large as the map is sent
+ * as an ordinary DISPLAY.
+ *
+ * Option "state" lets the server send a player's GOLD and DISPLAY (or VIEW)
+ * in one message, since after every move it sends both:
+ *   STATE n p r\n followed by the DISPLAY or VIEW message
+ * or, in binary,
+ *   STATE    0x86 n p r followed by the DISPLAY frame
+ * The client applies both, and so draws the screen once.  GOLD alone and
+ * DISPLAY alone are still sent when only one of them changed.
+ *
+ * Option "seq" says the server numbers DISPLAYs with the last key it has
+ * handled ("DISPLAY seq", wire_FlagSeq) once the client numbers its keys,
+ * so a client can tell which of its predicted moves a DISPLAY reflects.
+ *
+ * Option "reliable" says the peer's message module handles the frames of
+ * message_sendReliable and message_sendLatest (see message.h), so the
+ * server can send it messages that must not be lost (OK, GRID, QUIT)
+ * reliably, and DISPLAY and GOLD as the latest state on their own channels.
+ *
+ * CS50 Nuggets, Team 10
+ */
+
+#ifndef _WIRE_H_
+#define _WIRE_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/****************** constants *********************/
+// protocol options, as bits of a 'caps' set
+typedef enum wire_cap {
+  wire_CapBinary = 0x01,   // "binary"
+  wire_CapRle = 0x02,      // "rle"
+  wire_CapReliable = 0x04, // "reliable"
+  wire_CapView = 0x08,     // "view"
+  wire_CapState = 0x10,    // "state"
+  wire_CapSeq = 0x20,      // "seq": each DISPLAY carries the last key number handled
+} wire_cap_t;
+
+// binary frame types
+typedef enum wire_type {
+  wire_Ok = 0x81,
+  wire_Grid = 0x82,
+  wire_Gold = 0x83,
+  wire_Display = 0x84,
+  wire_Key = 0x85,
+  wire_State = 0x86,
+} wire_type_t;
+
+// frame flags
+static const int wire_FlagSeq = 0x01;     // a sequence number follows
+static const int wire_FlagRle = 0x02;     // DISPLAY: the cells are run-length encoded
+static const int wire_FlagView = 0x04;    // DISPLAY: a window; its place follows
+
+// the longest header a binary DISPLAY can have
+static const int wire_MaxHeader = 32;
+
+/****************** types *********************/
+/* A decoded binary frame.  'cells' points into the frame that was
+ * decoded; nothing is copied.
+ */
+typedef struct wire_frame {
+  wire_type_t type;
+  bool hasSeq;            // DISPLAY, STATE, KEY: is 'seq' present?
+  uint32_t seq;
+  uint32_t a, b, c;       // GRID: rows cols; GOLD: n p r; DISPLAY, STATE: rows cols
+  uint32_t gold[3];       // STATE: n p r
+  bool hasView;           // DISPLAY, STATE: is it a window at 'top', 'left'?
+  uint32_t top, left;
+  char letter;            // OK: the player's letter; KEY: the key
+  bool rle;               // DISPLAY: are the cells run-length encoded?
+  const char* cells;      // DISPLAY: the cells, as sent
+  size_t length;          // DISPLAY: bytes at 'cells'
+} wire_frame_t;
+
+/****************** global functions *********************/
+
+/******************************************/
+/* wire_parseCaps: parse the option names after "CAPS ".
+ * Caller provides: a string of space-separated option names.
+ * Function returns: the set of options recognized.
+ */
+int wire_parseCaps(const char* names);
+
+/******************************************/
+/* wire_formatCaps: write the message "CAPS name ..." for a set of options.
+ * Caller provides: the options, and a buffer and its size.
+ * Function returns: the buffer.
+ */
+char* wire_formatCaps(const int caps, char* buf, const size_t size);
+
+/******************************************/
+/* wire_isBinary: is this message a binary frame?
+ * Caller provides: the message (at least one byte long).
+ */
+bool wire_isBinary(const void* message);
+
+/******************************************/
+/* wire_putVarint: append a varint to 'out'.
+ * Caller provides: room for at least 5 bytes at 'out'.
+ * Function returns: the number of bytes written.
+ */
+size_t wire_putVarint(unsigned char* out, uint32_t value);
+
+/******************************************/
+/* wire_encodeOk, wire_encodeGrid, wire_encodeGold, wire_encodeKey:
+ * encode the small frames.
+ * Caller provides: a buffer of at least 32 bytes, and the values.
+ * Function returns: the length of the frame.
+ */
+size_t wire_encodeOk(unsigned char* out, const char letter);
+size_t wire_encodeGrid(unsigned char* out, const int rows, const int cols);
+size_t wire_encodeGold(unsigned char* out, const int n, const int p, const int r);
+size_t wire_encodeKey(unsigned char* out, const char key,
+                      const bool hasSeq, const uint32_t seq);
+
+/******************************************/
+/* wire_encodeState: encode the start of a STATE frame; the DISPLAY frame
+ *   (from wire_encodeDisplay or wire_encodeView) follows it.
+ * Caller provides: a buffer of at least 32 bytes, and the gold values.
+ * Function returns: the length written.
+ */
+size_t wire_encodeState(unsigned char* out, const int n, const int p, const int r);
+
+/******************************************/
+/* wire_encodeDisplay: encode a DISPLAY frame.
+ * Caller provides:
+ *   a buffer and its size,
+ *   whether to run-length encode the cells,
+ *   whether to include a sequence number, and the number,
+ *   the grid size and its rows*cols cells.
+ * Function returns: the length of the frame, or 0 if it does not fit.
+ *   If the run-length encoded cells would not fit, or would be no
+ *   smaller, the cells are sent as they are.
+ */
+size_t wire_encodeDisplay(unsigned char* out, const size_t size, const bool rle,
+                          const bool hasSeq, const uint32_t seq,
+                          const int rows, const int cols, const char* cells);
+
+/******************************************/
+/* wire_encodeView: encode a DISPLAY frame of a window on the map.
+ * Caller provides: as for wire_encodeDisplay, and the window's place on
+ *   the map; rows, cols and cells are the window's.
+ * Function returns: as for wire_encodeDisplay.
+ */
+size_t wire_encodeView(unsigned char* out, const size_t size, const bool rle,
+                       const bool hasSeq, const uint32_t seq,
+                       const int top, const int left,
+                       const int rows, const int cols, const char* cells);
+
+/******************************************/
+/* wire_decodeCells: copy the cells of a decoded DISPLAY frame into a grid.
+ * Caller provides: the frame, and room for rows*cols cells.
+ * Function returns: false if the cells do not make exactly rows*cols.
+ */
+bool wire_decodeCells(const wire_frame_t* frame, char* cells);
+
+/******************************************/
+/* wire_rleEncode: run-length encode 'count' cells (format above).
+ * Caller provides: the cells, and a buffer and its size.
+ * Function returns: the encoded length, or 0 if it does not fit.
+ */
+size_t wire_rleEncode(const char* cells, const size_t count,
+                      unsigned char* out, const size_t size);
+
+/******************************************/
+/* wire_rleDecode: decode run-length encoded cells.
+ * Caller provides: the encoded bytes and their length, and room for
+ *   'count' cells.
+ * Function returns: true if they decode to exactly 'count' cells.
+ */
+bool wire_rleDecode(const unsigned char* in, const size_t length,
+                    char* cells, const size_t count);
+
+/******************************************/
+/* wire_decode: decode a binary frame.
+ * Caller provides: the frame, its length, and a frame struct to fill in.
+ * Function returns:
+ *   true if the frame is well formed (for a DISPLAY sent as it is, that
+ *   includes holding exactly rows*cols cells), false otherwise.
+ *   A STATE frame is decoded as its DISPLAY, with type wire_State and the
+ *   gold in 'gold'.
+ */
+bool wire_decode(const void* message, const size_t length, wire_frame_t* frame);
+
+#endif // _WIRE_H_